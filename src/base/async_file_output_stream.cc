@@ -0,0 +1,185 @@
+#include "base/async_file_output_stream.h"
+#include "base/thread.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace cheaproute {
+
+AsyncFileOutputStream::AsyncFileOutputStream(int fd, bool take_fd_ownership,
+                                             AsyncOutputPolicy policy,
+                                             AsyncOutputFlags flags,
+                                             size_t buffer_size,
+                                             size_t buffer_count)
+  : file_(fd, take_fd_ownership),
+    policy_(policy),
+    flags_(flags),
+    buffer_size_(buffer_size),
+    buffers_(buffer_count, vector<uint8_t>(buffer_size)),
+    sizes_(buffer_count),
+    head_(0),
+    tail_(0),
+    fill_(0),
+    record_end_(0),
+    dropping_(false),
+    dropped_bytes_(0),
+    dropped_records_(0),
+    writer_waiting_(false),
+    producer_waiting_(false),
+    stopping_(false) {
+  assert(buffer_size > 0 && buffer_count > 0);
+  writer_thread_.reset(new Thread(
+      bind(&AsyncFileOutputStream::WriterMain, this)));
+  writer_thread_->Start();
+}
+
+AsyncFileOutputStream::~AsyncFileOutputStream() {
+  Flush();
+  if (fill_ > 0)
+    Publish(fill_);
+  
+  stopping_ = true;
+  __sync_synchronize();
+  {
+    MutexLock lock(&mutex_);
+    buffer_published_.Signal();
+  }
+  writer_thread_->Join();
+}
+
+void AsyncFileOutputStream::Write(const void* buf, size_t count) {
+  const uint8_t* src = static_cast<const uint8_t*>(buf);
+  while (count > 0) {
+    if (dropping_) {
+      Drop(count);
+      return;
+    }
+    
+    // There's never anything in the buffer being filled when the ring is
+    // full, so nothing written since the last Flush() has to be taken back
+    if (full() && !WaitForBuffer()) {
+      dropping_ = true;
+      continue;
+    }
+    
+    size_t copy_size = std::min(count, buffer_size_ - fill_);
+    memcpy(buffer(tail_) + fill_, src, copy_size);
+    fill_ += copy_size;
+    src += copy_size;
+    count -= copy_size;
+    if (fill_ == buffer_size_) {
+      // A record bigger than a buffer has to be split across buffers
+      if (record_end_ == 0)
+        Publish(fill_);
+      else
+        PublishRecords();
+    }
+  }
+}
+
+void AsyncFileOutputStream::Flush() {
+  if (dropping_) {
+    dropping_ = false;
+    if (policy_ == AsyncOutputPolicy_CountAndDrop)
+      dropped_records_++;
+    return;
+  }
+  record_end_ = fill_;
+  if (flags_ & AsyncOutputFlags_PublishOnFlush)
+    PublishRecords();
+}
+
+void AsyncFileOutputStream::PublishRecords() {
+  if (record_end_ == 0)
+    return;
+  size_t partial = fill_ - record_end_;
+  const uint8_t* carried = buffer(tail_) + record_end_;
+  Publish(record_end_);
+  if (partial == 0)
+    return;
+  
+  // What there is of the record being written moves to the next buffer.
+  // The writer thread only reads the buffer that was just published, so
+  // it's still intact even if there's only one buffer.
+  if (full() && !WaitForBuffer()) {
+    Drop(partial);
+    dropping_ = true;
+    return;
+  }
+  memmove(buffer(tail_), carried, partial);
+  fill_ = partial;
+}
+
+void AsyncFileOutputStream::Publish(size_t size) {
+  sizes_[tail_ % buffers_.size()] = size;
+  fill_ = 0;
+  record_end_ = 0;
+  __sync_synchronize();
+  tail_ = tail_ + 1;
+  __sync_synchronize();
+  
+  if (writer_waiting_) {
+    MutexLock lock(&mutex_);
+    buffer_published_.Signal();
+  }
+}
+
+bool AsyncFileOutputStream::WaitForBuffer() {
+  if (policy_ != AsyncOutputPolicy_Block)
+    return false;
+  
+  MutexLock lock(&mutex_);
+  producer_waiting_ = true;
+  __sync_synchronize();
+  while (full()) {
+    buffer_written_.Wait(&mutex_);
+  }
+  producer_waiting_ = false;
+  return true;
+}
+
+void AsyncFileOutputStream::Drop(size_t count) {
+  if (policy_ == AsyncOutputPolicy_CountAndDrop)
+    dropped_bytes_ += count;
+}
+
+void AsyncFileOutputStream::WriterMain() {
+  while (true) {
+    if (head_ == tail_) {
+      MutexLock lock(&mutex_);
+      writer_waiting_ = true;
+      __sync_synchronize();
+      while (head_ == tail_ && !stopping_) {
+        buffer_published_.Wait(&mutex_);
+      }
+      writer_waiting_ = false;
+      
+      // Only stop once everything has been written
+      if (head_ == tail_)
+        return;
+    }
+    
+    // Write out every buffer that's ready at once
+    size_t first = head_;
+    size_t tail = tail_;
+    size_t last = std::min(tail, first + kMaxBuffersPerWrite);
+    __sync_synchronize();
+    struct iovec pieces[kMaxBuffersPerWrite];
+    for (size_t i = first; i < last; i++) {
+      pieces[i - first].iov_base = buffer(i);
+      pieces[i - first].iov_len = sizes_[i % buffers_.size()];
+    }
+    file_.WriteV(pieces, static_cast<int>(last - first));
+    __sync_synchronize();
+    head_ = last;
+    __sync_synchronize();
+    
+    if (producer_waiting_) {
+      MutexLock lock(&mutex_);
+      buffer_written_.Signal();
+    }
+  }
+}
+
+}
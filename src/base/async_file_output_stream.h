@@ -0,0 +1,111 @@
+#pragma once
+
+#include "base/common.h"
+#include "base/mutex.h"
+#include "base/stream.h"
+
+namespace cheaproute {
+
+class Thread;
+
+// What an AsyncFileOutputStream does when its writer thread falls behind
+// and every buffer is waiting to be written
+enum AsyncOutputPolicy {
+  // Wait for the writer thread to free up a buffer
+  AsyncOutputPolicy_Block,
+  // Throw away whatever is written until the next Flush()
+  AsyncOutputPolicy_Drop,
+  // Like AsyncOutputPolicy_Drop, but keep count of what was thrown away
+  AsyncOutputPolicy_CountAndDrop
+};
+
+enum AsyncOutputFlags {
+  AsyncOutputFlags_None = 0,
+  // Hand over the buffer on every Flush(), for writers that only flush
+  // once they've built up plenty of data anyway
+  AsyncOutputFlags_PublishOnFlush = 1
+};
+
+// Writes to a file descriptor from a thread of its own, so whoever writes to
+// the stream never waits on a slow disk or pipe. Data is copied into a ring
+// of fixed-size buffers, and records are packed into a buffer until it
+// fills up or PublishRecords() is called. Handing a buffer over to the
+// writer thread doesn't take a lock unless the writer thread is asleep.
+//
+// Flush() marks the end of a record, but doesn't hand anything over by
+// itself (unless AsyncOutputFlags_PublishOnFlush is given); call
+// PublishRecords() every so often (from a timer or whenever the writing
+// thread runs out of work) so records don't wait for the buffer to fill.
+// When data is dropped, the rest of the record is dropped along with it, so
+// records that fit in one buffer are written either whole or not at all.
+// Only one thread may write to the stream at a time.
+class AsyncFileOutputStream : public OutputStream {
+public:
+  AsyncFileOutputStream(int fd, bool take_fd_ownership, 
+                        AsyncOutputPolicy policy,
+                        AsyncOutputFlags flags = AsyncOutputFlags_None,
+                        size_t buffer_size = 64 * 1024,
+                        size_t buffer_count = 32);
+  
+  // Writes out everything that was flushed (and anything that wasn't) and
+  // stops the writer thread
+  virtual ~AsyncFileOutputStream();
+  
+  void Write(const void* buf, size_t count);
+  void Flush();
+  
+  // Hands the records that were written in full so far to the writer
+  // thread. Must be called by the thread writing to the stream.
+  void PublishRecords();
+  
+  // Only kept up to date with AsyncOutputPolicy_CountAndDrop
+  uint64_t dropped_bytes() const { return dropped_bytes_; }
+  uint64_t dropped_records() const { return dropped_records_; }
+  
+private:
+  AsyncFileOutputStream(const AsyncFileOutputStream& other);
+  
+  bool full() const { return tail_ - head_ == buffers_.size(); }
+  uint8_t* buffer(size_t index) { return &buffers_[index % buffers_.size()][0]; }
+  
+  // How many buffers the writer thread writes out with one writev()
+  static const size_t kMaxBuffersPerWrite = 64;
+  
+  void Publish(size_t size);
+  bool WaitForBuffer();
+  void Drop(size_t count);
+  void WriterMain();
+  
+  // Only used by the writer thread
+  FileOutputStream file_;
+  AsyncOutputPolicy policy_;
+  AsyncOutputFlags flags_;
+  size_t buffer_size_;
+  vector<vector<uint8_t> > buffers_;
+  vector<size_t> sizes_;
+  
+  // Buffers [head_, tail_) are waiting to be written; buffer tail_ is the
+  // one being filled, if there's room for it. Only the writer thread
+  // moves head_, and only the writing thread moves tail_.
+  volatile size_t head_;
+  volatile size_t tail_;
+  size_t fill_;
+  // How much of buffer tail_ holds whole records; the record being
+  // written starts there
+  size_t record_end_;
+  bool dropping_;
+  uint64_t dropped_bytes_;
+  uint64_t dropped_records_;
+  
+  // Only used to sleep when there's nothing to do
+  Mutex mutex_;
+  ConditionVariable buffer_published_;
+  ConditionVariable buffer_written_;
+  volatile bool writer_waiting_;
+  volatile bool producer_waiting_;
+  volatile bool stopping_;
+  
+  scoped_ptr<Thread> writer_thread_;
+};
+
+}
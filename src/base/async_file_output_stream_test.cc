@@ -0,0 +1,168 @@
+#include "base/common.h"
+
+#include "gtest/gtest.h"
+
+#include "base/async_file_output_stream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace cheaproute {
+
+static string ReadAll(int fd) {
+  string result;
+  char buffer[4096];
+  ssize_t bytes_read;
+  while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
+    result.append(buffer, bytes_read);
+  }
+  return result;
+}
+
+TEST(AsyncFileOutputStreamTest, BlockingWritesEverythingInOrder) {
+  char path[] = "/tmp/cheaproute-async-test-XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_NE(-1, fd);
+  
+  string expected;
+  {
+    // Small buffers, so the writer thread falls behind now and then
+    AsyncFileOutputStream stream(fd, false, AsyncOutputPolicy_Block,
+                                 AsyncOutputFlags_None, 16, 2);
+    for (int i = 0; i < 10000; i++) {
+      string record = StrPrintf("record %d\n", i);
+      stream.Write(record.data(), record.size());
+      if (i % 3 == 0)
+        stream.Flush();
+      expected += record;
+    }
+  }
+  
+  lseek(fd, 0, SEEK_SET);
+  ASSERT_EQ(expected, ReadAll(fd));
+  close(fd);
+  unlink(path);
+}
+
+// Gives the writer thread a second to write something out, and returns it.
+// The file is opened again so reading it doesn't move the writer's offset.
+static string WaitForContents(const char* path) {
+  int fd = open(path, O_RDONLY);
+  assert(fd != -1);
+  string result;
+  for (int i = 0; i < 1000 && result.empty(); i++) {
+    usleep(1000);
+    result = ReadAll(fd);
+  }
+  close(fd);
+  return result;
+}
+
+TEST(AsyncFileOutputStreamTest, PublishesOnlyWholeRecords) {
+  char path[] = "/tmp/cheaproute-async-test-XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_NE(-1, fd);
+  
+  {
+    AsyncFileOutputStream stream(fd, false, AsyncOutputPolicy_Block,
+                                 AsyncOutputFlags_None, 64, 2);
+    stream.Write("first\n", 6);
+    stream.Flush();
+    stream.Write("sec", 3);
+    stream.PublishRecords();
+    
+    ASSERT_EQ("first\n", WaitForContents(path));
+    
+    stream.Write("ond\n", 4);
+    stream.Flush();
+  }
+  
+  lseek(fd, 0, SEEK_SET);
+  ASSERT_EQ("first\nsecond\n", ReadAll(fd));
+  close(fd);
+  unlink(path);
+}
+
+TEST(AsyncFileOutputStreamTest, PublishesOnFlushIfAsked) {
+  char path[] = "/tmp/cheaproute-async-test-XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_NE(-1, fd);
+  
+  {
+    AsyncFileOutputStream stream(fd, false, AsyncOutputPolicy_Block,
+                                 AsyncOutputFlags_PublishOnFlush, 64, 2);
+    stream.Write("first\n", 6);
+    stream.Flush();
+    ASSERT_EQ("first\n", WaitForContents(path));
+  }
+  close(fd);
+  unlink(path);
+}
+
+// Fills the pipe up, so the next write to it blocks
+static size_t FillPipe(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  size_t total = 0;
+  char buffer[4096] = { 0 };
+  size_t chunk = sizeof(buffer);
+  while (chunk > 0) {
+    ssize_t written = write(fd, buffer, chunk);
+    if (written > 0) {
+      total += written;
+    } else {
+      assert(errno == EAGAIN);
+      chunk /= 2;
+    }
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  return total;
+}
+
+static void TestDropping(AsyncOutputPolicy policy, uint64_t expected_bytes, 
+                         uint64_t expected_records) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  size_t filled = FillPipe(fds[1]);
+  
+  {
+    AsyncFileOutputStream stream(fds[1], true, policy, AsyncOutputFlags_None,
+                                 8, 2);
+    
+    // Records are packed until a buffer fills up. The writer thread gets
+    // stuck writing the first buffer, so the second is the last one
+    // there's room for.
+    stream.Write("first\n", 6);
+    stream.Flush();
+    stream.Write("second\n", 7);
+    stream.Flush();
+    stream.Write("third\n", 6);
+    stream.Write("more\n", 5);
+    stream.Flush();
+    ASSERT_EQ(expected_bytes, stream.dropped_bytes());
+    ASSERT_EQ(expected_records, stream.dropped_records());
+    
+    vector<char> buffer(filled);
+    size_t drained = 0;
+    while (drained < filled) {
+      ssize_t bytes_read = read(fds[0], &buffer[drained], filled - drained);
+      ASSERT_LT(0, bytes_read);
+      drained += bytes_read;
+    }
+  }
+  
+  ASSERT_EQ("first\nsecond\n", ReadAll(fds[0]));
+  close(fds[0]);
+}
+
+TEST(AsyncFileOutputStreamTest, DropsRecordsWhenBehind) {
+  TestDropping(AsyncOutputPolicy_Drop, 0, 0);
+}
+
+TEST(AsyncFileOutputStreamTest, CountsDroppedRecords) {
+  TestDropping(AsyncOutputPolicy_CountAndDrop, 11, 1);
+}
+
+}
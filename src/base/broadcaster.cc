@@ -1,7 +1,8 @@
-
 #include "base/common.h"
 
 #include "base/broadcaster.h"
 namespace cheaproute {
   
+__thread int tls_broadcast_depth = 0;
+
 }
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "base/common.h"
+#include "base/mutex.h"
+
+#include <sched.h>
 #include <algorithm>
 
 namespace cheaproute {
@@ -15,24 +18,166 @@ namespace {
   class MyListenerHandle ;
 }
 
+// How many broadcasts (of any Broadcaster) the current thread is in the
+// middle of
+extern __thread int tls_broadcast_depth;
+
+// Calls an action on every registered listener. Broadcast() may be called
+// from any number of threads at once, and never takes a lock or waits: it
+// walks an immutable snapshot of the listener list. Adding or removing a
+// listener (from any thread) publishes a new snapshot and waits for
+// broadcasts still walking the old one to finish before freeing it, RCU
+// style. Once a listener's handle has been destroyed, the listener won't
+// be called again, so it's safe to destroy the listener right after.
+//
+// The one exception is a handle destroyed from within a broadcast, which
+// can't wait for broadcasts to finish without waiting on itself. The
+// listener is skipped by the rest of that broadcast (and any later ones),
+// but broadcasts already running on other threads may still call it.
 template<typename TListener>
 class Broadcaster : public enable_shared_from_this<Broadcaster<TListener> > {
 public:
+  Broadcaster()
+    : snapshot_(new Snapshot()),
+      epoch_(0) {
+    readers_[0] = 0;
+    readers_[1] = 0;
+  }
+  
+  ~Broadcaster() {
+    assert(readers_[0] == 0 && readers_[1] == 0);
+    FreeRetired(&retired_);
+    for (size_t i = 0; i < snapshot_->size(); i++) {
+      delete (*snapshot_)[i];
+    }
+    delete snapshot_;
+  }
+  
   template<typename TAction>
   void Broadcast(TAction action) {
-    for (typename vector<TListener*>::iterator i = listeners_.begin(); i != listeners_.end(); i++) {
-      action(*i);
+    unsigned epoch = epoch_ & 1;
+    // A full barrier, so the snapshot is loaded after we're counted
+    __sync_fetch_and_add(&readers_[epoch], 1);
+    tls_broadcast_depth++;
+    
+    const Snapshot* snapshot = snapshot_;
+    for (typename Snapshot::const_iterator i = snapshot->begin(); 
+         i != snapshot->end(); i++) {
+      if (!(*i)->removed)
+        action((*i)->listener);
     }
+    
+    tls_broadcast_depth--;
+    __sync_fetch_and_sub(&readers_[epoch], 1);
   }
   
   shared_ptr<ListenerHandle> AddListener(TListener* listener);
   
 private:
+  struct Entry {
+    explicit Entry(TListener* listener)
+      : listener(listener),
+        removed(false) {
+    }
+    
+    TListener* listener;
+    volatile bool removed;
+  };
+  typedef vector<Entry*> Snapshot;
+  
+  // What can be freed once the broadcasts walking it are done
+  struct Retired {
+    vector<Snapshot*> snapshots;
+    vector<Entry*> entries;
+  };
+  
   void RemoveListener(TListener* listener) {
-    listeners_.erase(
-        std::remove(listeners_.begin(), listeners_.end(), listener));
+    Retired retired;
+    {
+      MutexLock lock(&writer_mutex_);
+      Snapshot* snapshot = new Snapshot();
+      snapshot->reserve(snapshot_->size());
+      for (size_t i = 0; i < snapshot_->size(); i++) {
+        Entry* entry = (*snapshot_)[i];
+        if (entry->listener == listener) {
+          entry->removed = true;
+          retired_.entries.push_back(entry);
+        } else {
+          snapshot->push_back(entry);
+        }
+      }
+      Publish(snapshot, &retired);
+    }
+    Reclaim(&retired);
+  }
+  
+  // Must be called with writer_mutex_ held. Moves everything retired so
+  // far into *retired, to be handed to Reclaim() once the lock is
+  // released.
+  void Publish(Snapshot* snapshot, Retired* retired) {
+    Snapshot* old_snapshot = snapshot_;
+    retired_.snapshots.push_back(old_snapshot);
+    __sync_synchronize();
+    snapshot_ = snapshot;
+    __sync_synchronize();
+    
+    // Leave the old snapshots for a later writer (or the destructor)
+    if (tls_broadcast_depth > 0)
+      return;
+    retired->snapshots.swap(retired_.snapshots);
+    retired->entries.swap(retired_.entries);
+  }
+  
+  // Waits for the broadcasts that might still be walking what was retired,
+  // then frees it. This happens without writer_mutex_, as a broadcast that
+  // adds or removes a listener would otherwise wait for the lock while
+  // we're waiting for it.
+  void Reclaim(Retired* retired) {
+    if (retired->snapshots.empty())
+      return;
+    {
+      MutexLock lock(&reclaim_mutex_);
+      WaitForReaders();
+    }
+    FreeRetired(retired);
   }
-  vector<TListener*> listeners_;
+  
+  // Waits for every broadcast that might have started before the last
+  // Publish() to finish. Flipping the epoch twice catches a reader that
+  // read the epoch just before the first flip but was counted after it.
+  // Must be called with reclaim_mutex_ held.
+  void WaitForReaders() {
+    for (int flip = 0; flip < 2; flip++) {
+      unsigned old_epoch = epoch_ & 1;
+      epoch_++;
+      __sync_synchronize();
+      while (readers_[old_epoch] != 0) {
+        sched_yield();
+      }
+    }
+  }
+  
+  static void FreeRetired(Retired* retired) {
+    for (size_t i = 0; i < retired->snapshots.size(); i++) {
+      delete retired->snapshots[i];
+    }
+    retired->snapshots.clear();
+    for (size_t i = 0; i < retired->entries.size(); i++) {
+      delete retired->entries[i];
+    }
+    retired->entries.clear();
+  }
+  
+  Snapshot* volatile snapshot_;
+  volatile unsigned epoch_;
+  volatile int readers_[2];
+  
+  // Serializes changes to the listener list, and guards retired_
+  Mutex writer_mutex_;
+  Retired retired_;
+  // Serializes WaitForReaders(), as writers flipping the epoch at the same
+  // time could both end up waiting on the same one
+  Mutex reclaim_mutex_;
   
   friend class MyListenerHandle<TListener>;
 };
@@ -62,11 +207,19 @@ template<typename TListener>
 shared_ptr<ListenerHandle> Broadcaster<TListener>::AddListener(TListener* listener)
 {
   CheckNotNull(listener, "listener");
-  assert(std::find(listeners_.begin(), listeners_.end(), listener) == 
-        listeners_.end());
-  listeners_.push_back(listener);
+  Retired retired;
+  {
+    MutexLock lock(&writer_mutex_);
+    Snapshot* snapshot = new Snapshot(*snapshot_);
+    for (size_t i = 0; i < snapshot->size(); i++) {
+      assert((*snapshot)[i]->listener != listener);
+    }
+    snapshot->push_back(new Entry(listener));
+    Publish(snapshot, &retired);
+  }
+  Reclaim(&retired);
   return shared_ptr<ListenerHandle>(
     new MyListenerHandle<TListener>(weak_ptr<Broadcaster<TListener> >(this->shared_from_this()), listener));
 }
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,130 @@
+// Compares dispatching a packet through Broadcaster (a bind object and a
+// virtual call per listener) against StaticBroadcaster, for 1, 2 and 8
+// listeners.
+
+#include "base/common.h"
+#include "base/broadcaster.h"
+#include "base/static_broadcaster.h"
+
+#include <stdio.h>
+#include <time.h>
+
+using namespace cheaproute;
+
+namespace {
+
+const size_t kPacketCount = 20000000;
+
+double Now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+}
+
+class PacketListener {
+public:
+  virtual ~PacketListener() {}
+  virtual void PacketReceived(const uint8_t* data, size_t size) = 0;
+};
+
+// Does just enough with each packet that the call can't be optimized away
+class ByteCounter : public PacketListener {
+public:
+  ByteCounter()
+    : bytes_(0) {
+  }
+  
+  virtual void PacketReceived(const uint8_t* data, size_t size) {
+    bytes_ += size + data[0];
+  }
+  
+  uint64_t bytes() const { return bytes_; }
+  
+private:
+  uint64_t bytes_;
+};
+
+struct PacketReceived {
+  PacketReceived(const uint8_t* data, size_t size)
+    : data(data),
+      size(size) {
+  }
+  
+  template<typename T>
+  void operator()(T* listener) const {
+    listener->T::PacketReceived(data, size);
+  }
+  
+  const uint8_t* data;
+  size_t size;
+};
+
+void Report(size_t listeners, const char* name, double seconds) {
+  printf("  %zu listener(s), %-20s %8.1f ms  %6.2f ns/packet\n", listeners, 
+         name, seconds * 1000, 
+         seconds * 1e9 / static_cast<double>(kPacketCount));
+}
+
+uint64_t TotalBytes(ByteCounter* counters, size_t count) {
+  uint64_t total = 0;
+  for (size_t i = 0; i < count; i++) {
+    total += counters[i].bytes();
+  }
+  return total;
+}
+
+void BenchmarkBroadcaster(size_t listener_count) {
+  ByteCounter counters[8];
+  shared_ptr<Broadcaster<PacketListener> > broadcaster(
+      new Broadcaster<PacketListener>());
+  vector<shared_ptr<ListenerHandle> > handles;
+  for (size_t i = 0; i < listener_count; i++) {
+    handles.push_back(broadcaster->AddListener(&counters[i]));
+  }
+  
+  uint8_t packet[1500] = { 1 };
+  double start = Now();
+  for (size_t i = 0; i < kPacketCount; i++) {
+    size_t size = 64 + (i & 1023);
+    broadcaster->Broadcast(bind(&PacketListener::PacketReceived, _1, 
+                                packet, size));
+  }
+  Report(listener_count, "Broadcaster", Now() - start);
+  assert(TotalBytes(counters, listener_count) > 0);
+}
+
+template<typename TBroadcaster>
+void RunStaticBroadcaster(size_t listener_count, 
+                          const TBroadcaster& broadcaster) {
+  uint8_t packet[1500] = { 1 };
+  double start = Now();
+  for (size_t i = 0; i < kPacketCount; i++) {
+    size_t size = 64 + (i & 1023);
+    broadcaster.Broadcast(PacketReceived(packet, size));
+  }
+  Report(listener_count, "StaticBroadcaster", Now() - start);
+}
+
+void BenchmarkStaticBroadcaster() {
+  ByteCounter c[8];
+  RunStaticBroadcaster(1, StaticBroadcaster<ByteCounter>(&c[0]));
+  RunStaticBroadcaster(2, StaticBroadcaster<ByteCounter, ByteCounter>(
+      &c[0], &c[1]));
+  RunStaticBroadcaster(8, StaticBroadcaster<
+      ByteCounter, ByteCounter, ByteCounter, ByteCounter,
+      ByteCounter, ByteCounter, ByteCounter, ByteCounter>(
+          &c[0], &c[1], &c[2], &c[3], &c[4], &c[5], &c[6], &c[7]));
+  printf("  (%llu bytes)\n", 
+         static_cast<unsigned long long>(TotalBytes(c, 8)));
+}
+
+}
+
+int main(int argc, const char* const argv[]) {
+  printf("%zu packets\n", kPacketCount);
+  BenchmarkBroadcaster(1);
+  BenchmarkBroadcaster(2);
+  BenchmarkBroadcaster(8);
+  BenchmarkStaticBroadcaster();
+  return 0;
+}
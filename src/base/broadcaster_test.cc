@@ -4,6 +4,7 @@
 #include "test_util/stream.h"
 
 #include "base/broadcaster.h"
+#include "base/thread.h"
 
 #include <sstream>
 
@@ -88,4 +89,196 @@ TEST(Broadcaster, BroadcasterDestroyedBeforeMultipleListeners) {
   ASSERT_EQ("Click(1, 2)\n", listener1->ToString());
   ASSERT_EQ("Click(1, 2)\n", listener2->ToString());
 }
-}
\ No newline at end of file
+
+// Drops another listener's handle (or its own) when it gets a click
+class RemovingListener : public MyListener {
+public:
+  explicit RemovingListener(Broadcaster<MyListener>* broadcaster)
+    : clicks_(0),
+      victim_(NULL) {
+    handle_ = broadcaster->AddListener(this);
+  }
+  
+  virtual void HandleClickEvent(int x, int y) {
+    clicks_++;
+    if (victim_)
+      victim_->reset();
+  }
+  
+  void set_victim(shared_ptr<ListenerHandle>* victim) { victim_ = victim; }
+  shared_ptr<ListenerHandle>* handle() { return &handle_; }
+  int clicks() const { return clicks_; }
+  
+private:
+  int clicks_;
+  shared_ptr<ListenerHandle>* victim_;
+  shared_ptr<ListenerHandle> handle_;
+};
+
+TEST(Broadcaster, ListenerRemovedDuringBroadcast) {
+  shared_ptr<Broadcaster<MyListener> > broadcaster(new Broadcaster<MyListener>());
+  
+  RemovingListener first(broadcaster.get());
+  RemovingListener second(broadcaster.get());
+  first.set_victim(second.handle());
+  second.set_victim(NULL);
+  
+  broadcaster->Broadcast(bind(&MyListener::HandleClickEvent, _1, 1, 2));
+  ASSERT_EQ(1, first.clicks());
+  ASSERT_EQ(0, second.clicks());
+  
+  // A listener removing itself
+  first.set_victim(first.handle());
+  broadcaster->Broadcast(bind(&MyListener::HandleClickEvent, _1, 1, 2));
+  broadcaster->Broadcast(bind(&MyListener::HandleClickEvent, _1, 1, 2));
+  ASSERT_EQ(2, first.clicks());
+}
+
+// Adds a FakeListener when it gets a click
+class AddingListener : public MyListener {
+public:
+  explicit AddingListener(Broadcaster<MyListener>* broadcaster)
+    : broadcaster_(broadcaster) {
+    handle_ = broadcaster->AddListener(this);
+  }
+  
+  virtual void HandleClickEvent(int x, int y) {
+    if (!added_)
+      added_.reset(new FakeListener(broadcaster_));
+  }
+  
+  FakeListener* added() { return added_.get(); }
+  
+private:
+  Broadcaster<MyListener>* broadcaster_;
+  shared_ptr<ListenerHandle> handle_;
+  scoped_ptr<FakeListener> added_;
+};
+
+TEST(Broadcaster, ListenerAddedDuringBroadcast) {
+  shared_ptr<Broadcaster<MyListener> > broadcaster(new Broadcaster<MyListener>());
+  
+  AddingListener adder(broadcaster.get());
+  broadcaster->Broadcast(bind(&MyListener::HandleClickEvent, _1, 1, 2));
+  ASSERT_TRUE(adder.added());
+  ASSERT_EQ("", adder.added()->ToString());
+  broadcaster->Broadcast(bind(&MyListener::HandleClickEvent, _1, 3, 4));
+  ASSERT_EQ("Click(3, 4)\n", adder.added()->ToString());
+}
+
+class CountingListener : public MyListener {
+public:
+  CountingListener()
+    : clicks_(0) {
+  }
+  
+  virtual void HandleClickEvent(int x, int y) {
+    __sync_fetch_and_add(&clicks_, 1);
+  }
+  
+  int clicks() const { return clicks_; }
+  
+private:
+  volatile int clicks_;
+};
+
+static void BroadcastUntilDone(Broadcaster<MyListener>* broadcaster, 
+                               volatile bool* done) {
+  while (!*done) {
+    broadcaster->Broadcast(bind(&MyListener::HandleClickEvent, _1, 1, 2));
+  }
+}
+
+TEST(Broadcaster, ListenersChangedWhileOtherThreadsBroadcast) {
+  shared_ptr<Broadcaster<MyListener> > broadcaster(new Broadcaster<MyListener>());
+  CountingListener permanent;
+  shared_ptr<ListenerHandle> permanent_handle = 
+      broadcaster->AddListener(&permanent);
+  
+  volatile bool done = false;
+  vector<shared_ptr<Thread> > threads;
+  for (int i = 0; i < 4; i++) {
+    threads.push_back(shared_ptr<Thread>(new Thread(
+        bind(&BroadcastUntilDone, broadcaster.get(), &done))));
+    threads.back()->Start();
+  }
+  
+  // Keep going until the other threads have really got going too
+  for (int i = 0; i < 1000 || permanent.clicks() < 1000; i++) {
+    // Once the handle is gone the listener must not be called again, so
+    // it can be destroyed right away
+    scoped_ptr<CountingListener> listener(new CountingListener());
+    shared_ptr<ListenerHandle> handle = broadcaster->AddListener(listener.get());
+    handle.reset();
+    listener.reset();
+  }
+  
+  done = true;
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i]->Join();
+  }
+  ASSERT_LT(0, permanent.clicks());
+}
+
+// On its first click, waits until another thread is adding a listener,
+// then adds one of its own from within the broadcast
+class RacingAddingListener : public MyListener {
+public:
+  explicit RacingAddingListener(Broadcaster<MyListener>* broadcaster)
+    : broadcaster_(broadcaster),
+      in_broadcast_(false),
+      other_writer_started_(false) {
+    handle_ = broadcaster->AddListener(this);
+  }
+  
+  virtual void HandleClickEvent(int x, int y) {
+    if (added_)
+      return;
+    in_broadcast_ = true;
+    while (!other_writer_started_) {
+      sched_yield();
+    }
+    // Give the other thread time to get to waiting for this broadcast
+    usleep(20000);
+    added_.reset(new FakeListener(broadcaster_));
+  }
+  
+  bool in_broadcast() const { return in_broadcast_; }
+  void set_other_writer_started() { other_writer_started_ = true; }
+  FakeListener* added() { return added_.get(); }
+  
+private:
+  Broadcaster<MyListener>* broadcaster_;
+  volatile bool in_broadcast_;
+  volatile bool other_writer_started_;
+  shared_ptr<ListenerHandle> handle_;
+  scoped_ptr<FakeListener> added_;
+};
+
+static void BroadcastOnce(Broadcaster<MyListener>* broadcaster) {
+  broadcaster->Broadcast(bind(&MyListener::HandleClickEvent, _1, 1, 2));
+}
+
+// A writer waiting for a broadcast to finish mustn't hold up that
+// broadcast if it adds a listener too
+TEST(Broadcaster, ListenerAddedDuringBroadcastWhileOtherThreadAdds) {
+  shared_ptr<Broadcaster<MyListener> > broadcaster(new Broadcaster<MyListener>());
+  RacingAddingListener adder(broadcaster.get());
+  
+  Thread thread(bind(&BroadcastOnce, broadcaster.get()));
+  thread.Start();
+  while (!adder.in_broadcast()) {
+    sched_yield();
+  }
+  adder.set_other_writer_started();
+  CountingListener listener;
+  shared_ptr<ListenerHandle> handle = broadcaster->AddListener(&listener);
+  thread.Join();
+  
+  ASSERT_TRUE(adder.added());
+  broadcaster->Broadcast(bind(&MyListener::HandleClickEvent, _1, 3, 4));
+  ASSERT_EQ("Click(3, 4)\n", adder.added()->ToString());
+  ASSERT_EQ(1, listener.clicks());
+}
+
+}
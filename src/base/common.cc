@@ -132,6 +132,8 @@ const char kHexChars[] = {'0', '1', '2', '3', '4', '5', '6', '7',
 
 string FormatHex(const void* ptr, size_t size) {
   string result;
+  // Two digits and a separator per byte, plus the gap in each line
+  result.reserve(size * 3 + size / 8);
   
   const uint8_t* p = static_cast<const uint8_t*>(ptr);
   const uint8_t* end = p + size;
@@ -25,6 +25,7 @@ namespace cheaproute
   using std::vector;
   using std::tr1::function;
   using std::tr1::bind;
+  using std::tr1::cref;
   using std::tr1::shared_ptr;
   using std::tr1::placeholders::_1;
   using std::tr1::enable_shared_from_this;
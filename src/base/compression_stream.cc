@@ -0,0 +1,543 @@
+#include "base/compression_stream.h"
+#include "base/mutex.h"
+#include "base/thread.h"
+
+#include <limits.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+
+namespace cheaproute {
+
+// How much uncompressed data goes in a chunk
+const size_t kCompressionChunkSize = 64 * 1024;
+
+// How many chunks may be waiting for (or, when reading, waiting after) the
+// helper thread
+const size_t kMaxQueuedCompressionChunks = 16;
+
+const uint8_t kGzipMagic[] = { 0x1f, 0x8b };
+const uint8_t kZstdMagic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+CompressionFormat DetectCompressionFormat(const void* data, size_t size) {
+  if (size >= sizeof(kGzipMagic) && 
+      memcmp(data, kGzipMagic, sizeof(kGzipMagic)) == 0)
+    return CompressionFormat_Gzip;
+  if (size >= sizeof(kZstdMagic) && 
+      memcmp(data, kZstdMagic, sizeof(kZstdMagic)) == 0)
+    return CompressionFormat_Zstd;
+  return CompressionFormat_None;
+}
+
+bool IsCompressionFormatSupported(CompressionFormat format) {
+  switch (format) {
+    case CompressionFormat_Gzip:
+      return true;
+    case CompressionFormat_Zstd:
+#ifdef HAVE_ZSTD
+      return true;
+#else
+      return false;
+#endif
+    default:
+      return false;
+  }
+}
+
+enum CompressorMode {
+  CompressorMode_Continue,
+  // Make everything compressed so far decodable
+  CompressorMode_Sync,
+  // End the compressed stream
+  CompressorMode_Finish
+};
+
+class Compressor {
+public:
+  virtual ~Compressor() {}
+  
+  // Appends the compressed output to *out
+  virtual void Compress(const uint8_t* data, size_t size, CompressorMode mode,
+                        vector<uint8_t>* out) = 0;
+};
+
+class Decompressor {
+public:
+  virtual ~Decompressor() {}
+  
+  // Decompresses from *data until *out reaches max_out bytes or the input
+  // runs out, moving *data and *size past the input that was used up
+  virtual void Decompress(const uint8_t** data, size_t* size, 
+                          vector<uint8_t>* out, size_t max_out) = 0;
+};
+
+class GzipCompressor : public Compressor {
+public:
+  GzipCompressor() {
+    memset(&stream_, 0, sizeof(stream_));
+    // 16 more window bits asks for a gzip header instead of a zlib one
+    int result = deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 
+                              15 + 16, 8, Z_DEFAULT_STRATEGY);
+    if (result != Z_OK)
+      AbortWithMessage("deflateInit2() failed: %d", result);
+  }
+  ~GzipCompressor() {
+    deflateEnd(&stream_);
+  }
+  
+  void Compress(const uint8_t* data, size_t size, CompressorMode mode,
+                vector<uint8_t>* out) {
+    assert(size <= UINT_MAX);
+    stream_.next_in = const_cast<Bytef*>(data);
+    stream_.avail_in = static_cast<uInt>(size);
+    
+    int flush = Z_NO_FLUSH;
+    if (mode == CompressorMode_Sync)
+      flush = Z_SYNC_FLUSH;
+    else if (mode == CompressorMode_Finish)
+      flush = Z_FINISH;
+    
+    // deflate() only stops short of using all the input (or finishing)
+    // when it runs out of room for output
+    do {
+      size_t old_size = out->size();
+      out->resize(old_size + kCompressionChunkSize);
+      stream_.next_out = &(*out)[old_size];
+      stream_.avail_out = static_cast<uInt>(kCompressionChunkSize);
+      int result = deflate(&stream_, flush);
+      if (result == Z_STREAM_ERROR)
+        AbortWithMessage("deflate() failed");
+      out->resize(out->size() - stream_.avail_out);
+    } while (stream_.avail_out == 0);
+  }
+  
+private:
+  z_stream stream_;
+};
+
+class GzipDecompressor : public Decompressor {
+public:
+  GzipDecompressor() {
+    memset(&stream_, 0, sizeof(stream_));
+    // 32 more window bits detects gzip or zlib headers
+    int result = inflateInit2(&stream_, 15 + 32);
+    if (result != Z_OK)
+      AbortWithMessage("inflateInit2() failed: %d", result);
+  }
+  ~GzipDecompressor() {
+    inflateEnd(&stream_);
+  }
+  
+  void Decompress(const uint8_t** data, size_t* size, vector<uint8_t>* out,
+                  size_t max_out) {
+    while (*size > 0 && out->size() < max_out) {
+      size_t in_size = std::min<size_t>(*size, UINT_MAX);
+      stream_.next_in = const_cast<Bytef*>(*data);
+      stream_.avail_in = static_cast<uInt>(in_size);
+      size_t old_size = out->size();
+      out->resize(max_out);
+      stream_.next_out = &(*out)[old_size];
+      stream_.avail_out = static_cast<uInt>(max_out - old_size);
+      
+      int result = inflate(&stream_, Z_NO_FLUSH);
+      size_t used = in_size - stream_.avail_in;
+      *data += used;
+      *size -= used;
+      out->resize(max_out - stream_.avail_out);
+      
+      if (result == Z_STREAM_END) {
+        // Another gzip member may follow
+        inflateReset(&stream_);
+      } else if (result != Z_OK) {
+        AbortWithMessage("Corrupt gzip stream (inflate() returned %d)", result);
+      }
+    }
+  }
+  
+private:
+  z_stream stream_;
+};
+
+#ifdef HAVE_ZSTD
+class ZstdCompressor : public Compressor {
+public:
+  ZstdCompressor()
+    : stream_(CheckNotNull(ZSTD_createCStream(), "ZSTD_createCStream()")) {
+    CheckZstdResult(ZSTD_initCStream(stream_, 3));
+  }
+  ~ZstdCompressor() {
+    ZSTD_freeCStream(stream_);
+  }
+  
+  void Compress(const uint8_t* data, size_t size, CompressorMode mode,
+                vector<uint8_t>* out) {
+    ZSTD_inBuffer input = { data, size, 0 };
+    while (input.pos < input.size) {
+      ZSTD_outBuffer output = Reserve(out);
+      CheckZstdResult(ZSTD_compressStream(stream_, &output, &input));
+      out->resize(out->size() - (output.size - output.pos));
+    }
+    
+    if (mode == CompressorMode_Continue)
+      return;
+    size_t remaining;
+    do {
+      ZSTD_outBuffer output = Reserve(out);
+      if (mode == CompressorMode_Sync)
+        remaining = CheckZstdResult(ZSTD_flushStream(stream_, &output));
+      else
+        remaining = CheckZstdResult(ZSTD_endStream(stream_, &output));
+      out->resize(out->size() - (output.size - output.pos));
+    } while (remaining > 0);
+  }
+  
+private:
+  static size_t CheckZstdResult(size_t result) {
+    if (ZSTD_isError(result))
+      AbortWithMessage("zstd compression failed: %s", 
+                       ZSTD_getErrorName(result));
+    return result;
+  }
+  
+  static ZSTD_outBuffer Reserve(vector<uint8_t>* out) {
+    size_t old_size = out->size();
+    out->resize(old_size + kCompressionChunkSize);
+    ZSTD_outBuffer output = { &(*out)[old_size], kCompressionChunkSize, 0 };
+    return output;
+  }
+  
+  ZSTD_CStream* stream_;
+};
+
+class ZstdDecompressor : public Decompressor {
+public:
+  ZstdDecompressor()
+    : stream_(CheckNotNull(ZSTD_createDStream(), "ZSTD_createDStream()")) {
+    ZSTD_initDStream(stream_);
+  }
+  ~ZstdDecompressor() {
+    ZSTD_freeDStream(stream_);
+  }
+  
+  // Concatenated frames are decompressed one after the other
+  void Decompress(const uint8_t** data, size_t* size, vector<uint8_t>* out,
+                  size_t max_out) {
+    while (*size > 0 && out->size() < max_out) {
+      ZSTD_inBuffer input = { *data, *size, 0 };
+      size_t old_size = out->size();
+      out->resize(max_out);
+      ZSTD_outBuffer output = { &(*out)[old_size], max_out - old_size, 0 };
+      size_t result = ZSTD_decompressStream(stream_, &output, &input);
+      if (ZSTD_isError(result))
+        AbortWithMessage("Corrupt zstd stream: %s", ZSTD_getErrorName(result));
+      *data += input.pos;
+      *size -= input.pos;
+      out->resize(old_size + output.pos);
+    }
+  }
+  
+private:
+  ZSTD_DStream* stream_;
+};
+#endif
+
+static Compressor* CreateCompressor(CompressionFormat format) {
+  switch (format) {
+    case CompressionFormat_Gzip:
+      return new GzipCompressor();
+#ifdef HAVE_ZSTD
+    case CompressionFormat_Zstd:
+      return new ZstdCompressor();
+#endif
+    default:
+      AbortWithMessage("Unsupported compression format %d", format);
+      return NULL;
+  }
+}
+
+static Decompressor* CreateDecompressor(CompressionFormat format) {
+  switch (format) {
+    case CompressionFormat_Gzip:
+      return new GzipDecompressor();
+#ifdef HAVE_ZSTD
+    case CompressionFormat_Zstd:
+      return new ZstdDecompressor();
+#endif
+    default:
+      AbortWithMessage("Unsupported compression format %d", format);
+      return NULL;
+  }
+}
+
+// A piece of data on its way between a compression stream's caller and its
+// helper thread
+struct CompressionChunk {
+  vector<uint8_t> data;
+  // The caller flushed the output stream while this chunk was being filled
+  bool flush;
+};
+
+// A queue of chunks that blocks the producer when it's full and the
+// consumer when it's empty. Used chunks are recycled.
+class CompressionChunkQueue {
+public:
+  explicit CompressionChunkQueue(size_t max_chunks)
+    : max_chunks_(max_chunks),
+      closed_(false) {
+  }
+  
+  ~CompressionChunkQueue() {
+    for (size_t i = 0; i < chunks_.size(); i++) {
+      delete chunks_[i];
+    }
+    for (size_t i = 0; i < free_chunks_.size(); i++) {
+      delete free_chunks_[i];
+    }
+  }
+  
+  // Returns an empty chunk
+  CompressionChunk* Allocate() {
+    MutexLock lock(&mutex_);
+    CompressionChunk* chunk;
+    if (free_chunks_.empty()) {
+      chunk = new CompressionChunk();
+      chunk->data.reserve(kCompressionChunkSize);
+    } else {
+      chunk = free_chunks_.back();
+      free_chunks_.pop_back();
+    }
+    chunk->data.clear();
+    chunk->flush = false;
+    return chunk;
+  }
+  
+  void Recycle(CompressionChunk* chunk) {
+    MutexLock lock(&mutex_);
+    free_chunks_.push_back(chunk);
+  }
+  
+  // Waits for room; returns false (and recycles the chunk) if the queue
+  // has been closed
+  bool Push(CompressionChunk* chunk) {
+    MutexLock lock(&mutex_);
+    while (chunks_.size() >= max_chunks_ && !closed_) {
+      chunk_popped_.Wait(&mutex_);
+    }
+    if (closed_) {
+      free_chunks_.push_back(chunk);
+      return false;
+    }
+    chunks_.push_back(chunk);
+    chunk_pushed_.Signal();
+    return true;
+  }
+  
+  // Waits for a chunk; returns NULL once the queue is closed and empty
+  CompressionChunk* Pop() {
+    MutexLock lock(&mutex_);
+    while (chunks_.empty() && !closed_) {
+      chunk_pushed_.Wait(&mutex_);
+    }
+    if (chunks_.empty())
+      return NULL;
+    CompressionChunk* chunk = chunks_.front();
+    chunks_.pop_front();
+    chunk_popped_.Signal();
+    return chunk;
+  }
+  
+  bool empty() {
+    MutexLock lock(&mutex_);
+    return chunks_.empty();
+  }
+  
+  // Wakes everything up; Push() fails from now on
+  void Close() {
+    MutexLock lock(&mutex_);
+    closed_ = true;
+    chunk_pushed_.Signal();
+    chunk_popped_.Signal();
+  }
+  
+private:
+  CompressionChunkQueue(const CompressionChunkQueue& other);
+  
+  size_t max_chunks_;
+  bool closed_;
+  deque<CompressionChunk*> chunks_;
+  vector<CompressionChunk*> free_chunks_;
+  Mutex mutex_;
+  ConditionVariable chunk_pushed_;
+  ConditionVariable chunk_popped_;
+};
+
+CompressingOutputStream::CompressingOutputStream(
+    shared_ptr<OutputStream> delegatee, CompressionFormat format)
+  : delegatee_(delegatee),
+    compressor_(CreateCompressor(format)),
+    queue_(new CompressionChunkQueue(kMaxQueuedCompressionChunks)) {
+  chunk_ = queue_->Allocate();
+  thread_.reset(new Thread(
+      bind(&CompressingOutputStream::CompressorMain, this)));
+  thread_->Start();
+}
+
+CompressingOutputStream::~CompressingOutputStream() {
+  if (!chunk_->data.empty())
+    HandOver();
+  queue_->Recycle(chunk_);
+  queue_->Close();
+  thread_->Join();
+}
+
+void CompressingOutputStream::Write(const void* buf, size_t count) {
+  const uint8_t* src = static_cast<const uint8_t*>(buf);
+  while (count > 0) {
+    size_t copy_size = std::min(count, 
+                                kCompressionChunkSize - chunk_->data.size());
+    chunk_->data.insert(chunk_->data.end(), src, src + copy_size);
+    src += copy_size;
+    count -= copy_size;
+    if (chunk_->data.size() == kCompressionChunkSize)
+      HandOver();
+  }
+}
+
+void CompressingOutputStream::Flush() {
+  // A stream flushed after every record would otherwise hand over lots of
+  // nearly empty chunks, and the queue only holds a few
+  if (!chunk_->data.empty())
+    chunk_->flush = true;
+}
+
+void CompressingOutputStream::HandOverFlushed() {
+  if (chunk_->flush)
+    HandOver();
+}
+
+void CompressingOutputStream::HandOver() {
+  queue_->Push(chunk_);
+  chunk_ = queue_->Allocate();
+}
+
+void CompressingOutputStream::CompressorMain() {
+  vector<uint8_t> output;
+  while (CompressionChunk* chunk = queue_->Pop()) {
+    // Only flush once there's nothing else to compress
+    bool sync = chunk->flush && queue_->empty();
+    output.clear();
+    compressor_->Compress(chunk->data.empty() ? NULL : &chunk->data[0], 
+                          chunk->data.size(), 
+                          sync ? CompressorMode_Sync : CompressorMode_Continue,
+                          &output);
+    queue_->Recycle(chunk);
+    
+    if (!output.empty())
+      delegatee_->Write(&output[0], output.size());
+    if (sync)
+      delegatee_->Flush();
+  }
+  
+  output.clear();
+  compressor_->Compress(NULL, 0, CompressorMode_Finish, &output);
+  if (!output.empty())
+    delegatee_->Write(&output[0], output.size());
+  delegatee_->Flush();
+}
+
+DecompressingInputStream::DecompressingInputStream(
+    shared_ptr<InputStream> delegatee, CompressionFormat format)
+  : delegatee_(delegatee),
+    decompressor_(CreateDecompressor(format)),
+    queue_(new CompressionChunkQueue(kMaxQueuedCompressionChunks)),
+    chunk_(NULL),
+    pos_(0),
+    finished_(false) {
+  thread_.reset(new Thread(
+      bind(&DecompressingInputStream::DecompressorMain, this)));
+  thread_->Start();
+}
+
+DecompressingInputStream::~DecompressingInputStream() {
+  queue_->Close();
+  thread_->Join();
+  if (chunk_)
+    queue_->Recycle(chunk_);
+}
+
+void DecompressingInputStream::NextChunk() {
+  while (!finished_ && (!chunk_ || pos_ == chunk_->data.size())) {
+    if (chunk_)
+      queue_->Recycle(chunk_);
+    chunk_ = queue_->Pop();
+    pos_ = 0;
+    if (!chunk_)
+      finished_ = true;
+  }
+}
+
+ssize_t DecompressingInputStream::Read(void* buf, size_t count) {
+  NextChunk();
+  if (finished_)
+    return 0;
+  size_t copy_size = std::min(count, chunk_->data.size() - pos_);
+  memcpy(buf, &chunk_->data[pos_], copy_size);
+  pos_ += copy_size;
+  return copy_size;
+}
+
+bool DecompressingInputStream::ReadSpan(const uint8_t** data, size_t* size) {
+  NextChunk();
+  if (finished_) {
+    *size = 0;
+    return true;
+  }
+  *data = &chunk_->data[pos_];
+  *size = chunk_->data.size() - pos_;
+  pos_ = chunk_->data.size();
+  return true;
+}
+
+void DecompressingInputStream::DecompressorMain() {
+  vector<uint8_t> buffer;
+  const uint8_t* input = NULL;
+  size_t input_size = 0;
+  bool end_of_input = false;
+  
+  while (true) {
+    if (input_size == 0 && !end_of_input) {
+      if (!delegatee_->ReadSpan(&input, &input_size)) {
+        buffer.resize(kCompressionChunkSize);
+        ssize_t bytes_read = delegatee_->Read(&buffer[0], buffer.size());
+        input = &buffer[0];
+        input_size = std::max<ssize_t>(0, bytes_read);
+      }
+      end_of_input = input_size == 0;
+    }
+    
+    CompressionChunk* chunk = queue_->Allocate();
+    size_t old_input_size = input_size;
+    decompressor_->Decompress(&input, &input_size, &chunk->data, 
+                              kCompressionChunkSize);
+    
+    if (chunk->data.empty()) {
+      queue_->Recycle(chunk);
+      if (end_of_input)
+        break;
+      if (input_size > 0 && input_size == old_input_size)
+        AbortWithMessage("Compressed stream isn't making progress");
+      continue;
+    }
+    
+    // The reader has gone away
+    if (!queue_->Push(chunk))
+      return;
+  }
+  queue_->Close();
+}
+
+}
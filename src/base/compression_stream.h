@@ -0,0 +1,91 @@
+#pragma once
+
+#include "base/common.h"
+#include "base/stream.h"
+
+namespace cheaproute {
+
+class Thread;
+class Compressor;
+class Decompressor;
+class CompressionChunkQueue;
+struct CompressionChunk;
+
+enum CompressionFormat {
+  CompressionFormat_None,
+  CompressionFormat_Gzip,
+  // Only available if cheaproute was built with libzstd
+  CompressionFormat_Zstd
+};
+
+// Tells which format a stream is in from its first few bytes (at least
+// four, to tell them all apart)
+CompressionFormat DetectCompressionFormat(const void* data, size_t size);
+
+bool IsCompressionFormatSupported(CompressionFormat format);
+
+// Compresses everything written to it on a helper thread and writes the
+// result to the delegatee (from that thread). Data is handed over a chunk
+// at a time, when a chunk fills up or HandOverFlushed() is called. Flush()
+// only marks a point that the compressed stream should be decodable up
+// to, without waiting for it to be compressed; the delegatee is only
+// flushed once the helper thread has caught up, so a busy stream isn't
+// broken up into lots of tiny compressed blocks. Destroying the stream
+// ends the compressed stream and waits for it to be written.
+class CompressingOutputStream : public OutputStream {
+public:
+  CompressingOutputStream(shared_ptr<OutputStream> delegatee, 
+                          CompressionFormat format);
+  virtual ~CompressingOutputStream();
+  
+  void Write(const void* buf, size_t count);
+  void Flush();
+  
+  // Hands over the chunk being filled if it's been flushed, so that it
+  // doesn't wait to fill up. Call this every so often (from a timer or
+  // whenever the writing thread runs out of work).
+  void HandOverFlushed();
+  
+private:
+  CompressingOutputStream(const CompressingOutputStream& other);
+  
+  void HandOver();
+  void CompressorMain();
+  
+  shared_ptr<OutputStream> delegatee_;
+  scoped_ptr<Compressor> compressor_;
+  scoped_ptr<CompressionChunkQueue> queue_;
+  CompressionChunk* chunk_;
+  scoped_ptr<Thread> thread_;
+};
+
+// Decompresses the delegatee on a helper thread, which stays a few chunks
+// ahead of the reader. Concatenated compressed streams are read as one,
+// like gunzip does. Supports ReadSpan(), so a BufferedInputStream reads
+// the decompressed chunks in place.
+class DecompressingInputStream : public InputStream {
+public:
+  DecompressingInputStream(shared_ptr<InputStream> delegatee,
+                           CompressionFormat format);
+  virtual ~DecompressingInputStream();
+  
+  ssize_t Read(void* buf, size_t count);
+  bool ReadSpan(const uint8_t** data, size_t* size);
+  
+private:
+  DecompressingInputStream(const DecompressingInputStream& other);
+  
+  // Makes sure there's something left in chunk_, unless the stream is over
+  void NextChunk();
+  void DecompressorMain();
+  
+  shared_ptr<InputStream> delegatee_;
+  scoped_ptr<Decompressor> decompressor_;
+  scoped_ptr<CompressionChunkQueue> queue_;
+  CompressionChunk* chunk_;
+  size_t pos_;
+  bool finished_;
+  scoped_ptr<Thread> thread_;
+};
+
+}
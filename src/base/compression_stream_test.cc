@@ -0,0 +1,164 @@
+#include "base/compression_stream.h"
+#include "base/mutex.h"
+
+#include "gtest/gtest.h"
+#include "test_util/stream.h"
+
+namespace cheaproute {
+
+// Somewhat compressible text spanning several compression chunks
+static string CreateTestData(size_t size) {
+  string result;
+  uint32_t state = 1;
+  while (result.size() < size) {
+    state = state * 1103515245 + 12345;
+    char line[64];
+    snprintf(line, sizeof(line), "packet %u\n", (state >> 16) % 1000);
+    result += line;
+  }
+  return result;
+}
+
+static string Compress(const string& data, CompressionFormat format) {
+  shared_ptr<MemoryOutputStream> compressed(new MemoryOutputStream());
+  {
+    CompressingOutputStream stream(compressed, format);
+    // Flushing in the middle mustn't break the stream up
+    stream.Write(data.data(), data.size() / 3);
+    stream.Flush();
+    stream.Write(data.data() + data.size() / 3, 
+                 data.size() - data.size() / 3);
+  }
+  return string(static_cast<const char*>(compressed->ptr()), 
+                compressed->size());
+}
+
+static string Decompress(const string& compressed, CompressionFormat format,
+                         size_t max_read_size) {
+  DecompressingInputStream stream(shared_ptr<InputStream>(
+    new FakeInputStream(max_read_size, compressed.data(), compressed.size())),
+    format);
+  
+  string result;
+  char buffer[1000];
+  while (ssize_t bytes_read = stream.Read(buffer, sizeof(buffer))) {
+    result.append(buffer, bytes_read);
+  }
+  return result;
+}
+
+// Collects what the compressing thread writes, so the test can wait for it
+// to flush
+class FlushRecordingOutputStream : public OutputStream {
+public:
+  FlushRecordingOutputStream() : flushes_(0) {}
+  
+  void Write(const void* buf, size_t count) {
+    MutexLock lock(&mutex_);
+    data_.append(static_cast<const char*>(buf), count);
+  }
+  void Flush() {
+    MutexLock lock(&mutex_);
+    flushes_++;
+    flushed_.Signal();
+  }
+  
+  // Waits for the first flush and returns what was written before it
+  string WaitForFlush() {
+    MutexLock lock(&mutex_);
+    while (flushes_ == 0) {
+      flushed_.Wait(&mutex_);
+    }
+    return data_;
+  }
+  
+private:
+  Mutex mutex_;
+  ConditionVariable flushed_;
+  string data_;
+  int flushes_;
+};
+
+TEST(CompressionStreamTest, HandsOverFlushedDataWhenAsked) {
+  shared_ptr<FlushRecordingOutputStream> compressed(
+      new FlushRecordingOutputStream());
+  CompressingOutputStream stream(compressed, CompressionFormat_Gzip);
+  
+  // Flushing only marks where the compressed stream has to be decodable
+  // up to, so both records go to the compressing thread together
+  stream.Write("first\n", 6);
+  stream.Flush();
+  stream.Write("second\n", 7);
+  stream.Flush();
+  stream.HandOverFlushed();
+  
+  ASSERT_EQ("first\nsecond\n", 
+            Decompress(compressed->WaitForFlush(), CompressionFormat_Gzip, 
+                       1000));
+}
+
+TEST(CompressionStreamTest, GzipRoundTrip) {
+  string data = CreateTestData(300000);
+  string compressed = Compress(data, CompressionFormat_Gzip);
+  ASSERT_LT(compressed.size(), data.size() / 2);
+  ASSERT_EQ(CompressionFormat_Gzip, 
+            DetectCompressionFormat(compressed.data(), compressed.size()));
+  
+  ASSERT_EQ(data, Decompress(compressed, CompressionFormat_Gzip, 1000000));
+  ASSERT_EQ(data, Decompress(compressed, CompressionFormat_Gzip, 7));
+}
+
+TEST(CompressionStreamTest, ConcatenatedStreams) {
+  string first = CreateTestData(1000);
+  string second = CreateTestData(100000);
+  string compressed = Compress(first, CompressionFormat_Gzip) + 
+                      Compress(second, CompressionFormat_Gzip);
+  
+  ASSERT_EQ(first + second, 
+            Decompress(compressed, CompressionFormat_Gzip, 1000000));
+}
+
+TEST(CompressionStreamTest, EmptyStream) {
+  string compressed = Compress("", CompressionFormat_Gzip);
+  ASSERT_EQ("", Decompress(compressed, CompressionFormat_Gzip, 1000000));
+}
+
+TEST(CompressionStreamTest, ReadSpan) {
+  string data = CreateTestData(200000);
+  string compressed = Compress(data, CompressionFormat_Gzip);
+  DecompressingInputStream stream(shared_ptr<InputStream>(
+    new MemoryInputStream(compressed.data(), compressed.size())), 
+    CompressionFormat_Gzip);
+  
+  string result;
+  const uint8_t* span;
+  size_t span_size;
+  do {
+    ASSERT_TRUE(stream.ReadSpan(&span, &span_size));
+    result.append(reinterpret_cast<const char*>(span), span_size);
+  } while (span_size > 0);
+  ASSERT_EQ(data, result);
+}
+
+TEST(CompressionStreamTest, DetectFormat) {
+  ASSERT_EQ(CompressionFormat_Gzip, DetectCompressionFormat("\x1f\x8b\x08", 3));
+  ASSERT_EQ(CompressionFormat_Zstd, 
+            DetectCompressionFormat("\x28\xb5\x2f\xfd", 4));
+  ASSERT_EQ(CompressionFormat_None, DetectCompressionFormat("{\"ti", 4));
+  ASSERT_EQ(CompressionFormat_None, DetectCompressionFormat("\x1f", 1));
+  ASSERT_TRUE(IsCompressionFormatSupported(CompressionFormat_Gzip));
+  ASSERT_FALSE(IsCompressionFormatSupported(CompressionFormat_None));
+}
+
+#ifdef HAVE_ZSTD
+TEST(CompressionStreamTest, ZstdRoundTrip) {
+  string data = CreateTestData(300000);
+  string compressed = Compress(data, CompressionFormat_Zstd) + 
+                      Compress(data, CompressionFormat_Zstd);
+  ASSERT_EQ(CompressionFormat_Zstd, 
+            DetectCompressionFormat(compressed.data(), compressed.size()));
+  ASSERT_EQ(data + data, Decompress(compressed, CompressionFormat_Zstd, 7));
+}
+#endif
+
+}
@@ -1,36 +1,230 @@
 
 #include "base/event_loop.h"
+#include "base/json_writer.h"
+#include "base/mpsc_queue.h"
 
 #include <ev.h>
+#include <math.h>
+#include <time.h>
+
+#include <algorithm>
 
 namespace cheaproute
 {
 
-class IoTask {
+static uint64_t MonotonicNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + 
+         static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// Records how long it was alive for in a CallbackStats
+class ScopedCallbackTiming {
+public:
+  explicit ScopedCallbackTiming(CallbackStats* stats)
+    : stats_(stats),
+      start_ns_(MonotonicNanos()) {
+  }
+  ~ScopedCallbackTiming() {
+    stats_->durations.Record(MonotonicNanos() - start_ns_);
+  }
+  
+private:
+  CallbackStats* stats_;
+  uint64_t start_ns_;
+};
+
+double EventLoopStats::utilization() const {
+  uint64_t total_ns = busy_ns + idle_ns;
+  if (total_ns == 0)
+    return 0;
+  return static_cast<double>(busy_ns) / static_cast<double>(total_ns);
+}
+
+// Keeps an EventLoop's stats. A check watcher with the highest priority
+// notes when each iteration's poll returns, and a prepare watcher with the
+// lowest priority notes when the loop is about to poll again, after every
+// other prepare hook has had its turn.
+class LoopInstrumentation {
+public:
+  explicit LoopInstrumentation(struct ev_loop* loop)
+    : loop_(loop),
+      timers_("timers"),
+      scheduled_tasks_("scheduled tasks"),
+      posted_tasks_("posted tasks"),
+      prepare_hooks_("prepare hooks"),
+      poll_returned_ns_(0),
+      poll_started_ns_(0) {
+    ev_check_init(&check_, &LoopInstrumentation::HandleCheck);
+    ev_set_priority(&check_, EV_MAXPRI);
+    check_.data = this;
+    ev_check_start(loop, &check_);
+    
+    ev_prepare_init(&prepare_, &LoopInstrumentation::HandlePrepare);
+    ev_set_priority(&prepare_, EV_MINPRI);
+    prepare_.data = this;
+    ev_prepare_start(loop, &prepare_);
+    
+    // Watching the loop shouldn't keep EventLoop::Run() from returning
+    ev_unref(loop);
+    ev_unref(loop);
+    
+    Register(&timers_);
+    Register(&scheduled_tasks_);
+    Register(&posted_tasks_);
+    Register(&prepare_hooks_);
+  }
+  
+  ~LoopInstrumentation() {
+    ev_ref(loop_);
+    ev_ref(loop_);
+    ev_check_stop(loop_, &check_);
+    ev_prepare_stop(loop_, &prepare_);
+  }
+  
+  void Register(CallbackStats* stats) {
+    callbacks_.push_back(stats);
+  }
+  void Unregister(CallbackStats* stats) {
+    callbacks_.erase(std::find(callbacks_.begin(), callbacks_.end(), stats));
+  }
+  
+  // expiry is in the millisecond ticks of the loop's TimerWheelDriver
+  void RecordTimerFired(uint64_t expiry) {
+    double lateness = ev_time() - static_cast<double>(expiry) / 1000;
+    stats_.timer_lateness_ns.Record(
+        static_cast<uint64_t>(std::max(0.0, lateness * 1e9)));
+  }
+  
+  CallbackStats* timers() { return &timers_; }
+  CallbackStats* scheduled_tasks() { return &scheduled_tasks_; }
+  CallbackStats* posted_tasks() { return &posted_tasks_; }
+  CallbackStats* prepare_hooks() { return &prepare_hooks_; }
+  
+  const EventLoopStats& stats() const { return stats_; }
+  
+  void GetCallbackStats(vector<CallbackStats>* stats) const {
+    for (size_t i = 0; i < callbacks_.size(); i++) {
+      stats->push_back(*callbacks_[i]);
+    }
+  }
+  
+  void Reset() {
+    stats_ = EventLoopStats();
+    for (size_t i = 0; i < callbacks_.size(); i++) {
+      callbacks_[i]->durations.Clear();
+    }
+  }
+  
+  void WriteJson(JsonWriter* writer) const {
+    writer->BeginObject();
+    writer->WritePropertyName("iterations");
+    writer->WriteInteger(static_cast<int64_t>(stats_.iterations));
+    writer->WritePropertyName("busy_ns");
+    writer->WriteInteger(static_cast<int64_t>(stats_.busy_ns));
+    writer->WritePropertyName("idle_ns");
+    writer->WriteInteger(static_cast<int64_t>(stats_.idle_ns));
+    writer->WritePropertyName("utilization");
+    writer->WriteDouble(stats_.utilization());
+    writer->WritePropertyName("iteration_busy_ns");
+    stats_.iteration_busy_ns.WriteJson(writer);
+    writer->WritePropertyName("timer_lateness_ns");
+    stats_.timer_lateness_ns.WriteJson(writer);
+    
+    writer->WritePropertyName("callbacks");
+    writer->BeginArray();
+    for (size_t i = 0; i < callbacks_.size(); i++) {
+      writer->BeginObject();
+      writer->WritePropertyName("name");
+      writer->WriteString(callbacks_[i]->name);
+      writer->WritePropertyName("durations_ns");
+      callbacks_[i]->durations.WriteJson(writer);
+      writer->EndObject();
+    }
+    writer->EndArray();
+    writer->EndObject();
+  }
+  
+private:
+  LoopInstrumentation(const LoopInstrumentation& other);
+  
+  static void HandleCheck(struct ev_loop* loop, ev_check* w, int revents) {
+    LoopInstrumentation* thiss = static_cast<LoopInstrumentation*>(w->data);
+    uint64_t now = MonotonicNanos();
+    if (thiss->poll_started_ns_)
+      thiss->stats_.idle_ns += now - thiss->poll_started_ns_;
+    thiss->poll_returned_ns_ = now;
+  }
+  
+  static void HandlePrepare(struct ev_loop* loop, ev_prepare* w, int revents) {
+    LoopInstrumentation* thiss = static_cast<LoopInstrumentation*>(w->data);
+    uint64_t now = MonotonicNanos();
+    if (thiss->poll_returned_ns_) {
+      uint64_t busy_ns = now - thiss->poll_returned_ns_;
+      thiss->stats_.iterations++;
+      thiss->stats_.busy_ns += busy_ns;
+      thiss->stats_.iteration_busy_ns.Record(busy_ns);
+    }
+    thiss->poll_started_ns_ = now;
+  }
+  
+  struct ev_loop* loop_;
+  ev_check check_;
+  ev_prepare prepare_;
+  EventLoopStats stats_;
+  CallbackStats timers_;
+  CallbackStats scheduled_tasks_;
+  CallbackStats posted_tasks_;
+  CallbackStats prepare_hooks_;
+  vector<CallbackStats*> callbacks_;
+  uint64_t poll_returned_ns_;
+  uint64_t poll_started_ns_;
+};
+
+class EvIoTask : public IoTask {
 public:
   static shared_ptr<IoTask> Create(struct ev_loop* loop, 
+                                   LoopInstrumentation* instrumentation,
                                    int fd,
                                    int flags, 
                                    const function<void(int)>& func) {
-    shared_ptr<IoTask> result(new IoTask(loop, fd, flags, func));
+    shared_ptr<IoTask> result(new EvIoTask(loop, instrumentation, fd, flags, 
+                                           func));
     return result;
   }
   
-  ~IoTask() {
+  ~EvIoTask() {
+    ev_io_stop(loop_, &io_);
+    instrumentation_->Unregister(&stats_);
+  }
+  
+  void Pause() {
     ev_io_stop(loop_, &io_);
   }
+  void Resume() {
+    ev_io_start(loop_, &io_);
+  }
+  bool paused() const {
+    return !ev_is_active(&io_);
+  }
   
 private:
-  IoTask(struct ev_loop* loop, int fd, int flags, const function<void(int)>& func) 
+  EvIoTask(struct ev_loop* loop, LoopInstrumentation* instrumentation,
+           int fd, int flags, const function<void(int)>& func) 
       : loop_(CheckNotNull(loop, "loop")),
-        func_(func) {
+        instrumentation_(instrumentation),
+        func_(func),
+        stats_(StrPrintf("fd %d", fd)) {
+    instrumentation_->Register(&stats_);
+    
     int evFlags = 0;
     if (flags & kEvRead)
       evFlags |= EV_READ;
     if (flags & kEvWrite)
       evFlags |= EV_WRITE;
     
-    ev_io_init (&io_, &IoTask::HandleFunctionRead, fd, evFlags);
+    ev_io_init (&io_, &EvIoTask::HandleFunctionRead, fd, evFlags);
     io_.data = this;
     ev_io_start(loop, &io_);
   }
@@ -38,62 +232,313 @@ private:
 
   
   static void HandleFunctionRead(struct ev_loop* loop, ev_io *w, int revents) {
-    IoTask* thiss = static_cast<IoTask*>(w->data);
+    EvIoTask* thiss = static_cast<EvIoTask*>(w->data);
     int flags = 0;
     if (revents & EV_READ)
       flags |= kEvRead;
-    else if (revents & EV_WRITE) 
+    if (revents & EV_WRITE) 
       flags |= kEvWrite;
-    thiss->func_(revents);
+    ScopedCallbackTiming timing(&thiss->stats_);
+    thiss->func_(flags);
   }
   
   struct ev_loop* loop_;
+  LoopInstrumentation* instrumentation_;
   function<void(int)> func_;
+  CallbackStats stats_;
   struct ev_io io_;
 };
 
-  
-class ScheduledTask {
+class EvPrepareTask : public IoTask {
 public:
-  static void Start(struct ev_loop* loop, double seconds_from_now, const function<void()>& func) {
-    ScheduledTask* task = new ScheduledTask(seconds_from_now, func);
-    ev_timer_start(loop, &task->timer_);
+  EvPrepareTask(struct ev_loop* loop, CallbackStats* stats,
+                const function<void()>& func)
+      : loop_(CheckNotNull(loop, "loop")),
+        stats_(stats),
+        func_(func) {
+    ev_prepare_init(&prepare_, &EvPrepareTask::HandlePrepare);
+    prepare_.data = this;
+    ev_prepare_start(loop, &prepare_);
+  }
+  
+  ~EvPrepareTask() {
+    ev_prepare_stop(loop_, &prepare_);
+  }
+  
+  void Pause() {
+    ev_prepare_stop(loop_, &prepare_);
+  }
+  void Resume() {
+    ev_prepare_start(loop_, &prepare_);
+  }
+  bool paused() const {
+    return !ev_is_active(&prepare_);
   }
   
 private:
-  ScheduledTask(double seconds_from_now, const function<void()>& func)
-    : func_(func)
-  {
-    ev_timer_init(&timer_, &ScheduledTask::HandleFunctionTimeout, seconds_from_now, 0.0);
+  static void HandlePrepare(struct ev_loop* loop, ev_prepare* w, int revents) {
+    EvPrepareTask* thiss = static_cast<EvPrepareTask*>(w->data);
+    ScopedCallbackTiming timing(thiss->stats_);
+    thiss->func_();
+  }
+  
+  struct ev_loop* loop_;
+  CallbackStats* stats_;
+  function<void()> func_;
+  struct ev_prepare prepare_;
+};
+  
+// Runs a TimerWheel with millisecond ticks off a single ev_timer, which is
+// kept armed for the wheel's next tick
+class TimerWheelDriver {
+public:
+  explicit TimerWheelDriver(struct ev_loop* loop)
+    : loop_(loop),
+      wheel_(NowTicks(loop)),
+      armed_tick_(0) {
+    ev_init(&timer_, &TimerWheelDriver::HandleTimeout);
     timer_.data = this;
   }
   
-  static void HandleFunctionTimeout(struct ev_loop* loop, ev_timer *w, int revents)
-  {
-    ScheduledTask* task = static_cast<ScheduledTask*>(w->data);
-    task->func_();
-    delete task;
+  ~TimerWheelDriver() {
+    ev_timer_stop(loop_, &timer_);
+  }
+  
+  void Schedule(WheelTimer* timer, double seconds_from_now) {
+    uint64_t now = NowTicks(loop_);
+    
+    // An empty wheel isn't advanced while it sits idle; catch it up so the
+    // new timer doesn't have to be cascaded through all the missed time
+    if (wheel_.size() == 0)
+      wheel_.Advance(now);
+    
+    uint64_t delay = 0;
+    if (seconds_from_now > 0)
+      delay = static_cast<uint64_t>(ceil(seconds_from_now * 1000));
+    wheel_.Schedule(timer, now + delay);
+    
+    if (!ev_is_active(&timer_) || now + delay < armed_tick_)
+      Arm();
+  }
+  
+  // The ev_timer is left alone; if it fires for nothing, it just gets
+  // armed again
+  void Cancel(WheelTimer* timer) {
+    wheel_.Cancel(timer);
+  }
+  
+private:
+  static uint64_t NowTicks(struct ev_loop* loop) {
+    // The fudge keeps a timeout that lands exactly on a millisecond from
+    // being rounded down to the one before
+    return static_cast<uint64_t>(ev_now(loop) * 1000 + 1e-6);
+  }
+  
+  void Arm() {
+    ev_timer_stop(loop_, &timer_);
+    if (!wheel_.NextTick(&armed_tick_))
+      return;
+    double delay = std::max(0.0, static_cast<double>(armed_tick_) / 1000 - 
+                                  ev_now(loop_));
+    ev_timer_set(&timer_, delay, 0.0);
+    ev_timer_start(loop_, &timer_);
   }
   
+  static void HandleTimeout(struct ev_loop* loop, ev_timer* w, int revents) {
+    TimerWheelDriver* driver = static_cast<TimerWheelDriver*>(w->data);
+    driver->wheel_.Advance(NowTicks(loop));
+    driver->Arm();
+  }
+  
+  struct ev_loop* loop_;
+  TimerWheel wheel_;
   ev_timer timer_;
+  uint64_t armed_tick_;
+};
+
+// A fire-and-forget timer for EventLoop::Schedule()
+class ScheduledTask {
+public:
+  static void Start(TimerWheelDriver* driver, 
+                    LoopInstrumentation* instrumentation,
+                    double seconds_from_now, 
+                    const function<void()>& func) {
+    ScheduledTask* task = new ScheduledTask(instrumentation, func);
+    driver->Schedule(&task->timer_, seconds_from_now);
+  }
+  
+private:
+  ScheduledTask(LoopInstrumentation* instrumentation, 
+                const function<void()>& func)
+    : instrumentation_(instrumentation),
+      func_(func),
+      timer_(bind(&ScheduledTask::HandleTimeout, this)) {
+  }
+  
+  void HandleTimeout() {
+    instrumentation_->RecordTimerFired(timer_.expiry());
+    {
+      ScopedCallbackTiming timing(instrumentation_->scheduled_tasks());
+      func_();
+    }
+    delete this;
+  }
+  
+  LoopInstrumentation* instrumentation_;
   function<void()> func_;
+  WheelTimer timer_;
+};
+
+// How many posted tasks run per wakeup before the loop gets a chance to
+// look at its other watchers
+const size_t kPostedTaskBatchSize = 64;
+
+// The tasks handed to a loop by EventLoop::Post(). Other threads push onto
+// a lock-free queue and wake the loop with an ev_async (an eventfd, where
+// available), which coalesces any number of posts into one wakeup.
+class PostedTaskQueue {
+public:
+  PostedTaskQueue(struct ev_loop* loop, CallbackStats* stats)
+    : loop_(loop),
+      stats_(stats) {
+    ev_async_init(&async_, &PostedTaskQueue::HandleAsync);
+    async_.data = this;
+    ev_async_start(loop, &async_);
+    
+    // Waiting for posts shouldn't keep EventLoop::Run() from returning;
+    // anything that has to wait for one holds EventLoop::Ref() instead
+    ev_unref(loop);
+  }
+  
+  ~PostedTaskQueue() {
+    ev_ref(loop_);
+    ev_async_stop(loop_, &async_);
+    
+    function<void()>* task;
+    while (tasks_.Pop(&task)) {
+      delete task;
+    }
+  }
+  
+  void Post(const function<void()>& action) {
+    tasks_.Push(new function<void()>(action));
+    ev_async_send(loop_, &async_);
+  }
+  
+private:
+  static void HandleAsync(struct ev_loop* loop, ev_async* w, int revents) {
+    PostedTaskQueue* queue = static_cast<PostedTaskQueue*>(w->data);
+    for (size_t i = 0; i < kPostedTaskBatchSize; i++) {
+      function<void()>* task;
+      if (!queue->tasks_.Pop(&task))
+        return;
+      {
+        ScopedCallbackTiming timing(queue->stats_);
+        (*task)();
+      }
+      delete task;
+    }
+    
+    // There may be more; come back after the loop has polled for I/O
+    ev_async_send(loop, w);
+  }
+  
+  struct ev_loop* loop_;
+  CallbackStats* stats_;
+  ev_async async_;
+  MpscQueue<function<void()>*> tasks_;
 };
 
+Timer::Timer(EventLoop* loop, const function<void()>& action)
+  : loop_(CheckNotNull(loop, "loop")),
+    action_(action),
+    timer_(bind(&Timer::Fire, this)) {
+}
+
+void Timer::Start(double seconds_from_now) {
+  loop_->timers_->Schedule(&timer_, seconds_from_now);
+}
+
+void Timer::Stop() {
+  loop_->timers_->Cancel(&timer_);
+}
 
+void Timer::Fire() {
+  LoopInstrumentation* instrumentation = loop_->instrumentation_.get();
+  instrumentation->RecordTimerFired(timer_.expiry());
+  
+  // The action may destroy the timer
+  ScopedCallbackTiming timing(instrumentation->timers());
+  action_();
+}
 
 EventLoop::EventLoop()
-  : loop_(EV_DEFAULT) {}
+  : loop_(CheckNotNull(ev_loop_new(EVFLAG_AUTO), "ev_loop_new()")) {
+  instrumentation_.reset(new LoopInstrumentation(loop_));
+  timers_.reset(new TimerWheelDriver(loop_));
+  posted_tasks_.reset(new PostedTaskQueue(loop_, 
+                                          instrumentation_->posted_tasks()));
+}
+
+EventLoop::~EventLoop() {
+  posted_tasks_.reset();
+  timers_.reset();
+  instrumentation_.reset();
+  ev_loop_destroy(loop_);
+}
 
 void EventLoop::Run() {
   ev_loop(loop_, 0);
 }
 
+static void BreakLoop(struct ev_loop* loop) {
+  ev_break(loop, EVBREAK_ALL);
+}
+
+void EventLoop::Stop() {
+  Post(bind(&BreakLoop, loop_));
+}
+
 void EventLoop::Schedule(double seconds_from_now, const function<void()>& func) {
-  ScheduledTask::Start(loop_, seconds_from_now, func);
+  ScheduledTask::Start(timers_.get(), instrumentation_.get(), seconds_from_now, 
+                       func);
+}
+
+void EventLoop::Post(const function<void()>& action) {
+  posted_tasks_->Post(action);
+}
+
+void EventLoop::Ref() {
+  ev_ref(loop_);
+}
+
+void EventLoop::Unref() {
+  ev_unref(loop_);
 }
 
 shared_ptr<IoTask> EventLoop::MonitorFd(int fd, int flags, const function<void(int)>& action) {
-  return IoTask::Create(loop_, fd, flags, action);
+  return EvIoTask::Create(loop_, instrumentation_.get(), fd, flags, action);
+}
+
+shared_ptr<IoTask> EventLoop::AddPrepareHook(const function<void()>& action) {
+  return shared_ptr<IoTask>(new EvPrepareTask(
+      loop_, instrumentation_->prepare_hooks(), action));
+}
+
+const EventLoopStats& EventLoop::stats() const {
+  return instrumentation_->stats();
+}
+
+void EventLoop::GetCallbackStats(vector<CallbackStats>* stats) const {
+  instrumentation_->GetCallbackStats(stats);
+}
+
+void EventLoop::WriteStats(JsonWriter* writer) const {
+  instrumentation_->WriteJson(writer);
+}
+
+void EventLoop::ResetStats() {
+  instrumentation_->Reset();
 }
   
 
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "common.h"
+#include "base/histogram.h"
+#include "base/timer_wheel.h"
 
 struct ev_loop;
 
@@ -10,21 +12,141 @@ namespace cheaproute
 const int kEvRead = 0x01;
 const int kEvWrite = 0x02;
 
-class IoTask;
+// Returned by EventLoop::MonitorFd. The fd is watched for as long as the
+// task is alive and not paused.
+class IoTask {
+public:
+  virtual ~IoTask() {}
+  
+  // Stops delivering events until Resume() is called. Unlike destroying the
+  // task, this is safe to do from within the task's own callback.
+  virtual void Pause() = 0;
+  virtual void Resume() = 0;
+  virtual bool paused() const = 0;
+};
+
+class EventLoop;
+class JsonWriter;
+class LoopInstrumentation;
+class PostedTaskQueue;
+class TimerWheelDriver;
+
+// How long one kind of callback took to run, in nanoseconds
+struct CallbackStats {
+  explicit CallbackStats(const string& name)
+    : name(name) {
+  }
+  
+  string name;
+  Histogram durations;
+};
+
+// What an EventLoop has been doing since it was created or its stats were
+// last reset. Times are in nanoseconds. An iteration of the loop counts as
+// busy from the moment its poll returns until it's about to poll again.
+struct EventLoopStats {
+  EventLoopStats()
+    : iterations(0),
+      busy_ns(0),
+      idle_ns(0) {
+  }
+  
+  // The fraction of the time the loop spent busy
+  double utilization() const;
+  
+  uint64_t iterations;
+  uint64_t busy_ns;
+  uint64_t idle_ns;
+  Histogram iteration_busy_ns;
+  // How long after their expiry Timers and scheduled tasks actually ran
+  Histogram timer_lateness_ns;
+};
+
+// A restartable one-shot timer, run by its loop's timer wheel. Starting,
+// restarting and stopping are O(1) and never allocate, so a Timer can be
+// kept in per-flow state. Timers have millisecond resolution and are
+// stopped when destroyed.
+class Timer {
+public:
+  Timer(EventLoop* loop, const function<void()>& action);
+  
+  // Starts the timer, or restarts it if it's already running
+  void Start(double seconds_from_now);
+  void Stop();
+  bool active() const { return timer_.scheduled(); }
+  
+private:
+  Timer(const Timer& other);
+  
+  void Fire();
+  
+  EventLoop* loop_;
+  function<void()> action_;
+  WheelTimer timer_;
+};
 
+// Every EventLoop has a libev backend of its own, so loops are independent
+// of each other and each one can be run on its own thread. Apart from
+// Post(), a loop must only be used from the thread that runs it.
 class EventLoop
 {
 public:
   EventLoop();
+  ~EventLoop();
   
   void Run();
+  
+  // Makes Run() return, even if there are watchers left; unlike everything
+  // else but Post(), this may be called from any thread. Callbacks already
+  // running are allowed to finish first.
+  void Stop();
+  
+  // Runs action once, seconds_from_now from now. Use a Timer for anything
+  // that may need to be cancelled or pushed back.
   void Schedule(double seconds_from_now, const function<void()>& action);
   
+  // Runs action on the loop's thread as soon as possible. Unlike everything
+  // else here, this may be called from any thread; it doesn't take a lock.
+  // Actions posted from the same thread run in the order they were posted.
+  void Post(const function<void()>& action);
+  
+  // Run() returns once nothing is being watched, even if a Post() is still
+  // to come. Ref() keeps it going until the matching Unref(), for waiting
+  // on a post while every watcher is paused. Both must be called from the
+  // loop's thread.
+  void Ref();
+  void Unref();
+  
   // Note: The monitor will only work while the returned IoTask is not destroyed
   shared_ptr<IoTask> MonitorFd(int fd, int flags, const function<void(int)>& action);
   
+  // Runs action on every iteration of the loop, just before it waits for
+  // new events. Useful for flushing work that callbacks batched up during
+  // the iteration. Pausing or destroying the returned task stops it.
+  shared_ptr<IoTask> AddPrepareHook(const function<void()>& action);
+  
+  // The loop keeps track of how busy it is and how long its callbacks
+  // take. Stats are only updated and read on the loop's thread; Post() a
+  // task to get at them from anywhere else.
+  const EventLoopStats& stats() const;
+  
+  // Appends a copy of the stats for every fd being monitored, along with
+  // one entry each for timers, scheduled tasks, posted tasks and prepare
+  // hooks
+  void GetCallbackStats(vector<CallbackStats>* stats) const;
+  
+  // Writes stats() and the callback stats as a single object
+  void WriteStats(JsonWriter* writer) const;
+  void ResetStats();
+  
 private:
+  friend class Timer;
+  EventLoop(const EventLoop& other);
+  
   struct ev_loop* loop_;
+  scoped_ptr<LoopInstrumentation> instrumentation_;
+  scoped_ptr<TimerWheelDriver> timers_;
+  scoped_ptr<PostedTaskQueue> posted_tasks_;
 };
 
 }
\ No newline at end of file
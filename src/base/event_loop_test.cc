@@ -0,0 +1,362 @@
+#include "base/common.h"
+
+#include "gtest/gtest.h"
+
+#include "base/event_loop.h"
+#include "base/json_reader.h"
+#include "base/json_writer.h"
+#include "base/thread.h"
+#include "test_util/stream.h"
+
+#include <pthread.h>
+#include <time.h>
+
+namespace cheaproute {
+
+static void AppendValue(vector<int>* values, int value) {
+  values->push_back(value);
+}
+
+TEST(EventLoopTest, RunsPostedTasksInOrder) {
+  EventLoop loop;
+  vector<int> values;
+  loop.Post(bind(&AppendValue, &values, 1));
+  loop.Post(bind(&AppendValue, &values, 2));
+  loop.Post(bind(&AppendValue, &values, 3));
+  
+  // Tasks waiting to be run don't keep the loop running on their own
+  loop.Ref();
+  loop.Post(bind(&EventLoop::Unref, &loop));
+  loop.Run();
+  ASSERT_EQ(3u, values.size());
+  ASSERT_EQ(1, values[0]);
+  ASSERT_EQ(2, values[1]);
+  ASSERT_EQ(3, values[2]);
+}
+
+// A task posted from another thread, which records the thread it ran on
+struct PostedFromThread {
+  explicit PostedFromThread(EventLoop* loop) : loop(loop), ran(false) {}
+  
+  void Post() {
+    // Give the loop a chance to go to sleep first
+    usleep(10000);
+    loop->Post(bind(&PostedFromThread::Run, this));
+  }
+  
+  void Run() {
+    ran = true;
+    ran_on = pthread_self();
+    loop->Unref();
+  }
+  
+  EventLoop* loop;
+  bool ran;
+  pthread_t ran_on;
+};
+
+TEST(EventLoopTest, RefWaitsForPostFromAnotherThread) {
+  EventLoop loop;
+  PostedFromThread task(&loop);
+  Thread thread(bind(&PostedFromThread::Post, &task));
+  loop.Ref();
+  thread.Start();
+  loop.Run();
+  thread.Join();
+  ASSERT_TRUE(task.ran);
+  ASSERT_TRUE(pthread_equal(pthread_self(), task.ran_on));
+}
+
+TEST(EventLoopTest, WaitingForPostsDoesntKeepLoopRunning) {
+  EventLoop loop;
+  loop.Run();
+}
+
+TEST(EventLoopTest, StopReturnsWithWatchersLeft) {
+  EventLoop loop;
+  vector<int> values;
+  loop.Ref();
+  loop.Post(bind(&AppendValue, &values, 1));
+  loop.Stop();
+  loop.Run();
+  ASSERT_EQ(1u, values.size());
+  loop.Unref();
+}
+
+static double MonotonicSeconds() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+}
+
+// Counts how often a timer fires, and restarts it a few times
+struct TimerCounter {
+  TimerCounter() : fired(0), restarts(0), last_fired(0) {}
+  
+  void Fire() {
+    fired++;
+    last_fired = MonotonicSeconds();
+    if (restarts > 0) {
+      restarts--;
+      timer->Start(0.001);
+    }
+  }
+  
+  Timer* timer;
+  int fired;
+  int restarts;
+  double last_fired;
+};
+
+static void StartTimer(Timer* timer, double seconds_from_now) {
+  timer->Start(seconds_from_now);
+}
+
+static void StopTimer(Timer* timer) {
+  timer->Stop();
+}
+
+TEST(EventLoopTest, TimerFiresOnce) {
+  EventLoop loop;
+  TimerCounter counter;
+  Timer timer(&loop, bind(&TimerCounter::Fire, &counter));
+  counter.timer = &timer;
+  
+  double started = MonotonicSeconds();
+  timer.Start(0.01);
+  ASSERT_TRUE(timer.active());
+  loop.Run();
+  ASSERT_EQ(1, counter.fired);
+  ASSERT_FALSE(timer.active());
+  ASSERT_LE(0.009, counter.last_fired - started);
+}
+
+TEST(EventLoopTest, RestartingTimerPushesItBack) {
+  EventLoop loop;
+  TimerCounter counter;
+  Timer timer(&loop, bind(&TimerCounter::Fire, &counter));
+  counter.timer = &timer;
+  
+  double started = MonotonicSeconds();
+  timer.Start(0.01);
+  loop.Schedule(0.005, bind(&StartTimer, &timer, 0.03));
+  loop.Run();
+  ASSERT_EQ(1, counter.fired);
+  // Well past the first expiry; timers only have millisecond resolution
+  // and go by the loop's idea of the time, so it can't be exact
+  ASSERT_LE(0.03, counter.last_fired - started);
+}
+
+TEST(EventLoopTest, TimerCanRestartItself) {
+  EventLoop loop;
+  TimerCounter counter;
+  counter.restarts = 2;
+  Timer timer(&loop, bind(&TimerCounter::Fire, &counter));
+  counter.timer = &timer;
+  
+  timer.Start(0.001);
+  loop.Run();
+  ASSERT_EQ(3, counter.fired);
+}
+
+TEST(EventLoopTest, StoppedTimerDoesntFire) {
+  EventLoop loop;
+  TimerCounter counter;
+  Timer timer(&loop, bind(&TimerCounter::Fire, &counter));
+  counter.timer = &timer;
+  
+  timer.Start(0.01);
+  loop.Schedule(0.005, bind(&StopTimer, &timer));
+  loop.Run();
+  ASSERT_EQ(0, counter.fired);
+  ASSERT_FALSE(timer.active());
+}
+
+// Runs one of each kind of callback the loop keeps stats for, except for
+// prepare hooks
+class LoopStatsTest : public testing::Test {
+protected:
+  virtual void SetUp() {
+    ASSERT_EQ(0, pipe(pipe_fds_));
+    ASSERT_EQ(1, write(pipe_fds_[1], "x", 1));
+    fd_reads_ = 0;
+    timer_fired_ = 0;
+    fd_task_ = loop_.MonitorFd(pipe_fds_[0], kEvRead, 
+                               bind(&LoopStatsTest::ReadFd, this, _1));
+    timer_.reset(new Timer(&loop_, bind(&LoopStatsTest::FireTimer, this)));
+    timer_->Start(0.001);
+    loop_.Post(bind(&LoopStatsTest::DoNothing));
+    
+    // Once the fd is no longer watched, Run() returns
+    loop_.Schedule(0.005, bind(&LoopStatsTest::StopWatchingFd, this));
+    loop_.Run();
+  }
+  
+  virtual void TearDown() {
+    close(pipe_fds_[0]);
+    close(pipe_fds_[1]);
+  }
+  
+  void ReadFd(int flags) {
+    char c;
+    ASSERT_EQ(1, read(pipe_fds_[0], &c, 1));
+    fd_reads_++;
+  }
+  void FireTimer() {
+    timer_fired_++;
+  }
+  static void DoNothing() {
+  }
+  // The fd's stats go away along with its task, so they are kept from
+  // just before
+  void StopWatchingFd() {
+    loop_.GetCallbackStats(&fd_watched_stats_);
+    fd_task_.reset();
+  }
+  
+  // How many times the callbacks with the given name ran
+  uint64_t CallbackCount(const string& name) {
+    vector<CallbackStats> stats;
+    loop_.GetCallbackStats(&stats);
+    return CallbackCount(stats, name);
+  }
+  static uint64_t CallbackCount(const vector<CallbackStats>& stats, 
+                                const string& name) {
+    for (size_t i = 0; i < stats.size(); i++) {
+      if (stats[i].name == name)
+        return stats[i].durations.count();
+    }
+    return UINT64_MAX;
+  }
+  
+  EventLoop loop_;
+  int pipe_fds_[2];
+  shared_ptr<IoTask> fd_task_;
+  scoped_ptr<Timer> timer_;
+  vector<CallbackStats> fd_watched_stats_;
+  int fd_reads_;
+  int timer_fired_;
+};
+
+TEST_F(LoopStatsTest, CountsCallbacks) {
+  ASSERT_EQ(1, fd_reads_);
+  ASSERT_EQ(1, timer_fired_);
+  
+  string fd_name = StrPrintf("fd %d", pipe_fds_[0]);
+  ASSERT_EQ(1u, CallbackCount(fd_watched_stats_, fd_name));
+  ASSERT_EQ(UINT64_MAX, CallbackCount(fd_name));
+  ASSERT_EQ(1u, CallbackCount("timers"));
+  ASSERT_EQ(1u, CallbackCount("scheduled tasks"));
+  ASSERT_EQ(1u, CallbackCount("posted tasks"));
+  ASSERT_EQ(0u, CallbackCount("prepare hooks"));
+}
+
+TEST_F(LoopStatsTest, CountsIterations) {
+  const EventLoopStats& stats = loop_.stats();
+  ASSERT_LE(1u, stats.iterations);
+  ASSERT_EQ(stats.iterations, stats.iteration_busy_ns.count());
+  ASSERT_LT(0u, stats.busy_ns);
+  ASSERT_LT(0u, stats.idle_ns);
+  ASSERT_EQ(2u, stats.timer_lateness_ns.count());
+  
+  loop_.ResetStats();
+  ASSERT_EQ(0u, loop_.stats().iterations);
+  ASSERT_EQ(0u, CallbackCount("timers"));
+}
+
+// Reads a Histogram's JSON object and records the integers in it
+static void ReadHistogram(JsonReader* reader, 
+                          unordered_map<string, int64_t>* values) {
+  ASSERT_TRUE(reader->Next());
+  ASSERT_EQ(JSON_StartObject, reader->token_type());
+  while (reader->Next() && reader->token_type() == JSON_PropertyName) {
+    string name = reader->str_value();
+    ASSERT_TRUE(reader->Next());
+    if (reader->token_type() == JSON_Integer)
+      (*values)[name] = reader->int_value();
+    else
+      ASSERT_EQ(JSON_Float, reader->token_type());
+  }
+  ASSERT_EQ(JSON_EndObject, reader->token_type());
+}
+
+TEST_F(LoopStatsTest, WritesStatsAsJson) {
+  MemoryOutputStream* output = new MemoryOutputStream();
+  JsonWriter writer(shared_ptr<BufferedOutputStream>(new BufferedOutputStream(
+      shared_ptr<OutputStream>(output), 4096)), JsonWriterFlags_None);
+  loop_.WriteStats(&writer);
+  writer.Flush();
+  
+  string json(static_cast<const char*>(output->ptr()), output->size());
+  JsonReader reader(CreateBufferedInputStream(json.c_str()));
+  ASSERT_TRUE(reader.Next());
+  ASSERT_EQ(JSON_StartObject, reader.token_type());
+  
+  vector<string> properties;
+  unordered_map<string, int64_t> values;
+  vector<string> callbacks;
+  while (reader.Next() && reader.token_type() == JSON_PropertyName) {
+    string name = reader.str_value();
+    properties.push_back(name);
+    if (name == "iteration_busy_ns" || name == "timer_lateness_ns") {
+      unordered_map<string, int64_t> histogram;
+      ReadHistogram(&reader, &histogram);
+      values[name + ".count"] = histogram["count"];
+    } else if (name == "callbacks") {
+      ASSERT_TRUE(reader.Next());
+      ASSERT_EQ(JSON_StartArray, reader.token_type());
+      while (reader.Next() && reader.token_type() == JSON_StartObject) {
+        ASSERT_TRUE(reader.Next());
+        ASSERT_EQ("name", reader.str_value());
+        ASSERT_TRUE(reader.Next());
+        string callback = reader.str_value();
+        callbacks.push_back(callback);
+        ASSERT_TRUE(reader.Next());
+        ASSERT_EQ("durations_ns", reader.str_value());
+        unordered_map<string, int64_t> histogram;
+        ReadHistogram(&reader, &histogram);
+        values[callback + ".count"] = histogram["count"];
+        ASSERT_TRUE(reader.Next());
+        ASSERT_EQ(JSON_EndObject, reader.token_type());
+      }
+      ASSERT_EQ(JSON_EndArray, reader.token_type());
+    } else {
+      ASSERT_TRUE(reader.Next());
+      if (reader.token_type() == JSON_Integer)
+        values[name] = reader.int_value();
+      else
+        ASSERT_EQ(JSON_Float, reader.token_type());
+    }
+  }
+  ASSERT_EQ(JSON_EndObject, reader.token_type());
+  
+  const char* expected_properties[] = {
+    "iterations", "busy_ns", "idle_ns", "utilization", "iteration_busy_ns",
+    "timer_lateness_ns", "callbacks"
+  };
+  ASSERT_EQ(sizeof(expected_properties) / sizeof(expected_properties[0]), 
+            properties.size());
+  for (size_t i = 0; i < properties.size(); i++) {
+    ASSERT_EQ(expected_properties[i], properties[i]);
+  }
+  const EventLoopStats& stats = loop_.stats();
+  ASSERT_EQ(static_cast<int64_t>(stats.iterations), values["iterations"]);
+  ASSERT_EQ(static_cast<int64_t>(stats.busy_ns), values["busy_ns"]);
+  ASSERT_EQ(static_cast<int64_t>(stats.iterations), 
+            values["iteration_busy_ns.count"]);
+  
+  const char* expected_callbacks[] = {
+    "timers", "scheduled tasks", "posted tasks", "prepare hooks"
+  };
+  ASSERT_EQ(sizeof(expected_callbacks) / sizeof(expected_callbacks[0]), 
+            callbacks.size());
+  for (size_t i = 0; i < callbacks.size(); i++) {
+    ASSERT_EQ(expected_callbacks[i], callbacks[i]);
+  }
+  ASSERT_EQ(1, values["timers.count"]);
+  ASSERT_EQ(1, values["scheduled tasks.count"]);
+  ASSERT_EQ(1, values["posted tasks.count"]);
+  ASSERT_EQ(0, values["prepare hooks.count"]);
+}
+
+}
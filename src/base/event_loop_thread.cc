@@ -0,0 +1,33 @@
+#include "base/event_loop_thread.h"
+#include "base/event_loop.h"
+#include "base/thread.h"
+
+namespace cheaproute {
+
+EventLoopThread::EventLoopThread()
+  : loop_(new EventLoop()) {
+  thread_.reset(new Thread(bind(&EventLoop::Run, loop_.get())));
+}
+
+EventLoopThread::~EventLoopThread() {
+  // Make sure the thread is gone before the loop it is running is destroyed
+  thread_.reset();
+}
+
+void EventLoopThread::set_cpu(int cpu) {
+  thread_->set_cpu(cpu);
+}
+
+void EventLoopThread::Start() {
+  thread_->Start();
+}
+
+void EventLoopThread::Stop() {
+  loop_->Stop();
+}
+
+void EventLoopThread::Join() {
+  thread_->Join();
+}
+
+}
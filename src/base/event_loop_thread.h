@@ -0,0 +1,40 @@
+#pragma once
+
+#include "base/common.h"
+
+namespace cheaproute {
+
+class EventLoop;
+class Thread;
+
+// Owns an EventLoop with its own libev backend and runs it on a dedicated
+// thread. Watchers should be registered with loop() before Start() is called;
+// after that, the loop may only be touched from its own thread, or through
+// EventLoop::Post().
+class EventLoopThread {
+public:
+  EventLoopThread();
+  
+  // Blocks until the loop runs out of active watchers, unless Stop() was
+  // called
+  ~EventLoopThread();
+  
+  EventLoop* loop() { return loop_.get(); }
+  
+  // Pins the loop's thread to a single CPU; must be called before Start()
+  void set_cpu(int cpu);
+  
+  void Start();
+  // Makes the loop return even if it still has watchers; Join() waits for
+  // it to do so
+  void Stop();
+  void Join();
+  
+private:
+  EventLoopThread(const EventLoopThread& other);
+  
+  scoped_ptr<EventLoop> loop_;
+  scoped_ptr<Thread> thread_;
+};
+
+}
@@ -0,0 +1,61 @@
+#include "base/common.h"
+
+#include "gtest/gtest.h"
+
+#include "base/event_loop.h"
+#include "base/event_loop_thread.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace cheaproute {
+
+// What the loop's thread finds out about itself
+struct LoopThreadInfo {
+  LoopThreadInfo() : ran(false), cpu_count(0) {}
+  
+  void Record() {
+    ran = true;
+    thread = pthread_self();
+    cpu_set_t cpus;
+    ASSERT_EQ(0, sched_getaffinity(0, sizeof(cpus), &cpus));
+    cpu_count = CPU_COUNT(&cpus);
+    running_on = sched_getcpu();
+  }
+  
+  bool ran;
+  pthread_t thread;
+  int cpu_count;
+  int running_on;
+};
+
+TEST(EventLoopThreadTest, RunsLoopOnItsOwnThread) {
+  EventLoopThread thread;
+  LoopThreadInfo info;
+  thread.loop()->Post(bind(&LoopThreadInfo::Record, &info));
+  
+  // Nothing but Stop() makes the loop return now
+  thread.loop()->Ref();
+  thread.Start();
+  thread.Stop();
+  thread.Join();
+  ASSERT_TRUE(info.ran);
+  ASSERT_FALSE(pthread_equal(pthread_self(), info.thread));
+}
+
+TEST(EventLoopThreadTest, PinsLoopToCpu) {
+  EventLoopThread thread;
+  int cpu = sched_getcpu();
+  thread.set_cpu(cpu);
+  LoopThreadInfo info;
+  thread.loop()->Post(bind(&LoopThreadInfo::Record, &info));
+  thread.loop()->Ref();
+  thread.Start();
+  thread.Stop();
+  thread.Join();
+  ASSERT_TRUE(info.ran);
+  ASSERT_EQ(1, info.cpu_count);
+  ASSERT_EQ(cpu, info.running_on);
+}
+
+}
@@ -0,0 +1,83 @@
+#include "base/histogram.h"
+#include "base/json_writer.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace cheaproute {
+
+Histogram::Histogram() {
+  Clear();
+}
+
+void Histogram::Clear() {
+  memset(buckets_, 0, sizeof(buckets_));
+  count_ = 0;
+  sum_ = 0;
+  min_ = UINT64_MAX;
+  max_ = 0;
+}
+
+int Histogram::BucketFor(uint64_t value) {
+  if (value == 0)
+    return 0;
+  return 64 - __builtin_clzll(value);
+}
+
+void Histogram::Record(uint64_t value) {
+  buckets_[BucketFor(value)]++;
+  count_++;
+  sum_ += value;
+  min_ = std::min(min_, value);
+  max_ = std::max(max_, value);
+}
+
+double Histogram::mean() const {
+  if (count_ == 0)
+    return 0;
+  return static_cast<double>(sum_) / static_cast<double>(count_);
+}
+
+uint64_t Histogram::Percentile(double fraction) const {
+  if (count_ == 0)
+    return 0;
+  
+  uint64_t rank = static_cast<uint64_t>(ceil(fraction * 
+                                             static_cast<double>(count_)));
+  rank = std::max<uint64_t>(rank, 1);
+  
+  uint64_t seen = 0;
+  for (int i = 0; i < kBucketCount; i++) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      uint64_t upper_bound = i < 64 ? (1ULL << i) - 1 : UINT64_MAX;
+      return std::max(min_, std::min(max_, upper_bound));
+    }
+  }
+  return max_;
+}
+
+void Histogram::WriteJson(JsonWriter* writer) const {
+  writer->BeginObject();
+  writer->WritePropertyName("count");
+  writer->WriteInteger(static_cast<int64_t>(count_));
+  writer->WritePropertyName("mean");
+  writer->WriteDouble(mean());
+  writer->WritePropertyName("min");
+  writer->WriteInteger(static_cast<int64_t>(min()));
+  writer->WritePropertyName("max");
+  writer->WriteInteger(static_cast<int64_t>(max_));
+  writer->WritePropertyName("p50");
+  writer->WriteInteger(static_cast<int64_t>(Percentile(0.5)));
+  writer->WritePropertyName("p90");
+  writer->WriteInteger(static_cast<int64_t>(Percentile(0.9)));
+  writer->WritePropertyName("p99");
+  writer->WriteInteger(static_cast<int64_t>(Percentile(0.99)));
+  writer->WritePropertyName("p999");
+  writer->WriteInteger(static_cast<int64_t>(Percentile(0.999)));
+  writer->EndObject();
+}
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "base/common.h"
+
+namespace cheaproute {
+
+class JsonWriter;
+
+// Counts samples (typically durations in nanoseconds) in power-of-two
+// buckets. That's coarse, but recording a sample is a handful of
+// instructions and the histogram never allocates, so it's cheap enough to
+// update on every callback. Percentiles are reported as the upper bound of
+// the bucket they fall in, so they may be up to twice the real value.
+class Histogram {
+public:
+  Histogram();
+  
+  void Record(uint64_t value);
+  void Clear();
+  
+  uint64_t count() const { return count_; }
+  uint64_t sum() const { return sum_; }
+  uint64_t min() const { return count_ ? min_ : 0; }
+  uint64_t max() const { return max_; }
+  double mean() const;
+  
+  // Returns a value at least as large as the given fraction (0 to 1) of
+  // the samples
+  uint64_t Percentile(double fraction) const;
+  
+  // Writes count, mean, min, max and a few percentiles as an object
+  void WriteJson(JsonWriter* writer) const;
+  
+private:
+  // Bucket 0 holds zeroes; bucket i holds values in [2^(i-1), 2^i)
+  static const int kBucketCount = 65;
+  
+  static int BucketFor(uint64_t value);
+  
+  uint64_t buckets_[kBucketCount];
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t min_;
+  uint64_t max_;
+};
+
+}
@@ -0,0 +1,69 @@
+#include "base/common.h"
+
+#include "gtest/gtest.h"
+#include "test_util/json.h"
+
+#include "base/histogram.h"
+
+namespace cheaproute {
+
+TEST(HistogramTest, Empty) {
+  Histogram histogram;
+  EXPECT_EQ(0U, histogram.count());
+  EXPECT_EQ(0U, histogram.min());
+  EXPECT_EQ(0U, histogram.max());
+  EXPECT_EQ(0U, histogram.Percentile(0.5));
+  EXPECT_EQ(0.0, histogram.mean());
+}
+
+TEST(HistogramTest, Summary) {
+  Histogram histogram;
+  histogram.Record(10);
+  histogram.Record(20);
+  histogram.Record(0);
+  histogram.Record(30);
+  EXPECT_EQ(4U, histogram.count());
+  EXPECT_EQ(60U, histogram.sum());
+  EXPECT_EQ(0U, histogram.min());
+  EXPECT_EQ(30U, histogram.max());
+  EXPECT_EQ(15.0, histogram.mean());
+  
+  histogram.Clear();
+  EXPECT_EQ(0U, histogram.count());
+  EXPECT_EQ(0U, histogram.max());
+}
+
+TEST(HistogramTest, PercentilesAreBucketUpperBounds) {
+  Histogram histogram;
+  for (int i = 0; i < 90; i++)
+    histogram.Record(100);
+  for (int i = 0; i < 9; i++)
+    histogram.Record(1000);
+  histogram.Record(100000);
+  
+  // 100 is in [64, 128), 1000 in [512, 1024)
+  EXPECT_EQ(127U, histogram.Percentile(0.5));
+  EXPECT_EQ(127U, histogram.Percentile(0.9));
+  EXPECT_EQ(1023U, histogram.Percentile(0.99));
+  EXPECT_EQ(100000U, histogram.Percentile(1.0));
+  
+  // Never beyond what was actually seen
+  Histogram single;
+  single.Record(5);
+  EXPECT_EQ(5U, single.Percentile(0.5));
+  single.Record(UINT64_MAX);
+  EXPECT_EQ(UINT64_MAX, single.Percentile(1.0));
+}
+
+TEST(HistogramTest, WriteJson) {
+  Histogram histogram;
+  histogram.Record(1);
+  histogram.Record(3);
+  
+  JsonWriterFixture fixture;
+  histogram.WriteJson(fixture.writer());
+  fixture.AssertContents("{\"count\":2,\"mean\":2,\"min\":1,\"max\":3,"
+                         "\"p50\":1,\"p90\":3,\"p99\":3,\"p999\":3}");
+}
+
+}
@@ -0,0 +1,331 @@
+#include "base/io_uring.h"
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <algorithm>
+
+namespace cheaproute {
+
+// Every provided buffer ring belongs to a group; we only ever need one
+const uint16_t kBufferGroup = 0;
+
+// The rings are shared with the kernel, so reads of the indices it writes
+// need acquire semantics and our writes of the indices it reads need
+// release semantics
+template<typename T>
+static T LoadAcquire(const T* p) {
+  T result = *static_cast<const volatile T*>(p);
+  __sync_synchronize();
+  return result;
+}
+
+template<typename T>
+static void StoreRelease(T* p, T value) {
+  __sync_synchronize();
+  *static_cast<volatile T*>(p) = value;
+}
+
+template<typename T>
+static T* RingPointer(void* ring, uint32_t offset) {
+  return reinterpret_cast<T*>(static_cast<uint8_t*>(ring) + offset);
+}
+
+static void* MapRing(int fd, size_t size, off_t offset) {
+  void* result = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+                      MAP_SHARED | MAP_POPULATE, fd, offset);
+  if (result == MAP_FAILED)
+    AbortWithPosixError("Unable to map io_uring ring");
+  return result;
+}
+
+IoUring::IoUring()
+  : sq_ring_(NULL),
+    sq_ring_size_(0),
+    cq_ring_(NULL),
+    cq_ring_size_(0),
+    sqes_(NULL),
+    sqes_size_(0),
+    sqe_head_(0),
+    sqe_tail_(0),
+    buffer_ring_(NULL),
+    buffer_ring_size_(0),
+    buffer_ring_mask_(0),
+    buffer_ring_tail_(0),
+    staged_buffers_(0) {
+}
+
+IoUring* IoUring::Create(unsigned sq_entries, unsigned cq_entries) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = cq_entries;
+  
+  int fd = static_cast<int>(syscall(__NR_io_uring_setup, sq_entries, &params));
+  if (fd == -1) {
+    // Not built into the kernel, or forbidden by a sysctl or seccomp
+    if (errno == ENOSYS || errno == EPERM || errno == EACCES)
+      return NULL;
+    AbortWithPosixError("Unable to create io_uring");
+  }
+  
+  IoUring* ring = new IoUring();
+  ring->fd_.set(fd);
+  
+  ring->sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->sq_ring_size_ = std::max(ring->sq_ring_size_, ring->cq_ring_size_);
+    ring->sq_ring_ = MapRing(fd, ring->sq_ring_size_, IORING_OFF_SQ_RING);
+    ring->cq_ring_ = ring->sq_ring_;
+  } else {
+    ring->sq_ring_ = MapRing(fd, ring->sq_ring_size_, IORING_OFF_SQ_RING);
+    ring->cq_ring_ = MapRing(fd, ring->cq_ring_size_, IORING_OFF_CQ_RING);
+  }
+  ring->sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  ring->sqes_ = static_cast<io_uring_sqe*>(
+      MapRing(fd, ring->sqes_size_, IORING_OFF_SQES));
+  
+  ring->sq_head_ = RingPointer<unsigned>(ring->sq_ring_, params.sq_off.head);
+  ring->sq_tail_ = RingPointer<unsigned>(ring->sq_ring_, params.sq_off.tail);
+  ring->sq_mask_ = *RingPointer<unsigned>(ring->sq_ring_, params.sq_off.ring_mask);
+  ring->sq_entries_ = params.sq_entries;
+  ring->sq_array_ = RingPointer<unsigned>(ring->sq_ring_, params.sq_off.array);
+  ring->sqe_head_ = ring->sqe_tail_ = *ring->sq_tail_;
+  
+  ring->cq_head_ = RingPointer<unsigned>(ring->cq_ring_, params.cq_off.head);
+  ring->cq_tail_ = RingPointer<unsigned>(ring->cq_ring_, params.cq_off.tail);
+  ring->cq_mask_ = *RingPointer<unsigned>(ring->cq_ring_, params.cq_off.ring_mask);
+  ring->cqes_ = RingPointer<io_uring_cqe>(ring->cq_ring_, params.cq_off.cqes);
+  return ring;
+}
+
+IoUring::~IoUring() {
+  if (buffer_ring_)
+    munmap(buffer_ring_, buffer_ring_size_);
+  munmap(sqes_, sqes_size_);
+  if (cq_ring_ != sq_ring_)
+    munmap(cq_ring_, cq_ring_size_);
+  munmap(sq_ring_, sq_ring_size_);
+}
+
+io_uring_sqe* IoUring::GetSqe() {
+  if (sqe_tail_ - LoadAcquire(sq_head_) >= sq_entries_) {
+    Submit();
+    if (sqe_tail_ - LoadAcquire(sq_head_) >= sq_entries_)
+      return NULL;
+  }
+  
+  io_uring_sqe* sqe = &sqes_[sqe_tail_ & sq_mask_];
+  sqe_tail_++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+bool IoUring::PrepareBufferedRead(int fd, unsigned size, uint64_t user_data) {
+  io_uring_sqe* sqe = GetSqe();
+  if (!sqe)
+    return false;
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->len = size;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kBufferGroup;
+  sqe->user_data = user_data;
+  return true;
+}
+
+bool IoUring::PrepareWritev(int fd, const iovec* iov, unsigned count,
+                            uint64_t user_data) {
+  io_uring_sqe* sqe = GetSqe();
+  if (!sqe)
+    return false;
+  sqe->opcode = IORING_OP_WRITEV;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uintptr_t>(iov);
+  sqe->len = count;
+  sqe->user_data = user_data;
+  return true;
+}
+
+bool IoUring::PrepareCancel(uint64_t target_user_data, uint64_t user_data) {
+  io_uring_sqe* sqe = GetSqe();
+  if (!sqe)
+    return false;
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = target_user_data;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+  sqe->user_data = user_data;
+  return true;
+}
+
+void IoUring::Submit() {
+  unsigned tail = *sq_tail_;
+  for (; sqe_head_ != sqe_tail_; sqe_head_++, tail++) {
+    sq_array_[tail & sq_mask_] = sqe_head_ & sq_mask_;
+  }
+  StoreRelease(sq_tail_, tail);
+  
+  // Entries an earlier Submit() put in the ring but the kernel didn't take
+  // go along with the new ones
+  unsigned to_submit = tail - LoadAcquire(sq_head_);
+  if (to_submit == 0)
+    return;
+  
+  while (syscall(__NR_io_uring_enter, fd_.get(), to_submit, 0, 0, NULL, 0) == -1) {
+    // EAGAIN and EBUSY mean the kernel is short on memory or completion
+    // space; the entries stay in the ring and go with the next submission
+    if (errno == EAGAIN || errno == EBUSY)
+      return;
+    if (errno != EINTR)
+      AbortWithPosixError("Unable to submit to io_uring");
+  }
+}
+
+size_t IoUring::unsubmitted() const {
+  return sqe_tail_ - LoadAcquire(sq_head_);
+}
+
+bool IoUring::NextCompletion(IoCompletion* completion) {
+  unsigned head = *cq_head_;
+  if (head == LoadAcquire(cq_tail_))
+    return false;
+  
+  const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+  completion->user_data = cqe.user_data;
+  completion->result = cqe.res;
+  completion->has_buffer = cqe.flags & IORING_CQE_F_BUFFER;
+  completion->buffer_id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+  StoreRelease(cq_head_, head + 1);
+  return true;
+}
+
+void IoUring::WaitForCompletion() {
+  while (LoadAcquire(cq_tail_) == *cq_head_) {
+    if (syscall(__NR_io_uring_enter, fd_.get(), 0, 1, IORING_ENTER_GETEVENTS, 
+                NULL, 0) == -1 && errno != EINTR) {
+      AbortWithPosixError("Unable to wait for io_uring completions");
+    }
+  }
+}
+
+bool IoUring::RegisterBufferRing(unsigned entries) {
+  assert(!buffer_ring_);
+  assert((entries & (entries - 1)) == 0);
+  
+  buffer_ring_size_ = entries * sizeof(io_uring_buf);
+  void* ring = mmap(NULL, buffer_ring_size_, PROT_READ | PROT_WRITE, 
+                    MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (ring == MAP_FAILED)
+    AbortWithPosixError("Unable to allocate io_uring buffer ring");
+  
+  io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uintptr_t>(ring);
+  reg.ring_entries = entries;
+  reg.bgid = kBufferGroup;
+  if (syscall(__NR_io_uring_register, fd_.get(), IORING_REGISTER_PBUF_RING, 
+              &reg, 1) == -1) {
+    // Kernels before 5.19 don't know about provided buffer rings
+    if (errno == EINVAL) {
+      munmap(ring, buffer_ring_size_);
+      return false;
+    }
+    AbortWithPosixError("Unable to register io_uring buffer ring");
+  }
+  
+  buffer_ring_ = static_cast<io_uring_buf*>(ring);
+  buffer_ring_mask_ = entries - 1;
+  return true;
+}
+
+void IoUring::AddBuffer(void* data, unsigned size, uint16_t buffer_id) {
+  io_uring_buf* buffer = 
+      &buffer_ring_[(buffer_ring_tail_ + staged_buffers_) & buffer_ring_mask_];
+  buffer->addr = reinterpret_cast<uintptr_t>(data);
+  buffer->len = size;
+  buffer->bid = buffer_id;
+  staged_buffers_++;
+}
+
+void IoUring::PublishBuffers() {
+  if (staged_buffers_ == 0)
+    return;
+  
+  // The ring's tail lives in the reserved field of its first entry
+  buffer_ring_tail_ = static_cast<uint16_t>(buffer_ring_tail_ + staged_buffers_);
+  staged_buffers_ = 0;
+  StoreRelease(&buffer_ring_[0].resv, buffer_ring_tail_);
+}
+
+}
+
+#else  // HAVE_IO_URING
+
+namespace cheaproute {
+
+IoUring* IoUring::Create(unsigned sq_entries, unsigned cq_entries) {
+  return NULL;
+}
+
+IoUring::~IoUring() {
+}
+
+bool IoUring::PrepareBufferedRead(int fd, unsigned size, uint64_t user_data) {
+  AbortWithMessage("io_uring support was not compiled in");
+  return false;
+}
+
+bool IoUring::PrepareWritev(int fd, const iovec* iov, unsigned count,
+                            uint64_t user_data) {
+  AbortWithMessage("io_uring support was not compiled in");
+  return false;
+}
+
+bool IoUring::PrepareCancel(uint64_t target_user_data, uint64_t user_data) {
+  AbortWithMessage("io_uring support was not compiled in");
+  return false;
+}
+
+void IoUring::Submit() {
+  AbortWithMessage("io_uring support was not compiled in");
+}
+
+size_t IoUring::unsubmitted() const {
+  AbortWithMessage("io_uring support was not compiled in");
+  return 0;
+}
+
+bool IoUring::NextCompletion(IoCompletion* completion) {
+  AbortWithMessage("io_uring support was not compiled in");
+  return false;
+}
+
+void IoUring::WaitForCompletion() {
+  AbortWithMessage("io_uring support was not compiled in");
+}
+
+bool IoUring::RegisterBufferRing(unsigned entries) {
+  AbortWithMessage("io_uring support was not compiled in");
+  return false;
+}
+
+void IoUring::AddBuffer(void* data, unsigned size, uint16_t buffer_id) {
+  AbortWithMessage("io_uring support was not compiled in");
+}
+
+void IoUring::PublishBuffers() {
+  AbortWithMessage("io_uring support was not compiled in");
+}
+
+}
+
+#endif  // HAVE_IO_URING
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "base/common.h"
+#include "base/file_descriptor.h"
+
+struct iovec;
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf;
+
+namespace cheaproute {
+
+struct IoCompletion {
+  uint64_t user_data;
+  // Bytes transferred, or a negated errno
+  int result;
+  // Set if the kernel picked a buffer from the provided buffer ring
+  bool has_buffer;
+  uint16_t buffer_id;
+};
+
+// A minimal io_uring instance driven through the raw system calls, so we
+// don't need liburing. Operations are prepared with the Prepare*() methods
+// and handed to the kernel together by Submit(). The ring's fd becomes
+// readable whenever there are completions to reap, so it can be watched
+// with EventLoop::MonitorFd(). Not thread-safe.
+class IoUring {
+public:
+  // Returns NULL if io_uring support wasn't compiled in, or if the kernel
+  // doesn't support it (or doesn't let us use it)
+  static IoUring* Create(unsigned sq_entries, unsigned cq_entries);
+  ~IoUring();
+  
+  int fd() const { return fd_.get(); }
+  
+  // Queues a read of up to size bytes into a buffer the kernel takes from
+  // the provided buffer ring. Returns false if the submission queue is
+  // full even after submitting what was already queued.
+  bool PrepareBufferedRead(int fd, unsigned size, uint64_t user_data);
+  bool PrepareWritev(int fd, const iovec* iov, unsigned count, 
+                     uint64_t user_data);
+  // Queues the cancellation of every operation in flight that was
+  // prepared with target_user_data. Cancelled operations complete with
+  // -ECANCELED; the cancellation itself completes with user_data.
+  bool PrepareCancel(uint64_t target_user_data, uint64_t user_data);
+  
+  // Hands every prepared operation to the kernel. If it can't take them
+  // all right now, the rest go with the next Submit(), even if nothing new
+  // was prepared by then.
+  void Submit();
+  // Prepared operations the kernel hasn't taken yet
+  size_t unsubmitted() const;
+  
+  // Pops the next completion; returns false if there are none
+  bool NextCompletion(IoCompletion* completion);
+  // Blocks until there is at least one completion to pop
+  void WaitForCompletion();
+  
+  // Sets up the provided buffer ring that PrepareBufferedRead() picks
+  // from. entries must be a power of two. Returns false if the kernel
+  // doesn't support provided buffer rings.
+  bool RegisterBufferRing(unsigned entries);
+  
+  // Stages a buffer to be put back on the ring; staged buffers only become
+  // visible to the kernel after PublishBuffers()
+  void AddBuffer(void* data, unsigned size, uint16_t buffer_id);
+  void PublishBuffers();
+  
+private:
+  friend class IoUringTest;
+  
+  IoUring();
+  IoUring(const IoUring& other);
+  
+  io_uring_sqe* GetSqe();
+  
+  FileDescriptor fd_;
+  
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  void* cq_ring_;
+  size_t cq_ring_size_;
+  io_uring_sqe* sqes_;
+  size_t sqes_size_;
+  
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned* sq_array_;
+  // Prepared but not yet submitted entries are the ones in 
+  // [sqe_head_, sqe_tail_)
+  unsigned sqe_head_;
+  unsigned sqe_tail_;
+  
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  io_uring_cqe* cqes_;
+  
+  io_uring_buf* buffer_ring_;
+  size_t buffer_ring_size_;
+  unsigned buffer_ring_mask_;
+  uint16_t buffer_ring_tail_;
+  uint16_t staged_buffers_;
+};
+
+}
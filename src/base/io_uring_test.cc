@@ -0,0 +1,165 @@
+#include "base/io_uring.h"
+
+#include "gtest/gtest.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+namespace cheaproute {
+
+// The tests pass without checking anything where io_uring isn't available
+// (not compiled in, or not allowed by the kernel)
+class IoUringTest : public testing::Test {
+protected:
+  virtual void SetUp() {
+    ring_.reset(IoUring::Create(8, 16));
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    read_fd_.set(fds[0]);
+    write_fd_.set(fds[1]);
+  }
+
+  // Waits for the next completion; returns false if none came within a
+  // second
+  bool WaitForCompletion(IoCompletion* completion) {
+    while (!ring_->NextCompletion(completion)) {
+      pollfd pfd = { ring_->fd(), POLLIN, 0 };
+      if (poll(&pfd, 1, 1000) != 1)
+        return false;
+    }
+    return true;
+  }
+
+  string ReadPipe() {
+    char buf[256];
+    ssize_t size = read(read_fd_.get(), buf, sizeof(buf));
+    return size > 0 ? string(buf, size) : string();
+  }
+
+#ifdef HAVE_IO_URING
+  // Prepares an operation the kernel refuses before running it, which
+  // makes it stop taking entries from the ring just like it does when
+  // io_uring_enter() fails with EAGAIN
+  void PrepareInvalid(uint64_t user_data) {
+    io_uring_sqe* sqe = ring_->GetSqe();
+    sqe->opcode = IORING_OP_LAST;
+    sqe->user_data = user_data;
+  }
+#endif
+
+  scoped_ptr<IoUring> ring_;
+  FileDescriptor read_fd_;
+  FileDescriptor write_fd_;
+};
+
+TEST_F(IoUringTest, ReadsIntoProvidedBuffer) {
+  if (!ring_ || !ring_->RegisterBufferRing(4))
+    return;
+  char buffers[4][64];
+  for (uint16_t i = 0; i < 4; i++) {
+    ring_->AddBuffer(buffers[i], sizeof(buffers[i]), i);
+  }
+  ring_->PublishBuffers();
+
+  ASSERT_TRUE(ring_->PrepareBufferedRead(read_fd_.get(), 64, 7));
+  ring_->Submit();
+  ASSERT_EQ(5, write(write_fd_.get(), "hello", 5));
+
+  IoCompletion completion;
+  ASSERT_TRUE(WaitForCompletion(&completion));
+  ASSERT_EQ(7u, completion.user_data);
+  ASSERT_EQ(5, completion.result);
+  ASSERT_TRUE(completion.has_buffer);
+  ASSERT_GT(4, completion.buffer_id);
+  ASSERT_EQ(0, memcmp("hello", buffers[completion.buffer_id], 5));
+}
+
+TEST_F(IoUringTest, SubmitsWritesTogether) {
+  if (!ring_)
+    return;
+  const char* pieces[] = { "one", "two", "three" };
+  iovec iov[3];
+  for (int i = 0; i < 3; i++) {
+    iov[i].iov_base = const_cast<char*>(pieces[i]);
+    iov[i].iov_len = strlen(pieces[i]);
+    ASSERT_TRUE(ring_->PrepareWritev(write_fd_.get(), &iov[i], 1, i));
+  }
+  ASSERT_EQ(3u, ring_->unsubmitted());
+  ring_->Submit();
+  ASSERT_EQ(0u, ring_->unsubmitted());
+
+  for (int i = 0; i < 3; i++) {
+    IoCompletion completion;
+    ASSERT_TRUE(WaitForCompletion(&completion));
+    ASSERT_EQ(static_cast<int>(iov[completion.user_data].iov_len),
+              completion.result);
+  }
+  ASSERT_EQ("onetwothree", ReadPipe());
+}
+
+TEST_F(IoUringTest, CancelsReadsInFlight) {
+  if (!ring_ || !ring_->RegisterBufferRing(4))
+    return;
+  char buffers[4][64];
+  for (uint16_t i = 0; i < 4; i++) {
+    ring_->AddBuffer(buffers[i], sizeof(buffers[i]), i);
+  }
+  ring_->PublishBuffers();
+  
+  // Nothing is ever written, so both reads stay in flight
+  ASSERT_TRUE(ring_->PrepareBufferedRead(read_fd_.get(), 64, 7));
+  ASSERT_TRUE(ring_->PrepareBufferedRead(read_fd_.get(), 64, 7));
+  ring_->Submit();
+  ASSERT_TRUE(ring_->PrepareCancel(7, 8));
+  ring_->Submit();
+  
+  int reads_cancelled = 0;
+  bool cancel_completed = false;
+  while (reads_cancelled < 2 || !cancel_completed) {
+    IoCompletion completion;
+    ring_->WaitForCompletion();
+    ASSERT_TRUE(ring_->NextCompletion(&completion));
+    if (completion.user_data == 8) {
+      ASSERT_EQ(2, completion.result);
+      cancel_completed = true;
+    } else {
+      ASSERT_EQ(7u, completion.user_data);
+      ASSERT_EQ(-ECANCELED, completion.result);
+      ASSERT_FALSE(completion.has_buffer);
+      reads_cancelled++;
+    }
+  }
+}
+
+#ifdef HAVE_IO_URING
+TEST_F(IoUringTest, ResubmitsEntriesTheKernelDidNotTake) {
+  if (!ring_)
+    return;
+  PrepareInvalid(1);
+  iovec iov = { const_cast<char*>("x"), 1 };
+  ASSERT_TRUE(ring_->PrepareWritev(write_fd_.get(), &iov, 1, 2));
+  ring_->Submit();
+  ASSERT_EQ(1u, ring_->unsubmitted());
+
+  IoCompletion completion;
+  ASSERT_TRUE(WaitForCompletion(&completion));
+  ASSERT_EQ(1u, completion.user_data);
+  ASSERT_GT(0, completion.result);
+
+  // Nothing new has been prepared, but the write is still waiting
+  ring_->Submit();
+  ASSERT_EQ(0u, ring_->unsubmitted());
+  ASSERT_TRUE(WaitForCompletion(&completion));
+  ASSERT_EQ(2u, completion.user_data);
+  ASSERT_EQ(1, completion.result);
+  ASSERT_EQ("x", ReadPipe());
+}
+#endif
+
+}
@@ -0,0 +1,94 @@
+#include "base/json_array_index.h"
+#include "base/json_scan.h"
+
+namespace cheaproute {
+
+// Returns the offset just past the value starting at pos, or 0 if it
+// doesn't end before the end of data
+static size_t FindValueEnd(const uint8_t* data, size_t size, size_t pos) {
+  uint8_t ch = data[pos++];
+  if (ch == '{' || ch == '[') {
+    JsonSkipState state;
+    pos += SkipJsonContainer(data + pos, size - pos, &state);
+    return state.depth == 0 ? pos : 0;
+  }
+  
+  if (ch == '"' || ch == '\'') {
+    while (true) {
+      pos += ScanJsonStringRun(data + pos, size - pos, ch);
+      if (pos == size)
+        return 0;
+      if (data[pos] == ch)
+        return pos + 1;
+      // Skip the backslash and whatever it escapes
+      pos += 2;
+      if (pos > size)
+        return 0;
+    }
+  }
+  
+  // Numbers and keywords go on until whatever comes after them
+  while (pos < size && data[pos] != ',' && data[pos] != ']' && 
+         data[pos] != '}' && !IsJsonWhitespace(data[pos])) {
+    pos++;
+  }
+  return pos;
+}
+
+JsonArrayIndex::JsonArrayIndex()
+  : data_(NULL),
+    error_code_(JsonError_None) {
+}
+
+bool JsonArrayIndex::Build(const uint8_t* data, size_t size) {
+  data_ = data;
+  elements_.clear();
+  error_code_ = JsonError_None;
+  
+  size_t pos = ScanJsonWhitespace(data, size);
+  if (pos == size || data[pos] != '[')
+    return Fail();
+  pos++;
+  
+  while (true) {
+    pos += ScanJsonWhitespace(data + pos, size - pos);
+    if (pos == size)
+      return Fail();
+    if (data[pos] == ']' && elements_.empty())
+      return true;
+    if (data[pos] == ']' || data[pos] == ',')
+      return Fail();
+    
+    size_t end = FindValueEnd(data, size, pos);
+    if (end == 0)
+      return Fail();
+    elements_.push_back(Element(pos, end - pos));
+    
+    pos = end + ScanJsonWhitespace(data + end, size - end);
+    if (pos == size)
+      return Fail();
+    if (data[pos] == ']')
+      return true;
+    if (data[pos] != ',')
+      return Fail();
+    pos++;
+  }
+}
+
+shared_ptr<JsonReader> JsonArrayIndex::ReadElement(size_t i) const {
+  assert(i < elements_.size());
+  const Element& element = elements_[i];
+  // The buffer is never used, as the span is read in place
+  return shared_ptr<JsonReader>(new JsonReader(
+      shared_ptr<BufferedInputStream>(new BufferedInputStream(
+          shared_ptr<InputStream>(new SpanInputStream(
+              data_ + element.offset, element.size)), 16))));
+}
+
+bool JsonArrayIndex::Fail() {
+  elements_.clear();
+  error_code_ = JsonError_UnexpectedCharacter;
+  return false;
+}
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "base/common.h"
+#include "base/json_reader.h"
+
+namespace cheaproute {
+
+// Finds each element of a JSON document's top-level array in one quick
+// pass over the document, so that the elements can afterwards be read in
+// any order. The elements themselves are skipped over, not tokenized, so
+// errors inside them only show up once they're read. The document has to
+// stay in memory (a MappedFileInputStream's, say) while the index is used.
+class JsonArrayIndex {
+public:
+  JsonArrayIndex();
+  
+  // Returns false, with error_code() set, if data isn't an array
+  bool Build(const uint8_t* data, size_t size);
+  
+  JsonError error_code() const { return error_code_; }
+  size_t element_count() const { return elements_.size(); }
+  
+  // Returns a reader that only sees element i, reading it in place; its
+  // first Next() returns the element's first token
+  shared_ptr<JsonReader> ReadElement(size_t i) const;
+  
+private:
+  struct Element {
+    Element(size_t offset, size_t size) : offset(offset), size(size) {}
+    size_t offset;
+    size_t size;
+  };
+  
+  bool Fail();
+  
+  const uint8_t* data_;
+  vector<Element> elements_;
+  JsonError error_code_;
+};
+
+}
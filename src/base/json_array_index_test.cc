@@ -0,0 +1,60 @@
+#include "base/json_array_index.h"
+
+#include "gtest/gtest.h"
+
+namespace cheaproute {
+
+static bool Build(JsonArrayIndex* index, const char* json) {
+  return index->Build(reinterpret_cast<const uint8_t*>(json), strlen(json));
+}
+
+static void ExpectElementTokens(const JsonArrayIndex& index, size_t i, 
+                                JsonToken first_token, size_t token_count) {
+  shared_ptr<JsonReader> reader = index.ReadElement(i);
+  ASSERT_TRUE(reader->Next());
+  ASSERT_EQ(first_token, reader->token_type());
+  for (size_t j = 1; j < token_count; j++) {
+    ASSERT_TRUE(reader->Next());
+  }
+  ASSERT_FALSE(reader->Next());
+  ASSERT_EQ(JsonError_None, reader->error_code());
+}
+
+TEST(JsonArrayIndexTest, Elements) {
+  JsonArrayIndex index;
+  ASSERT_TRUE(Build(&index, " [ {\"a\": [1, \"]\"]}, 12 ,\n\"x\\\"]\", [] ,"
+                            "{\"b\": {\"c\": '}'}}, true]  "));
+  ASSERT_EQ(6U, index.element_count());
+  
+  // Read out of order
+  ExpectElementTokens(index, 5, JSON_Boolean, 1);
+  ExpectElementTokens(index, 0, JSON_StartObject, 7);
+  ExpectElementTokens(index, 2, JSON_String, 1);
+  ExpectElementTokens(index, 1, JSON_Integer, 1);
+  ExpectElementTokens(index, 3, JSON_StartArray, 2);
+  ExpectElementTokens(index, 4, JSON_StartObject, 7);
+  
+  shared_ptr<JsonReader> reader = index.ReadElement(2);
+  ASSERT_TRUE(reader->Next());
+  ASSERT_EQ("x\"]", reader->str_value());
+}
+
+TEST(JsonArrayIndexTest, EmptyArray) {
+  JsonArrayIndex index;
+  ASSERT_TRUE(Build(&index, "[ ]"));
+  ASSERT_EQ(0U, index.element_count());
+}
+
+TEST(JsonArrayIndexTest, Errors) {
+  const char* bad_documents[] = {
+    "", "{}", "[", "[1", "[1,", "[1 2]", "[1,]", "[,1]", "[{]", "[\"]"
+  };
+  for (size_t i = 0; i < ArrayLength(bad_documents); i++) {
+    JsonArrayIndex index;
+    ASSERT_FALSE(Build(&index, bad_documents[i])) << bad_documents[i];
+    ASSERT_EQ(JsonError_UnexpectedCharacter, index.error_code());
+    ASSERT_EQ(0U, index.element_count());
+  }
+}
+
+}
@@ -1,8 +1,10 @@
 
 #include "base/common.h"
 #include "base/json_reader.h"
+#include "base/json_scan.h"
 
 #include <errno.h>
+#include <float.h>
 #include <stdlib.h>
 
 namespace cheaproute {
@@ -48,9 +50,12 @@ JsonReader::JsonReader(shared_ptr<BufferedInputStream> stream)
     error_code_(JsonError_None),
     token_type_(JSON_None),
     mode_(JsonMode_DocumentStart),
+    str_value_current_(true),
     int_value_(0),
     double_value_(0.0),
-    bool_value_(false) {
+    bool_value_(false),
+    resumable_(false),
+    needs_input_(false) {
 }
 
 bool JsonReader::ReadValue(int initial_char) {
@@ -125,99 +130,156 @@ bool JsonReader::ReadKeyword(int initial_char, const char* keyword) {
 }
 
 bool JsonReader::ReadNumber(int initial_char) {
-  str_value_.clear();
+  // Numbers are nearly always short and sitting in the buffer in one
+  // piece, so put initial_char back, find the end and parse them in place
+  stream_->Unread();
+  const uint8_t* data = stream_->buffered_data();
+  size_t size = stream_->buffered_size();
+  size_t length = ScanJsonNumber(data, size);
+  if (length < size) {
+    str_piece_ = StringPiece(reinterpret_cast<const char*>(data), length);
+    str_value_current_ = false;
+    stream_->Skip(length);
+    return ParseNumber(str_piece_);
+  }
   
-  bool seen_dot = false;
-  bool seen_exponent = false;
-  bool seen_initial_zero = false;
+  // It might go on in the next block
+  str_value_.assign(reinterpret_cast<const char*>(data), length);
+  stream_->Skip(length);
+  int ch;
+  while ((ch = stream_->Peek()) != -1 && IsJsonNumberChar(ch)) {
+    str_value_.push_back(static_cast<char>(ch));
+    stream_->Read();
+  }
+  str_piece_ = StringPiece(str_value_);
+  return ParseNumber(str_piece_);
+}
+
+// Powers of ten that doubles hold exactly
+static const double kExactPowersOfTen[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool IsDigit(char ch) {
+  return ch >= '0' && ch <= '9';
+}
+
+// Adds the digits at text[*pos] onwards to *mantissa, 8 at a time while
+// there are that many. Returns how many there were.
+static size_t AccumulateDigits(const char* text, size_t size, size_t* pos,
+                               uint64_t* mantissa) {
+  size_t start = *pos;
+  size_t i = start;
+  const uint8_t* digits = reinterpret_cast<const uint8_t*>(text);
+  while (i + 8 <= size && IsEightDigits(digits + i)) {
+    *mantissa = *mantissa * 100000000 + ParseEightDigits(digits + i);
+    i += 8;
+  }
+  while (i < size && IsDigit(text[i])) {
+    *mantissa = *mantissa * 10 + static_cast<uint64_t>(text[i] - '0');
+    i++;
+  }
+  *pos = i;
+  return i - start;
+}
+
+bool JsonReader::ParseNumber(StringPiece number) {
+  const char* text = number.data();
+  size_t size = number.size();
+  size_t i = 0;
   
-  int ch = initial_char;
-  if (ch == '-') {
-    str_value_.push_back('-');
-    ch = stream_->Read();
+  bool negative = false;
+  if (i < size && text[i] == '-') {
+    negative = true;
+    i++;
   }
-  for (int i = 0;; i++) {
-    switch (ch) {
-      case -1:
-      case '}':
-      case ']':
-      case ',':
-      case '\r':
-      case '\n':
-      case '\t':
-      case ' ':
-      {
-        if (str_value_.size() == 0) {
-          error_code_ = JsonError_UnexpectedCharacter;
-          return false;
-        }
-        if (seen_exponent || seen_dot) {
-          token_type_ = JSON_Float;
-          errno = 0;
-          double_value_ = strtod(str_value_.c_str(), NULL);
-          if (errno) {
-            error_code_ = JsonError_OutOfRange;
-            return false;
-          }
-        }
-        else {
-          token_type_ = JSON_Integer;
-          errno = 0;
-          int_value_ = strtoll(str_value_.c_str(), NULL, 10);
-          if (errno) {
-            error_code_ = JsonError_OutOfRange;
-            return false;
-          }
-        }
-        
-        return true;
-        break;
-      }
-      
-      case '.': {
-        if (seen_dot || seen_exponent) {
-          error_code_ = JsonError_UnexpectedCharacter;
-          return false;
-        }
-        seen_dot = true;
-        str_value_.push_back((char) ch);
-        break;
-      }
-      
-      case 'e':
-      case 'E': {
-        if (seen_exponent) {
-          
-        }
-        seen_exponent = true;
-        str_value_.push_back((char) ch);
-        break;
-      }
-      
-      case '0':
-      case '1':
-      case '2':
-      case '3':
-      case '4':
-      case '5':
-      case '6':
-      case '7':
-      case '8':
-      case '9': {
-        if (ch == '0' && i == 0) {
-          seen_initial_zero = true;
-        } else if (seen_initial_zero && !seen_dot) {
-          error_code_ = JsonError_UnexpectedCharacter;
-          return false;
-        }
-        str_value_.push_back(static_cast<char>(ch));
-        break;
-      }
+  if (i == size || !IsDigit(text[i]) ||
+      (text[i] == '0' && i + 1 < size && IsDigit(text[i + 1]))) {
+    error_code_ = JsonError_UnexpectedCharacter;
+    return false;
+  }
+  
+  // A uint64_t holds any 19 digits; past that it has wrapped around
+  uint64_t mantissa = 0;
+  size_t digit_count = AccumulateDigits(text, size, &i, &mantissa);
+  
+  if (i == size) {
+    token_type_ = JSON_Integer;
+    uint64_t limit = negative ? static_cast<uint64_t>(INT64_MAX) + 1 : 
+                                static_cast<uint64_t>(INT64_MAX);
+    if (digit_count > 19 || mantissa > limit) {
+      error_code_ = JsonError_OutOfRange;
+      return false;
     }
-    if (i > 0) {
-      stream_->Read();
+    if (negative)
+      int_value_ = -static_cast<int64_t>(mantissa - 1) - 1;
+    else
+      int_value_ = static_cast<int64_t>(mantissa);
+    return true;
+  }
+  
+  int exponent = 0;
+  if (text[i] == '.') {
+    i++;
+    size_t fraction_digits = AccumulateDigits(text, size, &i, &mantissa);
+    if (fraction_digits == 0) {
+      error_code_ = JsonError_UnexpectedCharacter;
+      return false;
     }
-    ch = stream_->Peek();
+    digit_count += fraction_digits;
+    exponent = -static_cast<int>(fraction_digits);
+  }
+  if (i < size && (text[i] == 'e' || text[i] == 'E')) {
+    i++;
+    bool negative_exponent = false;
+    if (i < size && (text[i] == '-' || text[i] == '+')) {
+      negative_exponent = text[i] == '-';
+      i++;
+    }
+    if (i == size || !IsDigit(text[i])) {
+      error_code_ = JsonError_UnexpectedCharacter;
+      return false;
+    }
+    int exponent_value = 0;
+    for (; i < size && IsDigit(text[i]); i++) {
+      // Anything this big is out of range whatever the mantissa is
+      if (exponent_value < 100000)
+        exponent_value = exponent_value * 10 + (text[i] - '0');
+    }
+    exponent += negative_exponent ? -exponent_value : exponent_value;
+  }
+  if (i != size) {
+    error_code_ = JsonError_UnexpectedCharacter;
+    return false;
+  }
+  
+  token_type_ = JSON_Float;
+#if FLT_EVAL_METHOD == 0
+  // When the mantissa and the power of ten are both exact doubles, one
+  // correctly rounded multiply or divide gives the correctly rounded
+  // result (Clinger's fast path). This needs doubles to really be doubles
+  // in registers, hence FLT_EVAL_METHOD.
+  if (digit_count <= 19 && mantissa <= (1ULL << 53) && 
+      exponent >= -22 && exponent <= 22) {
+    double value = static_cast<double>(mantissa);
+    if (exponent < 0)
+      value /= kExactPowersOfTen[-exponent];
+    else
+      value *= kExactPowersOfTen[exponent];
+    double_value_ = negative ? -value : value;
+    return true;
+  }
+#endif
+  
+  // strtod needs the terminating NUL that the input buffer hasn't got
+  if (!str_value_current_)
+    MaterializeStrValue();
+  errno = 0;
+  double_value_ = strtod(str_value_.c_str(), NULL);
+  if (errno) {
+    error_code_ = JsonError_OutOfRange;
+    return false;
   }
   return true;
 }
@@ -248,73 +310,98 @@ bool JsonReader::ReadString(int initial_char) {
     return false;
   }
   
+  uint8_t quote = static_cast<uint8_t>(initial_char);
   while (true) {
-    int ch = stream_->Read();
-    if (ch == -1)
+    // Copy everything up to the next quote or backslash in one go
+    if (!stream_->Refill())
       return false;
-    if (ch == initial_char)
+    const uint8_t* data = stream_->buffered_data();
+    size_t size = stream_->buffered_size();
+    size_t run_size = ScanJsonStringRun(data, size, quote);
+    if (str_value_.empty() && run_size < size && data[run_size] == quote) {
+      // No escapes and all of it is buffered, so it can be used in place
+      str_piece_ = StringPiece(reinterpret_cast<const char*>(data), run_size);
+      str_value_current_ = false;
+      stream_->Skip(run_size + 1);
       return true;
-    if (ch == '\\') {
-      ch = stream_->Read();
-      switch (ch) {
-        case -1: {
-          error_code_ = JsonError_UnexpectedCharacter;
-          return false;
-        }
-        case 'u': {
-          int value = 0;
-          if (!ReadUnicodeEscapeCharacter(&value))
-            return false;
-          AppendCharacterAsUtf8(&str_value_, value);
-          break;
-        }
-        case '"':
-        case '/':
-        case '\\': {
-          str_value_.push_back((char)ch);
-          break;
-        }
-        case 'b': {
-          str_value_.push_back('\b');
-          break;
-        }
-        case 'f': {
-          str_value_.push_back('\f');
-          break;
-        }
-        case 'n': {
-          str_value_.push_back('\n');
-          break;
-        }
-        case 'r': {
-          str_value_.push_back('\r');
-          break;
-        }
-        case 't': {
-          str_value_.push_back('\t');
-          break;
-        }
-        
-        default: {
-          error_code_ = JsonError_InvalidEscapeSequence;
+    }
+    str_value_.append(reinterpret_cast<const char*>(data), run_size);
+    stream_->Skip(run_size);
+    if (run_size == size)
+      continue;
+    
+    int ch = stream_->Read();
+    if (ch == initial_char) {
+      str_piece_ = StringPiece(str_value_);
+      return true;
+    }
+    
+    // Otherwise it's the start of an escape sequence
+    ch = stream_->Read();
+    switch (ch) {
+      case -1: {
+        error_code_ = JsonError_UnexpectedCharacter;
+        return false;
+      }
+      case 'u': {
+        int value = 0;
+        if (!ReadUnicodeEscapeCharacter(&value))
           return false;
-        }
+        AppendCharacterAsUtf8(&str_value_, value);
+        break;
+      }
+      case '"':
+      case '/':
+      case '\\': {
+        str_value_.push_back((char)ch);
+        break;
+      }
+      case 'b': {
+        str_value_.push_back('\b');
+        break;
+      }
+      case 'f': {
+        str_value_.push_back('\f');
+        break;
+      }
+      case 'n': {
+        str_value_.push_back('\n');
+        break;
+      }
+      case 'r': {
+        str_value_.push_back('\r');
+        break;
+      }
+      case 't': {
+        str_value_.push_back('\t');
+        break;
+      }
+      
+      default: {
+        error_code_ = JsonError_InvalidEscapeSequence;
+        return false;
       }
-      continue;
     }
-    str_value_.push_back((char)ch);
   }
 }
 
 bool JsonReader::SkipWhitespace(int* out_initial_char) {
-  int ch = ' ';
-  while (ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t') {
-    ch = stream_->Read();
-    if (ch == -1)
+  while (true) {
+    if (!stream_->Refill())
       return false;
+    size_t size = stream_->buffered_size();
+    size_t whitespace_size = ScanJsonWhitespace(stream_->buffered_data(), size);
+    stream_->Skip(whitespace_size);
+    if (whitespace_size < size) {
+      *out_initial_char = stream_->Read();
+      return true;
+    }
   }
-  *out_initial_char = ch;
-  return true;
+}
+
+void JsonReader::MaterializeStrValue() const {
+  str_value_.assign(str_piece_.data(), str_piece_.size());
+  str_value_current_ = true;
 }
 
 bool JsonReader::PopMode() {
@@ -327,7 +414,60 @@ bool JsonReader::PopMode() {
   return true;
 }
 
+bool JsonReader::SkipValue() {
+  if (token_type_ != JSON_StartObject && token_type_ != JSON_StartArray)
+    return true;
+  
+  JsonSkipState state;
+  uint8_t last_char = 0;
+  while (state.depth > 0) {
+    if (!stream_->Refill())
+      return false;
+    const uint8_t* data = stream_->buffered_data();
+    size_t skip_size = SkipJsonContainer(data, stream_->buffered_size(), 
+                                         &state);
+    last_char = data[skip_size - 1];
+    stream_->Skip(skip_size);
+  }
+  
+  if (last_char != (token_type_ == JSON_StartObject ? '}' : ']')) {
+    error_code_ = JsonError_UnexpectedCharacter;
+    return false;
+  }
+  token_type_ = token_type_ == JSON_StartObject ? JSON_EndObject : 
+                                                  JSON_EndArray;
+  return PopMode();
+}
+
 bool JsonReader::Next() {
+  // Nothing from the last token may point into the input any more
+  str_value_.clear();
+  str_value_current_ = true;
+  str_piece_ = StringPiece(str_value_);
+  
+  if (!resumable_)
+    return ReadToken();
+  
+  needs_input_ = false;
+  JsonToken last_token_type = token_type_;
+  JsonMode last_mode = mode_;
+  stream_->Mark();
+  bool result = ReadToken();
+  if (stream_->would_block()) {
+    // Whatever ran out of input is read again from the start next time.
+    // Nothing that touches mode_stack_ reads ahead, so it's left alone.
+    stream_->ResetToMark();
+    token_type_ = last_token_type;
+    mode_ = last_mode;
+    error_code_ = JsonError_None;
+    needs_input_ = true;
+    return false;
+  }
+  stream_->ClearMark();
+  return result;
+}
+
+bool JsonReader::ReadToken() {
   int ch;
   if (!SkipWhitespace(&ch)) 
     return false;
@@ -370,6 +510,15 @@ bool JsonReader::Next() {
         token_type_ = JSON_PropertyName;
         if (!ReadString(ch))
           return false;
+        // The colon may be in the next block of input, which would replace
+        // the one the name points into
+        if (!str_value_current_ && 
+            ScanJsonWhitespace(stream_->buffered_data(), 
+                               stream_->buffered_size()) == 
+                stream_->buffered_size()) {
+          MaterializeStrValue();
+          str_piece_ = StringPiece(str_value_);
+        }
         if (!SkipWhitespace(&ch))
           return false;
         
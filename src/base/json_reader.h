@@ -5,6 +5,7 @@
 // for doing streaming pull-based JSON parsing (kinda like STAX)
 #include "base/common.h"
 #include "base/stream.h"
+#include "base/string_piece.h"
 
 namespace cheaproute {
   
@@ -44,30 +45,62 @@ public:
   JsonReader(shared_ptr<BufferedInputStream> stream);
   
   JsonToken token_type() const { return token_type_; }
-  const string& str_value() const { return str_value_; }
+  const string& str_value() const {
+    if (!str_value_current_)
+      MaterializeStrValue();
+    return str_value_;
+  }
+  // The same characters as str_value(), without copying them out of the
+  // input when the string had no escapes. Only valid until the next call
+  // to Next().
+  StringPiece str_piece() const { return str_piece_; }
   int64_t int_value() const { return int_value_; }
   double float_value() const { return double_value_; }
   JsonError error_code() const { return error_code_; }
   bool bool_value() const { return bool_value_; }
   bool Next();
   
+  // For input that arrives bit by bit, such as a non-blocking pipe read
+  // through a FileInputStream. When the stream has nothing more for now,
+  // Next() goes back to the start of the token it was reading, returns
+  // false and sets needs_input(); call it again once the fd is readable.
+  // The partial token is kept in the stream's buffer until then. Off by
+  // default, as it costs a little copying whenever the buffer is refilled.
+  // SkipValue() isn't resumable.
+  void set_resumable(bool resumable) { resumable_ = resumable; }
+  bool needs_input() const { return needs_input_; }
+  
+  // If the current token is JSON_StartObject or JSON_StartArray, skips
+  // ahead to the matching end, which becomes the current token, without
+  // tokenizing (or validating) anything in between. Any other token is
+  // left alone. Returns false like Next() does.
+  bool SkipValue();
+  
 private:
   bool SkipWhitespace(int* out_initial_char);
   bool ReadValue(int initial_char);
   bool ReadNumber(int initial_char);
+  bool ParseNumber(StringPiece number);
   bool ReadString(int initial_char);
   bool ReadKeyword(int initial_char, const char* keyword);
   bool ReadUnicodeEscapeCharacter(int* out_char);
+  bool ReadToken();
   bool PopMode();
+  void MaterializeStrValue() const;
   
   shared_ptr<BufferedInputStream> stream_;
   JsonError error_code_;
   JsonToken token_type_;
   JsonMode mode_;
-  string str_value_;
+  // str_value_ is only filled in from str_piece_ when somebody asks for it
+  mutable string str_value_;
+  mutable bool str_value_current_;
+  StringPiece str_piece_;
   int64_t int_value_;
   double double_value_;
   bool bool_value_;
+  bool resumable_;
+  bool needs_input_;
   stack<JsonMode> mode_stack_;
 };
 
@@ -0,0 +1,74 @@
+// Measures how fast JsonReader tokenizes a JSON document, such as one of
+// the packet logs in samples/packet_logs. The document is read into memory
+// first and parsed over and over, so only the parser is measured.
+
+#include "base/common.h"
+#include "base/json_reader.h"
+#include "base/stream.h"
+
+#include <stdio.h>
+#include <time.h>
+
+using namespace cheaproute;
+
+namespace {
+
+// Parse at least this much in total
+const size_t kMinBytesParsed = 256 * 1024 * 1024;
+
+double Now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+}
+
+vector<uint8_t> ReadFile(const char* path) {
+  vector<uint8_t> result;
+  FileInputStream stream(path);
+  uint8_t buffer[65536];
+  while (ssize_t bytes_read = stream.Read(buffer, sizeof(buffer))) {
+    result.insert(result.end(), buffer, buffer + bytes_read);
+  }
+  return result;
+}
+
+// Returns the number of tokens read
+size_t Tokenize(const vector<uint8_t>& document) {
+  JsonReader reader(shared_ptr<BufferedInputStream>(new BufferedInputStream(
+      shared_ptr<InputStream>(new MemoryInputStream(&document[0], 
+                                                    document.size())), 
+      65536)));
+  size_t token_count = 0;
+  while (reader.Next()) {
+    token_count++;
+  }
+  if (reader.error_code() != JsonError_None)
+    AbortWithMessage("Parse error %d", reader.error_code());
+  return token_count;
+}
+
+}
+
+int main(int argc, const char* const argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <json_file>\n", argv[0]);
+    return -1;
+  }
+  vector<uint8_t> document = ReadFile(argv[1]);
+  if (document.empty())
+    AbortWithMessage("%s is empty", argv[1]);
+  
+  size_t iterations = kMinBytesParsed / document.size() + 1;
+  size_t token_count = 0;
+  double start = Now();
+  for (size_t i = 0; i < iterations; i++) {
+    token_count += Tokenize(document);
+  }
+  double elapsed = Now() - start;
+  
+  double bytes_parsed = static_cast<double>(document.size() * iterations);
+  printf("%zu tokens in %.3f s: %.1f MB/s, %.1f ns per token\n", 
+         token_count, elapsed, bytes_parsed / elapsed / 1e6, 
+         elapsed * 1e9 / static_cast<double>(token_count));
+  return 0;
+}
@@ -5,6 +5,9 @@
 #include "test_util/stream.h"
 #include "base/json_reader.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 namespace cheaproute {
 
 static void ExpectToken(JsonToken expected_token, JsonReader* reader) {
@@ -128,6 +131,73 @@ TEST(JsonReaderTest, BadFloat) {
   ExpectError(JsonError_OutOfRange, "-5e1230");
 }
 
+// Unlike ExpectError(), insists on the reader stopping at the first token
+static void ExpectNumberError(JsonError expected_error, const char* json) {
+  JsonReader reader(CreateBufferedInputStream(json));
+  ASSERT_FALSE(reader.Next()) << json;
+  ASSERT_EQ(expected_error, reader.error_code()) << json;
+}
+TEST(JsonReaderTest, IntegerLimits) {
+  TestIntegerParse(INT64_MAX, "9223372036854775807");
+  TestIntegerParse(INT64_MIN, "-9223372036854775808");
+  TestIntegerParse(1234567890123456789, "1234567890123456789");
+  TestIntegerParse(12345678, "12345678");
+  TestIntegerParse(-1234567890123456, "-1234567890123456");
+  ExpectNumberError(JsonError_OutOfRange, "9223372036854775808");
+  ExpectNumberError(JsonError_OutOfRange, "-9223372036854775809");
+  ExpectNumberError(JsonError_OutOfRange, "18446744073709551616");
+  ExpectNumberError(JsonError_OutOfRange, "99999999999999999999");
+}
+TEST(JsonReaderTest, MalformedNumbers) {
+  const char* numbers[] = {
+    "-", "--1", "-a", "1..", "1.", "1.e5", "1e", "1e+", "1e-e", "1.0.0",
+    "01", "-01", "00.12", "1-", "1e5e5", "+1"
+  };
+  for (size_t i = 0; i < ArrayLength(numbers); i++) {
+    ExpectNumberError(JsonError_UnexpectedCharacter, numbers[i]);
+  }
+}
+TEST(JsonReaderTest, FloatsMatchStrtod) {
+  TestFloatParse(100.0, "1e+2");
+  TestFloatParse(0.25, "25E-2");
+  TestFloatParse(-0.0, "-0.0");
+  TestFloatParse(0.1, "0.1");
+  // Too many digits or too big an exponent for the exact path
+  const char* floats[] = {
+    "3.141592653589793238462643", "1.7976931348623157e308", "5.5e-300",
+    "123456789012345678e-5", "9007199254740993.0", "1e23", "0.3e-30",
+    "12345678.87654321", "-2.2250738585072014e-308"
+  };
+  for (size_t i = 0; i < ArrayLength(floats); i++) {
+    JsonReader reader(CreateBufferedInputStream(floats[i]));
+    ExpectFloat(strtod(floats[i], NULL), &reader);
+    ASSERT_EQ(floats[i], reader.str_value());
+  }
+}
+
+// Numbers that straddle the stream's buffer boundaries are put together
+// before they're parsed
+TEST(JsonReaderTest, NumbersAcrossBuffers) {
+  const char* json = "[1234567890123456789,-72.75e5,0,\n"
+                     "  98765432109876,1.5 , -9223372036854775808]";
+  for (size_t max_read_size = 1; max_read_size < 20; max_read_size += 3) {
+    JsonReader reader(shared_ptr<BufferedInputStream>(new BufferedInputStream(
+        shared_ptr<InputStream>(new FakeInputStream(max_read_size, json)), 
+        16)));
+    ExpectToken(JSON_StartArray, &reader);
+    ExpectInteger(1234567890123456789, &reader);
+    ASSERT_EQ("1234567890123456789", reader.str_value());
+    ExpectFloat(-72.75e5, &reader);
+    ASSERT_TRUE(reader.str_piece() == "-72.75e5");
+    ExpectInteger(0, &reader);
+    ExpectInteger(98765432109876, &reader);
+    ExpectFloat(1.5, &reader);
+    ExpectInteger(INT64_MIN, &reader);
+    ExpectToken(JSON_EndArray, &reader);
+    ExpectEnd(&reader);
+  }
+}
+
 TEST(JsonReaderTest, Null) {
   JsonReader reader(CreateBufferedInputStream("null"));
   ExpectToken(JSON_Null, &reader);
@@ -284,4 +354,154 @@ TEST(JsonReaderTest, ComplexObject) {
                     "[ 1 , 2 , { \"foo\" : \"bar\" } ] } ");
 }
 
-}
\ No newline at end of file
+// Long strings and whitespace that straddle the stream's buffer boundaries
+TEST(JsonReaderTest, LongTokensAcrossBuffers) {
+  string long_string;
+  for (int i = 0; i < 100; i++) {
+    long_string += "0123456789abcdef";
+  }
+  string indent(70, ' ');
+  string json = "[\n" + indent + "\"" + long_string + "\\n" + long_string + 
+                "\",\n" + indent + "\"\\u00a1" + long_string + "\"\n]";
+  
+  for (size_t max_read_size = 1; max_read_size < 40; max_read_size += 7) {
+    JsonReader reader(shared_ptr<BufferedInputStream>(new BufferedInputStream(
+        shared_ptr<InputStream>(new FakeInputStream(max_read_size, 
+                                                    json.c_str())), 32)));
+    ExpectToken(JSON_StartArray, &reader);
+    ExpectString(long_string + "\n" + long_string, &reader);
+    ExpectString("\xc2\xa1" + long_string, &reader);
+    ExpectToken(JSON_EndArray, &reader);
+    ExpectEnd(&reader);
+  }
+}
+
+// Names and strings come back as pieces whether or not they had to be
+// copied; a property name has to survive the stream looking for its colon
+TEST(JsonReaderTest, StringPieces) {
+  const char* json = "{\"name\"  :  \"value\", \"esc\\taped\" : [\"a\\u0062\"]}";
+  size_t json_size = strlen(json);
+  for (size_t max_read_size = 1; max_read_size <= json_size; max_read_size++) {
+    JsonReader reader(shared_ptr<BufferedInputStream>(new BufferedInputStream(
+        shared_ptr<InputStream>(new FakeInputStream(max_read_size, json)), 
+        4096)));
+    ExpectToken(JSON_StartObject, &reader);
+    ExpectToken(JSON_PropertyName, &reader);
+    ASSERT_EQ("name", reader.str_piece().as_string());
+    ExpectToken(JSON_String, &reader);
+    ASSERT_TRUE(reader.str_piece() == "value");
+    ASSERT_EQ("value", reader.str_value());
+    ExpectToken(JSON_PropertyName, &reader);
+    ASSERT_TRUE(reader.str_piece() == "esc\taped");
+    ExpectToken(JSON_StartArray, &reader);
+    ASSERT_TRUE(reader.str_piece().empty());
+    ExpectString("ab", &reader);
+    ASSERT_TRUE(reader.str_piece() == "ab");
+    ExpectToken(JSON_EndArray, &reader);
+    ExpectToken(JSON_EndObject, &reader);
+    ExpectEnd(&reader);
+  }
+}
+
+TEST(JsonReaderTest, SkipValue) {
+  const char* json = "[{\"a\": [1, \"]}\\\"\", {}]}, 'x', [[], {\"b\": '['}], {}, 2]";
+  size_t json_size = strlen(json);
+  for (size_t max_read_size = 1; max_read_size <= json_size; max_read_size++) {
+    JsonReader reader(shared_ptr<BufferedInputStream>(new BufferedInputStream(
+        shared_ptr<InputStream>(new FakeInputStream(max_read_size, json)), 
+        4096)));
+    ExpectToken(JSON_StartArray, &reader);
+    ExpectToken(JSON_StartObject, &reader);
+    ASSERT_TRUE(reader.SkipValue());
+    ASSERT_EQ(JSON_EndObject, reader.token_type());
+    ExpectString("x", &reader);
+    
+    // Skipping anything but the start of an object or array does nothing
+    ASSERT_TRUE(reader.SkipValue());
+    ASSERT_EQ(JSON_String, reader.token_type());
+    
+    ExpectToken(JSON_StartArray, &reader);
+    ASSERT_TRUE(reader.SkipValue());
+    ASSERT_EQ(JSON_EndArray, reader.token_type());
+    ExpectToken(JSON_StartObject, &reader);
+    ASSERT_TRUE(reader.SkipValue());
+    ASSERT_EQ(JSON_EndObject, reader.token_type());
+    ExpectInteger(2, &reader);
+    ExpectToken(JSON_EndArray, &reader);
+    ExpectEnd(&reader);
+  }
+}
+
+TEST(JsonReaderTest, SkipValueErrors) {
+  JsonReader reader(CreateBufferedInputStream("{\"a\": [1, 2}"));
+  ExpectToken(JSON_StartObject, &reader);
+  ExpectPropertyName("a", &reader);
+  ExpectToken(JSON_StartArray, &reader);
+  ASSERT_FALSE(reader.SkipValue());
+  ASSERT_EQ(JsonError_UnexpectedCharacter, reader.error_code());
+  
+  JsonReader unterminated_reader(CreateBufferedInputStream("[[1, 2]"));
+  ExpectToken(JSON_StartArray, &unterminated_reader);
+  ASSERT_FALSE(unterminated_reader.SkipValue());
+}
+
+// Feeds json into a non-blocking pipe a few bytes at a time, reading
+// tokens in between
+TEST(JsonReaderTest, Resumable) {
+  string json = "{\"name\": \"value\", \"numbers\": [12, -3.5e2, true, null], "
+                "\"escaped\": \"a\\u00a1b\", \"long\": \"" + string(100, 'x') + 
+                "\"}";
+  for (size_t chunk_size = 1; chunk_size < 20; chunk_size++) {
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    JsonReader reader(shared_ptr<BufferedInputStream>(new BufferedInputStream(
+        shared_ptr<InputStream>(new FileInputStream(fds[0], true)), 16)));
+    reader.set_resumable(true);
+    
+    vector<string> tokens;
+    size_t pos = 0;
+    while (true) {
+      if (reader.Next()) {
+        string token = GetJsonTokenName(reader.token_type());
+        if (reader.token_type() == JSON_Integer)
+          token += StrPrintf(" %d", static_cast<int>(reader.int_value()));
+        else if (reader.token_type() == JSON_Float)
+          token += StrPrintf(" %g", reader.float_value());
+        else
+          token += " " + reader.str_value();
+        tokens.push_back(token);
+        continue;
+      }
+      ASSERT_EQ(JsonError_None, reader.error_code());
+      if (!reader.needs_input())
+        break;
+      
+      if (pos < json.size()) {
+        size_t size = std::min(chunk_size, json.size() - pos);
+        ASSERT_EQ(static_cast<ssize_t>(size), 
+                  write(fds[1], json.data() + pos, size));
+        pos += size;
+      } else {
+        close(fds[1]);
+      }
+    }
+    
+    ASSERT_EQ(json.size(), pos);
+    const char* expected_tokens[] = {
+      "StartObject ", "PropertyName name", "String value", 
+      "PropertyName numbers", "StartArray ", "Integer 12", "Float -350", 
+      "Boolean ", "Null ", "EndArray ", "PropertyName escaped", 
+      "String a\xc2\xa1" "b", "PropertyName long", 
+      NULL, "EndObject "
+    };
+    ASSERT_EQ(ArrayLength(expected_tokens), tokens.size());
+    for (size_t i = 0; i < tokens.size(); i++) {
+      if (expected_tokens[i])
+        ASSERT_EQ(expected_tokens[i], tokens[i]);
+    }
+    ASSERT_EQ("String " + string(100, 'x'), tokens[13]);
+  }
+}
+
+}
@@ -0,0 +1,182 @@
+#include "base/json_scan.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace cheaproute {
+
+#ifdef __SSE2__
+static inline __m128i LoadBlock(const uint8_t* data) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+}
+#endif
+
+size_t ScanJsonWhitespace(const uint8_t* data, size_t size) {
+  size_t i = 0;
+  // Most runs of whitespace are a newline and some indentation, so only
+  // bring out the vectors once the first few bytes didn't settle it
+  for (; i < size && i < 4; i++) {
+    if (!IsJsonWhitespace(data[i]))
+      return i;
+  }
+  
+#ifdef __SSE2__
+  const __m128i spaces = _mm_set1_epi8(' ');
+  const __m128i newlines = _mm_set1_epi8('\n');
+  const __m128i returns = _mm_set1_epi8('\r');
+  const __m128i tabs = _mm_set1_epi8('\t');
+  for (; i + 16 <= size; i += 16) {
+    __m128i block = LoadBlock(data + i);
+    __m128i whitespace = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(block, spaces), 
+                     _mm_cmpeq_epi8(block, newlines)),
+        _mm_or_si128(_mm_cmpeq_epi8(block, returns), 
+                     _mm_cmpeq_epi8(block, tabs)));
+    int mask = ~_mm_movemask_epi8(whitespace) & 0xffff;
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+#endif
+  
+  for (; i < size; i++) {
+    if (!IsJsonWhitespace(data[i]))
+      return i;
+  }
+  return size;
+}
+
+size_t ScanJsonStringRun(const uint8_t* data, size_t size, uint8_t quote) {
+  size_t i = 0;
+  
+#ifdef __SSE2__
+  const __m128i quotes = _mm_set1_epi8(static_cast<char>(quote));
+  const __m128i backslashes = _mm_set1_epi8('\\');
+  for (; i + 16 <= size; i += 16) {
+    __m128i block = LoadBlock(data + i);
+    int mask = _mm_movemask_epi8(_mm_or_si128(
+        _mm_cmpeq_epi8(block, quotes), _mm_cmpeq_epi8(block, backslashes)));
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+#endif
+  
+  for (; i < size; i++) {
+    if (data[i] == quote || data[i] == '\\')
+      return i;
+  }
+  return size;
+}
+
+static inline bool NeedsJsonEscape(uint8_t ch) {
+  return ch == '"' || ch == '\\' || ch < ' ';
+}
+
+size_t ScanJsonUnescapedRun(const uint8_t* data, size_t size) {
+  size_t i = 0;
+  
+#ifdef __SSE2__
+  const __m128i quotes = _mm_set1_epi8('"');
+  const __m128i backslashes = _mm_set1_epi8('\\');
+  const __m128i last_control = _mm_set1_epi8(' ' - 1);
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= size; i += 16) {
+    __m128i block = LoadBlock(data + i);
+    // Control characters are the bytes that saturate to zero
+    __m128i controls = _mm_cmpeq_epi8(_mm_subs_epu8(block, last_control), 
+                                      zero);
+    int mask = _mm_movemask_epi8(_mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(block, quotes), 
+                     _mm_cmpeq_epi8(block, backslashes)), controls));
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+#endif
+  
+  for (; i < size; i++) {
+    if (NeedsJsonEscape(data[i]))
+      return i;
+  }
+  return size;
+}
+
+size_t ScanJsonStructure(const uint8_t* data, size_t size) {
+  size_t i = 0;
+  
+#ifdef __SSE2__
+  // '[' and '{' (and ']' and '}') only differ in 0x20
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+  const __m128i open_brackets = _mm_set1_epi8('{');
+  const __m128i close_brackets = _mm_set1_epi8('}');
+  const __m128i double_quotes = _mm_set1_epi8('"');
+  const __m128i single_quotes = _mm_set1_epi8('\'');
+  for (; i + 16 <= size; i += 16) {
+    __m128i block = LoadBlock(data + i);
+    __m128i folded = _mm_or_si128(block, case_bit);
+    __m128i structure = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(folded, open_brackets), 
+                     _mm_cmpeq_epi8(folded, close_brackets)),
+        _mm_or_si128(_mm_cmpeq_epi8(block, double_quotes), 
+                     _mm_cmpeq_epi8(block, single_quotes)));
+    int mask = _mm_movemask_epi8(structure);
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+#endif
+  
+  for (; i < size; i++) {
+    switch (data[i]) {
+      case '[':
+      case ']':
+      case '{':
+      case '}':
+      case '"':
+      case '\'':
+        return i;
+    }
+  }
+  return size;
+}
+
+size_t SkipJsonContainer(const uint8_t* data, size_t size, 
+                         JsonSkipState* state) {
+  size_t i = 0;
+  while (i < size) {
+    if (state->escaped) {
+      state->escaped = false;
+      i++;
+    } else if (state->quote != 0) {
+      i += ScanJsonStringRun(data + i, size - i, state->quote);
+      if (i == size)
+        break;
+      if (data[i] == '\\')
+        state->escaped = true;
+      else
+        state->quote = 0;
+      i++;
+    } else {
+      i += ScanJsonStructure(data + i, size - i);
+      if (i == size)
+        break;
+      uint8_t ch = data[i++];
+      if (ch == '"' || ch == '\'') {
+        state->quote = ch;
+      } else if (ch == '[' || ch == '{') {
+        state->depth++;
+      } else if (--state->depth == 0) {
+        return i;
+      }
+    }
+  }
+  return size;
+}
+
+size_t ScanJsonNumber(const uint8_t* data, size_t size) {
+  // Numbers are short enough that vectors wouldn't pay for themselves
+  size_t i = 0;
+  while (i < size && IsJsonNumberChar(data[i]))
+    i++;
+  return i;
+}
+
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+// Block-at-a-time scanning primitives for JsonReader and JsonWriter. Each
+// one looks at as much of a buffer as it can with SSE2 (16 bytes per step)
+// and finishes with plain C++, so they work on any platform and never read
+// past the end of the buffer.
+#include "base/common.h"
+
+#include <string.h>
+
+namespace cheaproute {
+
+inline bool IsJsonWhitespace(int ch) {
+  return ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t';
+}
+
+// Whether ch could be part of a number (a digit, sign, dot or exponent
+// marker)
+inline bool IsJsonNumberChar(int ch) {
+  return (ch >= '0' && ch <= '9') || ch == '-' || ch == '+' || ch == '.' ||
+      ch == 'e' || ch == 'E';
+}
+
+// Returns how many bytes at the start of data are whitespace
+size_t ScanJsonWhitespace(const uint8_t* data, size_t size);
+
+// Returns the offset of the first quote or backslash in data (or size if
+// there isn't one), so everything before it can be copied as is
+size_t ScanJsonStringRun(const uint8_t* data, size_t size, uint8_t quote);
+
+// Returns the offset of the first byte that JsonWriter has to escape (a
+// double quote, backslash or control character), or size if there isn't
+// one
+size_t ScanJsonUnescapedRun(const uint8_t* data, size_t size);
+
+// Returns the offset of the first quote or bracket of either kind in data
+// (or size if there isn't one)
+size_t ScanJsonStructure(const uint8_t* data, size_t size);
+
+// How far SkipJsonContainer() has got, so it can carry on where it left
+// off with the next block of input
+struct JsonSkipState {
+  JsonSkipState() : depth(1), quote(0), escaped(false) {}
+  
+  // Brackets that are still open
+  int depth;
+  // The quote that started the string being skipped, or 0 outside strings
+  uint8_t quote;
+  // Whether the last byte was a backslash in a string
+  bool escaped;
+};
+
+// Skips the rest of an object or array whose opening bracket has already
+// been read, without looking at anything but quotes, backslashes and
+// brackets (which are counted, not matched). Returns how many bytes were
+// skipped; once state->depth is 0 that includes the closing bracket,
+// otherwise all of data was used up and the value goes on in the next
+// block.
+size_t SkipJsonContainer(const uint8_t* data, size_t size,
+                         JsonSkipState* state);
+
+// Returns how many bytes at the start of data are IsJsonNumberChar()
+size_t ScanJsonNumber(const uint8_t* data, size_t size);
+
+// Whether the 8 bytes at data are all ASCII digits, checked all at once
+// in a 64-bit word
+inline bool IsEightDigits(const uint8_t* data) {
+  uint64_t word;
+  memcpy(&word, data, sizeof(word));
+  return ((word & 0xF0F0F0F0F0F0F0F0ULL) |
+          (((word + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))
+      == 0x3333333333333333ULL;
+}
+
+// The value of the 8 ASCII digits at data. Pairs of digits, then pairs of
+// pairs, are combined in place with a couple of multiplies instead of
+// eight.
+inline uint32_t ParseEightDigits(const uint8_t* data) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64_t word;
+  memcpy(&word, data, sizeof(word));
+  word -= 0x3030303030303030ULL;
+  word = word * 10 + (word >> 8);
+  word = ((word & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32)) +
+          ((word >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))
+      >> 32;
+  return static_cast<uint32_t>(word);
+#else
+  uint32_t value = 0;
+  for (int i = 0; i < 8; i++)
+    value = value * 10 + (data[i] - '0');
+  return value;
+#endif
+}
+
+}
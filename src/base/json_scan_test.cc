@@ -0,0 +1,144 @@
+#include "base/json_scan.h"
+
+#include "gtest/gtest.h"
+
+namespace cheaproute {
+
+static const uint8_t* Bytes(const string& str) {
+  return reinterpret_cast<const uint8_t*>(str.data());
+}
+
+TEST(JsonScanTest, Whitespace) {
+  ASSERT_EQ(0u, ScanJsonWhitespace(Bytes(""), 0));
+  ASSERT_EQ(0u, ScanJsonWhitespace(Bytes("x  "), 3));
+  ASSERT_EQ(3u, ScanJsonWhitespace(Bytes(" \t\r\n"), 3));
+  
+  // The first non-whitespace byte at every position in and around a few
+  // blocks, including none at all
+  for (size_t size = 0; size < 50; size++) {
+    for (size_t pos = 0; pos <= size; pos++) {
+      string str;
+      for (size_t i = 0; i < size; i++) {
+        str.push_back(" \n\r\t"[i % 4]);
+      }
+      if (pos < size)
+        str[pos] = pos % 2 ? '{' : '\x0b';
+      ASSERT_EQ(pos, ScanJsonWhitespace(Bytes(str), size));
+    }
+  }
+}
+
+TEST(JsonScanTest, StringRun) {
+  ASSERT_EQ(0u, ScanJsonStringRun(Bytes(""), 0, '"'));
+  ASSERT_EQ(5u, ScanJsonStringRun(Bytes("hello\""), 6, '"'));
+  ASSERT_EQ(6u, ScanJsonStringRun(Bytes("hello'\""), 7, '"'));
+  ASSERT_EQ(5u, ScanJsonStringRun(Bytes("hello'\""), 7, '\''));
+  
+  for (size_t size = 0; size < 50; size++) {
+    for (size_t pos = 0; pos <= size; pos++) {
+      string str(size, 'a');
+      if (pos < size)
+        str[pos] = pos % 2 ? '"' : '\\';
+      ASSERT_EQ(pos, ScanJsonStringRun(Bytes(str), size, '"'));
+    }
+  }
+  
+  // Bytes with the high bit set aren't special
+  string utf8 = "\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\"";
+  ASSERT_EQ(utf8.size() - 1, ScanJsonStringRun(Bytes(utf8), utf8.size(), '"'));
+}
+
+TEST(JsonScanTest, Structure) {
+  ASSERT_EQ(0u, ScanJsonStructure(Bytes(""), 0));
+  ASSERT_EQ(3u, ScanJsonStructure(Bytes("a: {"), 4));
+  
+  // Only the brackets and quotes stop the scan, in and out of a block
+  for (int ch = 0; ch < 256; ch++) {
+    bool special = strchr("[]{}\"'", ch) != NULL && ch != 0;
+    string str(40, 'a');
+    str[5] = static_cast<char>(ch);
+    str[35] = static_cast<char>(ch);
+    ASSERT_EQ(special ? 5u : 40u, ScanJsonStructure(Bytes(str), 40));
+    ASSERT_EQ(special ? 35u : 40u, 
+              ScanJsonStructure(Bytes(str) + 30, 10) + 30);
+  }
+  
+  const char* specials = "[]{}\"'";
+  for (size_t size = 0; size < 50; size++) {
+    for (size_t pos = 0; pos <= size; pos++) {
+      string str(size, 'a');
+      if (pos < size)
+        str[pos] = specials[pos % 6];
+      ASSERT_EQ(pos, ScanJsonStructure(Bytes(str), size));
+    }
+  }
+}
+
+TEST(JsonScanTest, SkipContainer) {
+  // Everything after the opening bracket
+  string json = "\"a]\": [1, '}', \"\\\"]\", {\"b\": []}]} , 2]";
+  size_t end = json.find(" , 2]");
+  
+  JsonSkipState state;
+  ASSERT_EQ(end, SkipJsonContainer(Bytes(json), json.size(), &state));
+  ASSERT_EQ(0, state.depth);
+  
+  // Split into blocks at every possible point
+  for (size_t block_size = 1; block_size < end; block_size++) {
+    JsonSkipState block_state;
+    size_t pos = 0;
+    while (block_state.depth > 0) {
+      size_t size = std::min(block_size, json.size() - pos);
+      size_t skip_size = SkipJsonContainer(Bytes(json) + pos, size, 
+                                           &block_state);
+      ASSERT_TRUE(block_state.depth == 0 || skip_size == size);
+      pos += skip_size;
+    }
+    ASSERT_EQ(end, pos);
+  }
+}
+
+TEST(JsonScanTest, UnescapedRun) {
+  string text = "plain text with \xc3\xa9 and \x7f in it, long enough";
+  ASSERT_EQ(text.size(), ScanJsonUnescapedRun(Bytes(text), text.size()));
+  
+  // Every byte that needs escaping, at every position
+  for (int ch = 0; ch < 256; ch++) {
+    bool needs_escape = ch == '"' || ch == '\\' || ch < ' ';
+    for (size_t i = 0; i < text.size(); i += 5) {
+      string escaped = text;
+      escaped[i] = static_cast<char>(ch);
+      ASSERT_EQ(needs_escape ? i : text.size(), 
+                ScanJsonUnescapedRun(Bytes(escaped), escaped.size())) << ch;
+    }
+  }
+}
+
+TEST(JsonScanTest, Numbers) {
+  string json = "-12.5e+3, 7";
+  ASSERT_EQ(8u, ScanJsonNumber(Bytes(json), json.size()));
+  ASSERT_EQ(0u, ScanJsonNumber(Bytes(json) + 8, json.size() - 8));
+  ASSERT_EQ(1u, ScanJsonNumber(Bytes(json) + 10, 1));
+}
+
+TEST(JsonScanTest, EightDigits) {
+  const char* digits[] = { "00000000", "12345678", "99999999", "00000001" };
+  uint32_t values[] = { 0, 12345678, 99999999, 1 };
+  for (size_t i = 0; i < ArrayLength(digits); i++) {
+    ASSERT_TRUE(IsEightDigits(Bytes(digits[i])));
+    ASSERT_EQ(values[i], ParseEightDigits(Bytes(digits[i])));
+  }
+  
+  // Every byte that isn't a digit, in every position
+  for (int ch = 0; ch < 256; ch++) {
+    if (ch >= '0' && ch <= '9')
+      continue;
+    for (size_t i = 0; i < 8; i++) {
+      string text = "12345678";
+      text[i] = static_cast<char>(ch);
+      ASSERT_FALSE(IsEightDigits(Bytes(text))) << ch << " at " << i;
+    }
+  }
+}
+
+}
@@ -1,7 +1,8 @@
 
 #include "base/json_writer.h"
+#include "base/json_scan.h"
 
-#include <inttypes.h>
+#include <math.h>
 #include <string.h>
 
 namespace cheaproute {
@@ -25,7 +26,67 @@ const char kSpecialEscapes[] = { 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 ,
                                  0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 ,
                                  0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 };
 
-void JsonWriter::WritePropertyName(const char* str) {
+namespace {
+
+// Lets WriteEscapedString() append to a string as well as write to a
+// stream
+class StringAppender {
+public:
+  explicit StringAppender(string* str) : str_(str) {}
+  
+  void Write(char ch) { str_->push_back(ch); }
+  void Write(const void* buf, size_t size) {
+    str_->append(static_cast<const char*>(buf), size);
+  }
+  
+private:
+  string* str_;
+};
+
+}
+
+template<typename TOutput>
+static void WriteEscapedString(TOutput* output, const char* str, 
+                               size_t size) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(str);
+  const uint8_t* end = p + size;
+  output->Write('"');
+  while (p < end) {
+    // Most strings have nothing to escape and go out in one piece
+    size_t run_size = ScanJsonUnescapedRun(p, end - p);
+    output->Write(p, run_size);
+    p += run_size;
+    if (p == end)
+      break;
+    
+    uint8_t ch = *p++;
+    if (ch == '"' || ch == '\\') {
+      output->Write('\\');
+      output->Write(static_cast<char>(ch));
+    } else {
+      char special_escape_code = kSpecialEscapes[ch];
+      output->Write('\\');
+      if (special_escape_code) {
+        output->Write(special_escape_code);
+      } else {
+        output->Write('u');
+        output->Write('0');
+        output->Write('0');
+        output->Write(kHexChars[(ch & 0xf0) >> 4]);
+        output->Write(kHexChars[(ch & 0x0f) >> 0]);
+      }
+    }
+  }
+  output->Write('"');
+}
+
+JsonPropertyName::JsonPropertyName(const char* name) {
+  StringAppender appender(&encoded_);
+  WriteEscapedString(&appender, name, strlen(name));
+  encoded_.append(": ");
+}
+
+void JsonWriter::BeginPropertyName() {
   assert(mode_ == JsonWriterMode_StartObject || mode_ == JsonWriterMode_ObjectPropertyName);
   if (mode_ == JsonWriterMode_ObjectPropertyName) {
     stream_->Write(',');
@@ -35,61 +96,85 @@ void JsonWriter::WritePropertyName(const char* str) {
   }
   BeginNewLineIfNecessary();
   mode_ = JsonWriterMode_ObjectPropertyValue;
-  WriteRawString(str);
+}
+
+void JsonWriter::WritePropertyName(const char* str) {
+  BeginPropertyName();
+  WriteRawString(str, strlen(str));
   stream_->Write(':');
   if (should_indent())
     stream_->Write(' ');
 }
+
+void JsonWriter::WritePropertyName(const JsonPropertyName& name) {
+  BeginPropertyName();
+  const string& encoded = name.encoded_;
+  stream_->Write(encoded.data(), 
+                 should_indent() ? encoded.size() : encoded.size() - 1);
+}
                                  
 void JsonWriter::WriteString(const char* str) {
   BeginValue();
-  WriteRawString(str);
+  WriteRawString(str, strlen(str));
 }
 
-void JsonWriter::WriteRawString(const char* str) {
-  const char* p = str;
-  stream_->Write('"');
-  while (uint8_t ch = *p++) {
-    if (ch == '"' || ch == '\\') {
-      stream_->Write('\\');
-      stream_->Write(ch);
-    } else if (ch < ' ') {
-      char special_escape_code = kSpecialEscapes[ch];
-      stream_->Write('\\');
-      if (special_escape_code) {
-        stream_->Write(special_escape_code);
-      } else {
-        stream_->Write('u');
-        stream_->Write('0');
-        stream_->Write('0');
-        stream_->Write(kHexChars[(ch & 0xf0) >> 4]);
-        stream_->Write(kHexChars[(ch & 0x0f) >> 0]);
-      }
-    } else {
-      stream_->Write(ch);
-    }
+void JsonWriter::WriteRawString(const char* str, size_t size) {
+  WriteEscapedString(stream_.get(), str, size);
+}
+
+// "00" through "99", so digits can be formatted two at a time
+static const char kDigitPairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536"
+  "37383940414243444546474849505152535455565758596061626364656667686970717273"
+  "7475767778798081828384858687888990919293949596979899";
+
+void JsonWriter::WriteDigits(uint64_t magnitude, bool negative) {
+  // Filled in from the end; 20 digits and a sign is as long as it gets
+  char buffer[24];
+  char* end = buffer + sizeof(buffer);
+  char* p = end;
+  while (magnitude >= 100) {
+    size_t pair = static_cast<size_t>(magnitude % 100) * 2;
+    magnitude /= 100;
+    p -= 2;
+    memcpy(p, kDigitPairs + pair, 2);
   }
-  stream_->Write('"');
+  if (magnitude >= 10) {
+    p -= 2;
+    memcpy(p, kDigitPairs + magnitude * 2, 2);
+  } else {
+    *--p = static_cast<char>('0' + magnitude);
+  }
+  if (negative)
+    *--p = '-';
+  stream_->Write(p, end - p);
 }
+
 void JsonWriter::WriteInteger(uint32_t value) {
   BeginValue();
-  
-  char buffer[16];
-  snprintf(buffer, sizeof(buffer), "%"PRIu32, value);
-  stream_->Write(buffer, strlen(buffer));
+  WriteDigits(value, false);
 }
 void JsonWriter::WriteInteger(int value) {
   BeginValue();
-  
-  char buffer[16];
-  snprintf(buffer, sizeof(buffer), "%d", value);
-  stream_->Write(buffer, strlen(buffer));
+  // Negated as unsigned so INT_MIN works too
+  uint64_t magnitude = static_cast<uint64_t>(value);
+  WriteDigits(value < 0 ? 0 - magnitude : magnitude, value < 0);
 }
 void JsonWriter::WriteInteger(int64_t value) {
   BeginValue();
+  uint64_t magnitude = static_cast<uint64_t>(value);
+  WriteDigits(value < 0 ? 0 - magnitude : magnitude, value < 0);
+}
+void JsonWriter::WriteDouble(double value) {
+  // JSON has no way to spell NaN or infinity
+  if (isnan(value) || isinf(value)) {
+    WriteNull();
+    return;
+  }
+  BeginValue();
   
   char buffer[32];
-  snprintf(buffer, sizeof(buffer), "%"PRId64, value);
+  snprintf(buffer, sizeof(buffer), "%.17g", value);
   stream_->Write(buffer, strlen(buffer));
 }
 void JsonWriter::WriteBoolean(bool value) {
@@ -159,10 +244,14 @@ void JsonWriter::BeginValue() {
 }
 
 void JsonWriter::BeginNewLineIfNecessary() {
+  static const char kSpaces[] = "                                ";
   if (should_indent() && pack_ == 0) {
     stream_->Write('\n');
-    for (int i = 0; i < indent_; i++) {
-      stream_->Write(' ');
+    size_t remaining = static_cast<size_t>(indent_);
+    while (remaining > 0) {
+      size_t size = std::min(remaining, sizeof(kSpaces) - 1);
+      stream_->Write(kSpaces, size);
+      remaining -= size;
     }
   }
 }
@@ -19,6 +19,21 @@ enum JsonWriterFlags {
   JsonWriterFlags_Indent = (1 << 0)
 };
 
+// A property name that's been escaped and quoted once, colon and all, so
+// that writing it is a single copy. For names written over and over, such
+// as the fields of every packet in a log.
+class JsonPropertyName {
+public:
+  explicit JsonPropertyName(const char* name);
+  
+private:
+  friend class JsonWriter;
+  
+  // Ends with the space that JsonWriterFlags_Indent puts after the colon,
+  // which is left off otherwise
+  string encoded_;
+};
+
 class JsonWriter {
 public:
   JsonWriter(shared_ptr<BufferedOutputStream> stream, 
@@ -26,12 +41,18 @@ public:
   
   void WritePropertyName(const string& str) { WritePropertyName(str.c_str()); }
   void WritePropertyName(const char* str);
-  void WriteString(const string& str) { WriteString(str.c_str()); }
+  void WritePropertyName(const JsonPropertyName& name);
+  void WriteString(const string& str) {
+    BeginValue();
+    WriteRawString(str.data(), str.size());
+  }
   void WriteString(const char* str);
   
   void WriteInteger(int value);
   void WriteInteger(uint32_t value);
   void WriteInteger(int64_t value);
+  // NaN and infinities are written as null
+  void WriteDouble(double value);
   void WriteBoolean(bool value);
   void WriteNull();
   
@@ -47,7 +68,9 @@ public:
   void Flush();
   
 private:
-  void WriteRawString(const char* str);
+  void BeginPropertyName();
+  void WriteRawString(const char* str, size_t size);
+  void WriteDigits(uint64_t magnitude, bool negative);
   void BeginValue();
   void BeginNewLineIfNecessary();
   
@@ -8,6 +8,8 @@
 #include "json_writer.h"
 #include "test_util/json.h"
 
+#include <inttypes.h>
+#include <math.h>
 #include <stdint.h>
 
 namespace cheaproute {
@@ -32,6 +34,11 @@ void TestJsonWriteInteger(const string& expected_json, int64_t value) {
   fixture.writer()->WriteInteger(value);
   fixture.AssertContents(expected_json);
 }
+void TestJsonWriteDouble(const string& expected_json, double value) {
+  JsonWriterFixture fixture;
+  fixture.writer()->WriteDouble(value);
+  fixture.AssertContents(expected_json);
+}
 
 TEST(JsonWriter, String) {
   TestJsonWriteString("\"hello\"", "hello");
@@ -39,6 +46,23 @@ TEST(JsonWriter, String) {
                       "\r\n\t\f\b\\\"\x01\x1f");
 }
 
+// Long enough that the escapes land in different 16-byte blocks
+TEST(JsonWriter, LongString) {
+  string plain = "0123456789abcdefghijklmnopqrstuvwxyz";
+  TestJsonWriteString("\"" + plain + "\"", plain);
+  for (size_t i = 0; i < plain.size(); i++) {
+    string value = plain;
+    value[i] = '"';
+    string expected = "\"" + plain.substr(0, i) + "\\\"" + 
+                      plain.substr(i + 1) + "\"";
+    TestJsonWriteString(expected, value);
+  }
+  TestJsonWriteString("\"" + plain + "\x7f\xc3\xa9\"", 
+                      plain + "\x7f\xc3\xa9");
+  TestJsonWriteString("\"" + plain + "\\u0000" + plain + "\"", 
+                      plain + string(1, '\0') + plain);
+}
+
 TEST(JsonWriter, Integer) {
   TestJsonWriteInteger("0", 0);
   TestJsonWriteInteger("12345", 12345);
@@ -48,6 +72,30 @@ TEST(JsonWriter, Integer) {
   TestJsonWriteInteger("12734987234838", static_cast<int64_t>(12734987234838LL));
   TestJsonWriteInteger("9223372036854775807", INT64_MAX);
   TestJsonWriteInteger("-9223372036854775808", INT64_MIN);
+  
+  // Both ends of every run of digit pairs
+  int64_t power = 1;
+  for (int digits = 1; digits < 19; digits++) {
+    TestJsonWriteInteger(StrPrintf("%" PRId64, power), power);
+    TestJsonWriteInteger(StrPrintf("%" PRId64, power * 10 - 1), 
+                         power * 10 - 1);
+    TestJsonWriteInteger(StrPrintf("%" PRId64, -power), -power);
+    power *= 10;
+  }
+  
+  JsonWriterFixture fixture;
+  fixture.writer()->WriteInteger(UINT32_MAX);
+  fixture.AssertContents("4294967295");
+}
+
+TEST(JsonWriter, Double) {
+  TestJsonWriteDouble("0", 0.0);
+  TestJsonWriteDouble("1.5", 1.5);
+  TestJsonWriteDouble("-0.25", -0.25);
+  TestJsonWriteDouble("0.10000000000000001", 0.1);
+  TestJsonWriteDouble("1.2676506002282294e+30", ldexp(1.0, 100));
+  TestJsonWriteDouble("null", NAN);
+  TestJsonWriteDouble("null", INFINITY);
 }
 
 TEST(JsonWriter, Boolean) {
@@ -252,4 +300,49 @@ TEST(JsonWriter, IndentWithPackedLines) {
 }
 
 
-}
\ No newline at end of file
+// Pre-encoded names come out exactly like the ones written as strings,
+// with and without indenting and packing
+static void WriteNamedObject(JsonWriter* writer, bool pre_encoded) {
+  static const JsonPropertyName kFoo("foo");
+  static const JsonPropertyName kEscaped("a \"quoted\"\tname");
+  writer->BeginObject();
+  if (pre_encoded)
+    writer->WritePropertyName(kFoo);
+  else
+    writer->WritePropertyName("foo");
+  writer->WriteInteger(1);
+  writer->WritePropertyName("inner");
+  writer->BeginPack();
+  writer->BeginObject();
+  if (pre_encoded)
+    writer->WritePropertyName(kFoo);
+  else
+    writer->WritePropertyName("foo");
+  writer->WriteInteger(2);
+  if (pre_encoded)
+    writer->WritePropertyName(kEscaped);
+  else
+    writer->WritePropertyName("a \"quoted\"\tname");
+  writer->WriteInteger(3);
+  writer->EndObject();
+  writer->EndPack();
+  writer->EndObject();
+}
+
+TEST(JsonWriter, PreEncodedPropertyName) {
+  JsonWriterFlags flags[] = { JsonWriterFlags_None, JsonWriterFlags_Indent };
+  const char* expected[] = {
+    "{\"foo\":1,\"inner\":{\"foo\":2,\"a \\\"quoted\\\"\\tname\":3}}",
+    "{\n  \"foo\": 1,\n  \"inner\": "
+        "{\"foo\": 2, \"a \\\"quoted\\\"\\tname\": 3}\n}"
+  };
+  for (size_t i = 0; i < ArrayLength(flags); i++) {
+    for (int pre_encoded = 0; pre_encoded < 2; pre_encoded++) {
+      JsonWriterFixture fixture(flags[i]);
+      WriteNamedObject(fixture.writer(), pre_encoded != 0);
+      fixture.AssertContents(expected[i]);
+    }
+  }
+}
+
+}
@@ -0,0 +1,79 @@
+#include "base/loop_group.h"
+#include "base/event_loop.h"
+#include "base/event_loop_thread.h"
+
+#include <sched.h>
+
+namespace cheaproute {
+
+// The CPUs this process may run on, which may be fewer than the machine
+// has (taskset, cgroups)
+static vector<int> AllowedCpus() {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  if (sched_getaffinity(0, sizeof(cpus), &cpus) == -1)
+    AbortWithPosixError("Unable to get CPU affinity");
+  
+  vector<int> result;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &cpus))
+      result.push_back(cpu);
+  }
+  return result;
+}
+
+LoopGroup::LoopGroup(size_t count, LoopGroupFlags flags) {
+  if (count < 1) {
+    AbortWithMessage("A loop group needs at least one loop");
+  }
+  
+  vector<int> allowed_cpus;
+  if (flags & LoopGroupFlags_PinThreads)
+    allowed_cpus = AllowedCpus();
+  
+  for (size_t i = 0; i < count; i++) {
+    shared_ptr<EventLoopThread> thread(new EventLoopThread());
+    int cpu = -1;
+    if (!allowed_cpus.empty()) {
+      cpu = allowed_cpus[i % allowed_cpus.size()];
+      thread->set_cpu(cpu);
+    }
+    threads_.push_back(thread);
+    cpus_.push_back(cpu);
+  }
+}
+
+LoopGroup::~LoopGroup() {
+}
+
+EventLoop* LoopGroup::loop(size_t index) {
+  return threads_[index]->loop();
+}
+
+vector<EventLoop*> LoopGroup::loops() {
+  vector<EventLoop*> result;
+  for (size_t i = 0; i < threads_.size(); i++) {
+    result.push_back(threads_[i]->loop());
+  }
+  return result;
+}
+
+void LoopGroup::Start() {
+  for (size_t i = 0; i < threads_.size(); i++) {
+    threads_[i]->Start();
+  }
+}
+
+void LoopGroup::Stop() {
+  for (size_t i = 0; i < threads_.size(); i++) {
+    threads_[i]->Stop();
+  }
+}
+
+void LoopGroup::Join() {
+  for (size_t i = 0; i < threads_.size(); i++) {
+    threads_[i]->Join();
+  }
+}
+
+}
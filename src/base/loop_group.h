@@ -0,0 +1,50 @@
+#pragma once
+
+#include "base/common.h"
+
+namespace cheaproute {
+
+class EventLoop;
+class EventLoopThread;
+
+enum LoopGroupFlags {
+  LoopGroupFlags_None = 0,
+  
+  // Pins the thread of loop i to the i-th CPU the process is allowed to run
+  // on, wrapping around if there are more loops than CPUs
+  LoopGroupFlags_PinThreads = (1 << 0)
+};
+
+// A fixed set of EventLoops, each run on a thread of its own; the unit
+// that work is sharded across. Like with EventLoopThread, the loops should
+// be set up before Start() is called, and after that only be touched from
+// their own threads or through EventLoop::Post().
+class LoopGroup {
+public:
+  LoopGroup(size_t count, LoopGroupFlags flags);
+  
+  // Blocks until every loop runs out of active watchers, unless Stop() was
+  // called
+  ~LoopGroup();
+  
+  size_t size() const { return threads_.size(); }
+  EventLoop* loop(size_t index);
+  vector<EventLoop*> loops();
+  
+  // The CPU loop index is pinned to, or -1 if it isn't pinned
+  int cpu(size_t index) const { return cpus_[index]; }
+  
+  void Start();
+  // Makes every loop return even if it still has watchers; Join() waits
+  // for them to do so
+  void Stop();
+  void Join();
+  
+private:
+  LoopGroup(const LoopGroup& other);
+  
+  vector<shared_ptr<EventLoopThread> > threads_;
+  vector<int> cpus_;
+};
+
+}
@@ -0,0 +1,79 @@
+#include "base/common.h"
+
+#include "gtest/gtest.h"
+
+#include "base/event_loop.h"
+#include "base/loop_group.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace cheaproute {
+
+// What a loop's thread finds out about itself
+struct GroupThreadInfo {
+  GroupThreadInfo() : ran(false), cpu_count(0) {}
+  
+  void Record() {
+    ran = true;
+    thread = pthread_self();
+    cpu_set_t cpus;
+    ASSERT_EQ(0, sched_getaffinity(0, sizeof(cpus), &cpus));
+    cpu_count = CPU_COUNT(&cpus);
+    running_on = sched_getcpu();
+  }
+  
+  bool ran;
+  pthread_t thread;
+  int cpu_count;
+  int running_on;
+};
+
+// Runs every loop of the group until each has recorded its thread
+static void RunGroup(LoopGroup* group, vector<GroupThreadInfo>* infos) {
+  infos->resize(group->size());
+  for (size_t i = 0; i < group->size(); i++) {
+    group->loop(i)->Post(bind(&GroupThreadInfo::Record, &(*infos)[i]));
+    group->loop(i)->Ref();
+  }
+  group->Start();
+  group->Stop();
+  group->Join();
+}
+
+TEST(LoopGroupTest, RunsEachLoopOnItsOwnThread) {
+  LoopGroup group(3, LoopGroupFlags_None);
+  ASSERT_EQ(3u, group.size());
+  vector<GroupThreadInfo> infos;
+  RunGroup(&group, &infos);
+  
+  for (size_t i = 0; i < infos.size(); i++) {
+    ASSERT_TRUE(infos[i].ran);
+    ASSERT_EQ(-1, group.cpu(i));
+    ASSERT_FALSE(pthread_equal(pthread_self(), infos[i].thread));
+    for (size_t j = 0; j < i; j++) {
+      ASSERT_FALSE(pthread_equal(infos[j].thread, infos[i].thread));
+    }
+  }
+}
+
+TEST(LoopGroupTest, PinsThreadsToAllowedCpus) {
+  cpu_set_t allowed;
+  ASSERT_EQ(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+  
+  // More loops than CPUs wrap around
+  size_t count = CPU_COUNT(&allowed) + 1;
+  LoopGroup group(count, LoopGroupFlags_PinThreads);
+  vector<GroupThreadInfo> infos;
+  RunGroup(&group, &infos);
+  
+  for (size_t i = 0; i < count; i++) {
+    ASSERT_TRUE(infos[i].ran);
+    ASSERT_TRUE(CPU_ISSET(group.cpu(i), &allowed));
+    ASSERT_EQ(1, infos[i].cpu_count);
+    ASSERT_EQ(group.cpu(i), infos[i].running_on);
+  }
+  ASSERT_EQ(group.cpu(0), group.cpu(count - 1));
+}
+
+}
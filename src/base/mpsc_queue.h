@@ -0,0 +1,83 @@
+#pragma once
+
+#include "base/common.h"
+
+namespace cheaproute {
+
+// An unbounded multi-producer, single-consumer queue, after Dmitry Vyukov's
+// non-intrusive MPSC node queue. Push() may be called from any thread and
+// never takes a lock; Pop() may only be called from one thread at a time.
+//
+// A Pop() that races with a Push() in progress may briefly see the queue as
+// empty, so producers need to signal the consumer after pushing rather than
+// before.
+template<typename T>
+class MpscQueue {
+public:
+  MpscQueue()
+    : head_(new Node()),
+      tail_(head_) {
+  }
+  
+  ~MpscQueue() {
+    while (tail_) {
+      Node* next = tail_->next;
+      delete tail_;
+      tail_ = next;
+    }
+  }
+  
+  void Push(const T& value) {
+    Node* node = new Node(value);
+    
+    // Swing head_ to the new node, then link the old head to it. Until the
+    // link is made, the consumer can't see this node or any pushed after it.
+    Node* prev;
+    do {
+      prev = head_;
+    } while (!__sync_bool_compare_and_swap(&head_, prev, node));
+    __sync_synchronize();
+    prev->next = node;
+  }
+  
+  // Returns false if the queue is empty
+  bool Pop(T* value) {
+    Node* tail = tail_;
+    Node* next = tail->next;
+    if (!next)
+      return false;
+    __sync_synchronize();
+    
+    // next becomes the new stub node, so its value is moved out rather
+    // than the node being freed
+    *value = next->value;
+    next->value = T();
+    tail_ = next;
+    delete tail;
+    return true;
+  }
+  
+private:
+  MpscQueue(const MpscQueue& other);
+  
+  struct Node {
+    Node()
+      : next(NULL) {
+    }
+    explicit Node(const T& value)
+      : next(NULL),
+        value(value) {
+    }
+    
+    Node* volatile next;
+    T value;
+  };
+  
+  // Producers and the consumer work on opposite ends; keep them on
+  // separate cache lines
+  Node* volatile head_;
+  char padding_[64 - sizeof(Node*)];
+  Node* tail_;
+};
+
+}
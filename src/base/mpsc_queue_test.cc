@@ -0,0 +1,79 @@
+#include "base/common.h"
+
+#include "gtest/gtest.h"
+
+#include "base/mpsc_queue.h"
+#include "base/thread.h"
+
+namespace cheaproute {
+
+TEST(MpscQueueTest, PopsInPushOrder) {
+  MpscQueue<int> queue;
+  int value;
+  ASSERT_FALSE(queue.Pop(&value));
+  
+  queue.Push(1);
+  queue.Push(2);
+  ASSERT_TRUE(queue.Pop(&value));
+  ASSERT_EQ(1, value);
+  queue.Push(3);
+  ASSERT_TRUE(queue.Pop(&value));
+  ASSERT_EQ(2, value);
+  ASSERT_TRUE(queue.Pop(&value));
+  ASSERT_EQ(3, value);
+  ASSERT_FALSE(queue.Pop(&value));
+}
+
+TEST(MpscQueueTest, ReleasesValues) {
+  shared_ptr<int> tracked(new int(5));
+  {
+    MpscQueue<shared_ptr<int> > queue;
+    queue.Push(tracked);
+    queue.Push(tracked);
+    ASSERT_EQ(3, tracked.use_count());
+    
+    shared_ptr<int> popped;
+    ASSERT_TRUE(queue.Pop(&popped));
+    popped.reset();
+    ASSERT_EQ(2, tracked.use_count());
+  }
+  ASSERT_EQ(1, tracked.use_count());
+}
+
+const int kProducers = 4;
+const int kItemsPerProducer = 100000;
+
+static void Produce(MpscQueue<int>* queue, int producer) {
+  for (int i = 0; i < kItemsPerProducer; i++) {
+    queue->Push(producer * kItemsPerProducer + i);
+  }
+}
+
+TEST(MpscQueueTest, KeepsEachProducersOrder) {
+  MpscQueue<int> queue;
+  vector<shared_ptr<Thread> > threads;
+  for (int i = 0; i < kProducers; i++) {
+    threads.push_back(shared_ptr<Thread>(new Thread(bind(&Produce, &queue, i))));
+    threads.back()->Start();
+  }
+  
+  vector<int> next(kProducers, 0);
+  int received = 0;
+  while (received < kProducers * kItemsPerProducer) {
+    int value;
+    if (!queue.Pop(&value))
+      continue;
+    int producer = value / kItemsPerProducer;
+    ASSERT_EQ(next[producer], value % kItemsPerProducer);
+    next[producer]++;
+    received++;
+  }
+  
+  for (int i = 0; i < kProducers; i++) {
+    threads[i]->Join();
+  }
+  int value;
+  ASSERT_FALSE(queue.Pop(&value));
+}
+
+}
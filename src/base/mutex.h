@@ -0,0 +1,83 @@
+#pragma once
+
+#include "base/common.h"
+
+#include <pthread.h>
+
+namespace cheaproute {
+
+class Mutex {
+public:
+  Mutex() {
+    int result = pthread_mutex_init(&mutex_, NULL);
+    if (result != 0)
+      AbortWithPosixError(result, "Unable to initialize mutex");
+  }
+  ~Mutex() {
+    pthread_mutex_destroy(&mutex_);
+  }
+  
+  void Lock() {
+    int result = pthread_mutex_lock(&mutex_);
+    if (result != 0)
+      AbortWithPosixError(result, "Unable to lock mutex");
+  }
+  void Unlock() {
+    int result = pthread_mutex_unlock(&mutex_);
+    if (result != 0)
+      AbortWithPosixError(result, "Unable to unlock mutex");
+  }
+  
+private:
+  friend class ConditionVariable;
+  Mutex(const Mutex& other);
+  
+  pthread_mutex_t mutex_;
+};
+
+// Holds a Mutex locked for the lifetime of the object
+class MutexLock {
+public:
+  explicit MutexLock(Mutex* mutex)
+      : mutex_(mutex) {
+    mutex_->Lock();
+  }
+  ~MutexLock() {
+    mutex_->Unlock();
+  }
+  
+private:
+  MutexLock(const MutexLock& other);
+  
+  Mutex* mutex_;
+};
+
+class ConditionVariable {
+public:
+  ConditionVariable() {
+    int result = pthread_cond_init(&cond_, NULL);
+    if (result != 0)
+      AbortWithPosixError(result, "Unable to initialize condition variable");
+  }
+  ~ConditionVariable() {
+    pthread_cond_destroy(&cond_);
+  }
+  
+  // mutex must be locked; it's unlocked while waiting. Wakeups may be
+  // spurious, so check the condition again.
+  void Wait(Mutex* mutex) {
+    int result = pthread_cond_wait(&cond_, &mutex->mutex_);
+    if (result != 0)
+      AbortWithPosixError(result, "Unable to wait on condition variable");
+  }
+  void Signal() {
+    pthread_cond_signal(&cond_);
+  }
+  
+private:
+  ConditionVariable(const ConditionVariable& other);
+  
+  pthread_cond_t cond_;
+};
+
+}
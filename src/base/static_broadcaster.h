@@ -0,0 +1,93 @@
+#pragma once
+
+#include "base/common.h"
+
+namespace cheaproute {
+
+// Fills the unused slots of a StaticBroadcaster
+struct NoListener {};
+
+// A broadcaster for a set of listeners whose types are known at compile
+// time, for the hot paths where Broadcaster's virtual call per listener
+// shows up. Up to eight listeners are fixed at construction (any of them
+// may be NULL), and Broadcast() is unrolled into a direct call to each,
+// so nothing is allocated and everything can be inlined.
+//
+// The action is called with each listener as a pointer to its own type,
+// so it has to be a functor with a templated operator():
+//
+//   struct Click {
+//     template<typename T> void operator()(T* listener) const {
+//       listener->T::HandleClick(x, y);
+//     }
+//     int x, y;
+//   };
+//
+// Qualifying the method with T:: keeps the call from being virtual even if
+// the listener also implements a listener interface.
+//
+// Unlike Broadcaster, the listener set can't change, so the listeners must
+// outlive the StaticBroadcaster.
+template<typename T1, 
+         typename T2 = NoListener, 
+         typename T3 = NoListener, 
+         typename T4 = NoListener,
+         typename T5 = NoListener, 
+         typename T6 = NoListener, 
+         typename T7 = NoListener, 
+         typename T8 = NoListener>
+class StaticBroadcaster {
+public:
+  explicit StaticBroadcaster(T1* listener1,
+                             T2* listener2 = NULL,
+                             T3* listener3 = NULL,
+                             T4* listener4 = NULL,
+                             T5* listener5 = NULL,
+                             T6* listener6 = NULL,
+                             T7* listener7 = NULL,
+                             T8* listener8 = NULL)
+    : listener1_(listener1),
+      listener2_(listener2),
+      listener3_(listener3),
+      listener4_(listener4),
+      listener5_(listener5),
+      listener6_(listener6),
+      listener7_(listener7),
+      listener8_(listener8) {
+  }
+  
+  // Calls action on every listener, in order
+  template<typename TAction>
+  void Broadcast(const TAction& action) const {
+    Dispatch(listener1_, action);
+    Dispatch(listener2_, action);
+    Dispatch(listener3_, action);
+    Dispatch(listener4_, action);
+    Dispatch(listener5_, action);
+    Dispatch(listener6_, action);
+    Dispatch(listener7_, action);
+    Dispatch(listener8_, action);
+  }
+  
+private:
+  template<typename T, typename TAction>
+  static void Dispatch(T* listener, const TAction& action) {
+    if (listener)
+      action(listener);
+  }
+  
+  template<typename TAction>
+  static void Dispatch(NoListener* listener, const TAction& action) {
+  }
+  
+  T1* listener1_;
+  T2* listener2_;
+  T3* listener3_;
+  T4* listener4_;
+  T5* listener5_;
+  T6* listener6_;
+  T7* listener7_;
+  T8* listener8_;
+};
+
+}
@@ -0,0 +1,90 @@
+#include "base/common.h"
+
+#include "gtest/gtest.h"
+
+#include "base/static_broadcaster.h"
+
+#include <sstream>
+
+namespace cheaproute {
+
+class Logger {
+public:
+  explicit Logger(std::stringstream* ss)
+    : ss_(ss) {
+  }
+  
+  void HandleClick(int x, int y) {
+    *ss_ << "Logger(" << x << ", " << y << ")\n";
+  }
+  
+private:
+  std::stringstream* ss_;
+};
+
+class Counter {
+public:
+  Counter()
+    : clicks_(0) {
+  }
+  
+  void HandleClick(int x, int y) {
+    clicks_++;
+  }
+  
+  int clicks() const { return clicks_; }
+  
+private:
+  int clicks_;
+};
+
+struct Click {
+  Click(int x, int y)
+    : x(x),
+      y(y) {
+  }
+  
+  template<typename T>
+  void operator()(T* listener) const {
+    listener->T::HandleClick(x, y);
+  }
+  
+  int x;
+  int y;
+};
+
+TEST(StaticBroadcaster, CallsEachListenerInOrder) {
+  std::stringstream ss;
+  Logger first(&ss);
+  Counter counter;
+  Logger last(&ss);
+  StaticBroadcaster<Logger, Counter, Logger> broadcaster(&first, &counter, 
+                                                         &last);
+  
+  broadcaster.Broadcast(Click(1, 2));
+  broadcaster.Broadcast(Click(3, 4));
+  ASSERT_EQ("Logger(1, 2)\nLogger(1, 2)\nLogger(3, 4)\nLogger(3, 4)\n", 
+            ss.str());
+  ASSERT_EQ(2, counter.clicks());
+}
+
+TEST(StaticBroadcaster, SkipsMissingListeners) {
+  Counter counter;
+  StaticBroadcaster<Counter, Counter> broadcaster(NULL, &counter);
+  broadcaster.Broadcast(Click(1, 2));
+  ASSERT_EQ(1, counter.clicks());
+}
+
+TEST(StaticBroadcaster, EightListeners) {
+  Counter counters[8];
+  StaticBroadcaster<Counter, Counter, Counter, Counter, 
+                    Counter, Counter, Counter, Counter> broadcaster(
+      &counters[0], &counters[1], &counters[2], &counters[3],
+      &counters[4], &counters[5], &counters[6], &counters[7]);
+  broadcaster.Broadcast(Click(1, 2));
+  for (int i = 0; i < 8; i++) {
+    ASSERT_EQ(1, counters[i].clicks());
+  }
+}
+
+}
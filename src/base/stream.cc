@@ -5,23 +5,34 @@
 #include "base/file_descriptor.h"
 
 #include <algorithm>
+#include <errno.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <limits.h>
 
 namespace cheaproute {
 
+void OutputStream::WriteV(const struct iovec* iov, int count) {
+  for (int i = 0; i < count; i++) {
+    Write(iov[i].iov_base, iov[i].iov_len);
+  }
+}
   
 BufferedInputStream::BufferedInputStream(shared_ptr<InputStream> delegatee, size_t buffer_size) 
-  : delegatee_(delegatee) {
+  : delegatee_(delegatee),
+    marked_(false),
+    would_block_(false) {
   buffer_.resize(buffer_size);
-  pos_ = buffer_.begin();
-  end_ = buffer_.begin();
+  pos_ = &buffer_[0];
+  end_ = &buffer_[0];
+  mark_ = pos_;
 }
 
 ssize_t BufferedInputStream::Read(void* buf, size_t count) {
-  assert(pos_ <= buffer_.end());
+  assert(pos_ <= end_);
   
   uint8_t* dest = static_cast<uint8_t*>(buf);
   
@@ -36,7 +47,7 @@ ssize_t BufferedInputStream::Read(void* buf, size_t count) {
   
   // If there are many bytes to read, then we will skip the
   // buffering process and read directly in to the user's buffer
-  if (count >= buffer_.size() / 2) {
+  if (count >= buffer_.size() / 2 && !marked_) {
     return delegatee_->Read(buf, count);
   }
   
@@ -53,10 +64,55 @@ ssize_t BufferedInputStream::Read(void* buf, size_t count) {
   
 }
 
+bool BufferedInputStream::ReadSpan(const uint8_t** data, size_t* size) {
+  if (pos_ == end_ && FillBuffer() < 0)
+    return false;
+  *data = pos_;
+  *size = end_ - pos_;
+  pos_ = end_;
+  return true;
+}
+
 ssize_t BufferedInputStream::FillBuffer() {
-  ssize_t bytes_read = delegatee_->Read(&buffer_[0], buffer_.size());
-  assert(bytes_read <= static_cast<ssize_t>(buffer_.size()));
-  pos_ = buffer_.begin();
+  assert(pos_ == end_);
+  would_block_ = false;
+  
+  // Anything after the mark moves to the start of the buffer, and the new
+  // data goes after it
+  size_t kept_size = marked_ ? end_ - mark_ : 0;
+  if (kept_size > buffer_.size() / 2) {
+    vector<uint8_t> bigger_buffer(kept_size * 2);
+    memcpy(&bigger_buffer[0], mark_, kept_size);
+    buffer_.swap(bigger_buffer);
+  } else if (kept_size > 0) {
+    memmove(&buffer_[0], mark_, kept_size);
+  }
+  
+  const uint8_t* span;
+  size_t span_size;
+  if (delegatee_->ReadSpan(&span, &span_size)) {
+    if (kept_size == 0) {
+      pos_ = span;
+      end_ = span + span_size;
+      mark_ = pos_;
+      return span_size;
+    }
+    if (buffer_.size() < kept_size + span_size)
+      buffer_.resize(kept_size + span_size);
+    memcpy(&buffer_[kept_size], span, span_size);
+    mark_ = &buffer_[0];
+    pos_ = mark_ + kept_size;
+    end_ = pos_ + span_size;
+    return span_size;
+  }
+  
+  ssize_t bytes_read = delegatee_->Read(&buffer_[kept_size], 
+                                        buffer_.size() - kept_size);
+  assert(bytes_read <= static_cast<ssize_t>(buffer_.size() - kept_size));
+  if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    would_block_ = true;
+  mark_ = &buffer_[0];
+  pos_ = mark_ + kept_size;
   end_ = pos_ + std::max(static_cast<ssize_t>(0), bytes_read);
   return bytes_read;
 }
@@ -80,12 +136,14 @@ BufferedOutputStream::BufferedOutputStream(shared_ptr<OutputStream> delegatee, s
   buffer_.resize(buffer_size);
   pos_ = buffer_.begin();
   end_ = buffer_.end();
+  piece_start_ = buffer_.begin();
 }
 
 void BufferedOutputStream::Write(const void* buf, size_t size) {
   if (size >= buffer_.size() / 2) {
-    Flush();
-    delegatee_->Write(buf, size);
+    // Not worth copying; write it out right away along with the buffer
+    WriteReference(buf, size);
+    WriteBuffer();
   } else {
     const uint8_t* src = static_cast<const uint8_t*>(buf);
     const uint8_t* src_end = src + size;
@@ -94,7 +152,7 @@ void BufferedOutputStream::Write(const void* buf, size_t size) {
       pos_ = std::copy(src, src + write_size, pos_);
       src += write_size;
       if (end_ == pos_) {
-        Flush();
+        WriteBuffer();
       }
     }
   }
@@ -102,11 +160,46 @@ void BufferedOutputStream::Write(const void* buf, size_t size) {
 }
 
 void BufferedOutputStream::Flush() {
-  size_t num_bytes_to_flush = pos_ - buffer_.begin();
-  if (num_bytes_to_flush > 0) {
-    delegatee_->Write(&buffer_[0], num_bytes_to_flush);
-    pos_ = buffer_.begin();
+  WriteBuffer();
+  delegatee_->Flush();
+}
+
+void BufferedOutputStream::WriteReference(const void* buf, size_t size) {
+  if (size == 0)
+    return;
+  
+  EndBufferedPiece();
+  struct iovec piece;
+  piece.iov_base = const_cast<void*>(buf);
+  piece.iov_len = size;
+  pieces_.push_back(piece);
+  
+  if (pieces_.size() >= kMaxPieces - 1)
+    WriteBuffer();
+}
+
+void BufferedOutputStream::EndBufferedPiece() {
+  if (pos_ == piece_start_)
+    return;
+  struct iovec piece;
+  piece.iov_base = &*piece_start_;
+  piece.iov_len = pos_ - piece_start_;
+  pieces_.push_back(piece);
+  piece_start_ = pos_;
+}
+
+void BufferedOutputStream::WriteBuffer() {
+  if (pieces_.empty()) {
+    size_t num_bytes_to_flush = pos_ - buffer_.begin();
+    if (num_bytes_to_flush > 0)
+      delegatee_->Write(&buffer_[0], num_bytes_to_flush);
+  } else {
+    EndBufferedPiece();
+    delegatee_->WriteV(&pieces_[0], static_cast<int>(pieces_.size()));
+    pieces_.clear();
   }
+  pos_ = buffer_.begin();
+  piece_start_ = buffer_.begin();
 }
 
 MemoryInputStream::MemoryInputStream(const void* data, size_t size)
@@ -122,14 +215,34 @@ ssize_t MemoryInputStream::Read(void* buf, size_t count) {
   return copy_size;
 }
 
+SpanInputStream::SpanInputStream(const void* data, size_t size)
+  : data_(static_cast<const uint8_t*>(data)),
+    size_(size),
+    pos_(0) {
+}
+
+ssize_t SpanInputStream::Read(void* buf, size_t count) {
+  size_t copy_size = std::min(count, size_ - pos_);
+  memcpy(buf, data_ + pos_, copy_size);
+  pos_ += copy_size;
+  return copy_size;
+}
+
+bool SpanInputStream::ReadSpan(const uint8_t** data, size_t* size) {
+  *data = data_ + pos_;
+  *size = size_ - pos_;
+  pos_ = size_;
+  return true;
+}
+
 MemoryOutputStream::MemoryOutputStream() 
     : pos_(0) {
   buffer_.resize(16);
 } 
 
 void MemoryOutputStream::Write(const void* buf, size_t count) {
-  if (count > buffer_.size()) {
-    buffer_.resize(std::max(buffer_.size() * 2, count));
+  if (pos_ + count > buffer_.size()) {
+    buffer_.resize(std::max(buffer_.size() * 2, pos_ + count));
   }
   memcpy(&buffer_[pos_], buf, count);
   pos_ += count;
@@ -141,7 +254,10 @@ FileInputStream::FileInputStream(const char* file_path) {
 }
 
 ssize_t FileInputStream::Read(void* buf, size_t count) {
-  return CheckFdOp(read(fd_, buf, count), "While reading from file");
+  ssize_t result = read(fd_, buf, count);
+  if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return -1;
+  return CheckFdOp(result, "While reading from file");
 }
 
 FileInputStream::~FileInputStream() {
@@ -150,6 +266,52 @@ FileInputStream::~FileInputStream() {
   }
 }
 
+MappedFileInputStream::MappedFileInputStream(const char* file_path)
+  : data_(NULL),
+    size_(0),
+    pos_(0) {
+  int fd = CheckFdOp(open(file_path, O_RDONLY), "While opening file");
+  struct stat st;
+  CheckFdOp(fstat(fd, &st), "While getting the size of a file");
+  size_ = st.st_size;
+  
+  // mmap() refuses to map nothing
+  if (size_ == 0) {
+    close(fd);
+    return;
+  }
+  
+  void* data = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED)
+    AbortWithPosixError("While mapping %s", file_path);
+  data_ = static_cast<uint8_t*>(data);
+  
+  // The mapping keeps the file around
+  close(fd);
+  
+  // Let the kernel read ahead aggressively and drop pages once we're past
+  madvise(data_, size_, MADV_SEQUENTIAL);
+}
+
+MappedFileInputStream::~MappedFileInputStream() {
+  if (data_)
+    munmap(data_, size_);
+}
+
+ssize_t MappedFileInputStream::Read(void* buf, size_t count) {
+  size_t copy_size = std::min(count, size_ - pos_);
+  memcpy(buf, data_ + pos_, copy_size);
+  pos_ += copy_size;
+  return copy_size;
+}
+
+bool MappedFileInputStream::ReadSpan(const uint8_t** data, size_t* size) {
+  *data = data_ + pos_;
+  *size = size_ - pos_;
+  pos_ = size_;
+  return true;
+}
+
 FileOutputStream::~FileOutputStream() {
   if (take_fd_ownership_) {
     close(fd_);
@@ -157,9 +319,12 @@ FileOutputStream::~FileOutputStream() {
 }
 
 void FileOutputStream::Write(const void* buf, size_t count) {
+  const uint8_t* src = static_cast<const uint8_t*>(buf);
   size_t total_bytes_written = 0;
   while (total_bytes_written < count) {
-    size_t bytes_written = CheckFdOp(write(fd_, buf, count), "writing to fd");
+    size_t bytes_written = CheckFdOp(write(fd_, src + total_bytes_written, 
+                                           count - total_bytes_written), 
+                                     "writing to fd");
     if (bytes_written == 0) {
       AbortWithMessage("write() returned 0");
     }
@@ -168,4 +333,30 @@ void FileOutputStream::Write(const void* buf, size_t count) {
   }
 }
 
+void FileOutputStream::WriteV(const struct iovec* iov, int count) {
+  // writev() may stop part way through a piece, so work on a copy that
+  // can be advanced past what was written
+  vector<struct iovec> pieces(iov, iov + count);
+  size_t next = 0;
+  while (next < pieces.size()) {
+    int piece_count = static_cast<int>(std::min<size_t>(pieces.size() - next, 
+                                                        IOV_MAX));
+    size_t bytes_written = CheckFdOp(writev(fd_, &pieces[next], piece_count),
+                                     "writing to fd");
+    if (bytes_written == 0) {
+      AbortWithMessage("writev() returned 0");
+    }
+    
+    while (next < pieces.size() && bytes_written >= pieces[next].iov_len) {
+      bytes_written -= pieces[next].iov_len;
+      next++;
+    }
+    if (bytes_written > 0) {
+      pieces[next].iov_base = static_cast<uint8_t*>(pieces[next].iov_base) + 
+                              bytes_written;
+      pieces[next].iov_len -= bytes_written;
+    }
+  }
+}
+
 }
\ No newline at end of file
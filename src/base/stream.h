@@ -2,27 +2,42 @@
 
 #include "base/common.h"
 
+#include <sys/uio.h>
+
 namespace cheaproute {
   
 class InputStream {
 public:
   virtual ~InputStream() {}
   virtual ssize_t Read(void* buf, size_t count) = 0;
+  
+  // Streams that already have their contents in memory can hand them out
+  // without copying. Points *data at the next *size bytes of the stream
+  // (*size is 0 at the end of the stream); the bytes stay valid until the
+  // stream is read from again. Returns false if the stream can't do this,
+  // in which case Read() has to be used instead.
+  virtual bool ReadSpan(const uint8_t** data, size_t* size) { return false; }
 };
 
 class OutputStream {
 public:
   virtual ~OutputStream() {}
   virtual void Write(const void* buf, size_t count) = 0;
+  // Writes each piece in order. Unless overridden, this just calls Write()
+  // for every piece.
+  virtual void WriteV(const struct iovec* iov, int count);
   virtual void Flush() = 0;
 };
 
 class BufferedInputStream : public InputStream {
 public:
+  // If the delegatee supports ReadSpan(), its spans are read in place and
+  // the buffer is never used
   BufferedInputStream(shared_ptr<InputStream> delegatee, 
                       size_t buffer_size);
   
   ssize_t Read(void* buf, size_t count);
+  bool ReadSpan(const uint8_t** data, size_t* size);
   
   // returns -1 if we hit the end of the stream
   int Read() {
@@ -41,6 +56,48 @@ public:
     }
   }
   
+  // Steps back over the byte the last Read() returned, which is always
+  // still in the buffer. Only valid straight after a Read() that didn't
+  // return -1.
+  void Unread() {
+    pos_--;
+  }
+
+  // The bytes that can be looked at without going to the delegatee, for
+  // scanning a block at a time; Skip() consumes some of them
+  const uint8_t* buffered_data() const { return pos_; }
+  size_t buffered_size() const { return end_ - pos_; }
+  void Skip(size_t count) {
+    assert(count <= buffered_size());
+    pos_ += count;
+  }
+  // Reads more from the delegatee if nothing is buffered. Returns false at
+  // the end of the stream.
+  bool Refill() {
+    return pos_ != end_ || FillBuffer() > 0;
+  }
+  
+  // While there's a mark, everything read since it stays in the buffer
+  // (which grows if it has to), so that ResetToMark() can go back to it.
+  // This is for parsers that have to undo half a token. Setting a mark
+  // also clears would_block().
+  void Mark() {
+    mark_ = pos_;
+    marked_ = true;
+    would_block_ = false;
+  }
+  void ResetToMark() {
+    assert(marked_);
+    pos_ = mark_;
+  }
+  void ClearMark() { marked_ = false; }
+  
+  // Whether the delegatee had nothing to read for now (it's a non-blocking
+  // FileInputStream and read() failed with EAGAIN) the last time the
+  // buffer needed filling. Reads return -1 in that case, just like at the
+  // end of the stream.
+  bool would_block() const { return would_block_; }
+  
 private:
   int ReadSlowPath();
   int PeekSlowPath();
@@ -48,8 +105,11 @@ private:
   
   shared_ptr<InputStream> delegatee_;
   vector<uint8_t> buffer_;
-  vector<uint8_t>::iterator pos_;
-  vector<uint8_t>::iterator end_;
+  const uint8_t* pos_;
+  const uint8_t* end_;
+  const uint8_t* mark_;
+  bool marked_;
+  bool would_block_;
 };
 
 class BufferedOutputStream : public OutputStream {
@@ -59,17 +119,36 @@ public:
   void Write(char ch) {
     *pos_++ = ch;
     if (pos_ == end_) {
-      Flush();
+      WriteBuffer();
     }
   }
   void Write(const void* buf, size_t size);
+  
+  // Like Write(), but buf isn't copied: it's queued by reference and
+  // written out in a single WriteV() along with whatever is buffered
+  // around it. buf must stay valid and unchanged until the buffer is next
+  // written out, which is at the latest the next call to Flush().
+  void WriteReference(const void* buf, size_t size);
+  
+  // Writes out the buffer and flushes the delegatee
   void Flush();
   
 private:
+  // How many pieces are gathered before they're written out
+  static const size_t kMaxPieces = 64;
+  
+  void WriteBuffer();
+  void EndBufferedPiece();
+  
   shared_ptr<OutputStream> delegatee_;
   vector<uint8_t> buffer_;
   vector<uint8_t>::iterator pos_;
   vector<uint8_t>::iterator end_;
+  
+  // Buffered bytes and referenced data waiting to be written, in order.
+  // The buffered bytes from piece_start_ to pos_ aren't in pieces_ yet.
+  vector<struct iovec> pieces_;
+  vector<uint8_t>::iterator piece_start_;
 };
 
 class MemoryInputStream : public InputStream {
@@ -82,6 +161,21 @@ private:
   size_t pos_;
 };
 
+// Reads memory that belongs to somebody else, who has to keep it around
+// for as long as the stream and its spans are used. Everything is handed
+// out in place through ReadSpan().
+class SpanInputStream : public InputStream {
+public:
+  SpanInputStream(const void* data, size_t size);
+  virtual ssize_t Read(void* buf, size_t count);
+  virtual bool ReadSpan(const uint8_t** data, size_t* size);
+  
+private:
+  const uint8_t* data_;
+  size_t size_;
+  size_t pos_;
+};
+
 class MemoryOutputStream : public OutputStream {
 public:
   MemoryOutputStream();
@@ -105,6 +199,8 @@ public:
   FileInputStream(const char* file_path);
   virtual ~FileInputStream();
     
+  // If fd is non-blocking and has nothing to read right now, returns -1
+  // with errno set to EAGAIN
   ssize_t Read(void* buf, size_t count);
   
 private:
@@ -112,6 +208,30 @@ private:
   bool take_fd_ownership_;
 };
 
+// Reads a file through a read-only mapping of the whole thing, which is
+// faster than FileInputStream for large files, especially when read
+// through ReadSpan() (BufferedInputStream does this), as nothing gets
+// copied at all.
+class MappedFileInputStream : public InputStream {
+public:
+  explicit MappedFileInputStream(const char* file_path);
+  virtual ~MappedFileInputStream();
+  
+  ssize_t Read(void* buf, size_t count);
+  bool ReadSpan(const uint8_t** data, size_t* size);
+  
+  // The whole file, for as long as the stream is around
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+  
+private:
+  MappedFileInputStream(const MappedFileInputStream& other);
+  
+  uint8_t* data_;
+  size_t size_;
+  size_t pos_;
+};
+
 class FileOutputStream : public OutputStream {
 public:
   FileOutputStream(int fd, bool take_fd_ownership)
@@ -121,6 +241,8 @@ public:
   virtual ~FileOutputStream();
   
   void Write(const void* buf, size_t count);
+  // Uses writev(), so the pieces go out in one system call
+  void WriteV(const struct iovec* iov, int count);
   void Flush() {}
   
 private:
@@ -4,6 +4,10 @@
 #include "gtest/gtest.h"
 #include "test_util/stream.h"
 
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
 namespace cheaproute {
 
 static void TestCharacterByCharacter(size_t max_read_size, size_t buffer_size) {
@@ -95,4 +99,239 @@ TEST(BufferedOutputStreamTest, SmallWriteThenBigWrite) {
   AssertStreamContents("abcdefghijkl", memOutStream);
 }
 
-}
\ No newline at end of file
+
+// Remembers how each write was made
+class RecordingOutputStream : public OutputStream {
+public:
+  virtual void Write(const void* buf, size_t count) {
+    log_ += "Write(" + string(static_cast<const char*>(buf), count) + ")";
+  }
+  virtual void WriteV(const struct iovec* iov, int count) {
+    log_ += "WriteV(";
+    for (int i = 0; i < count; i++) {
+      if (i > 0)
+        log_ += ", ";
+      log_ += string(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    }
+    log_ += ")";
+  }
+  virtual void Flush() {
+    log_ += "Flush()";
+  }
+  
+  const string& log() const { return log_; }
+  
+private:
+  string log_;
+};
+
+TEST(BufferedOutputStreamTest, WriteReference) {
+  RecordingOutputStream* recording = new RecordingOutputStream();
+  BufferedOutputStream stream(shared_ptr<OutputStream>(recording), 16);
+  stream.Write("ab", 2);
+  stream.WriteReference("referenced", 10);
+  stream.Write('c');
+  stream.WriteReference("again", 5);
+  ASSERT_EQ("", recording->log());
+  stream.Flush();
+  ASSERT_EQ("WriteV(ab, referenced, c, again)Flush()", recording->log());
+}
+
+TEST(BufferedOutputStreamTest, BigWriteGoesOutWithBuffer) {
+  RecordingOutputStream* recording = new RecordingOutputStream();
+  BufferedOutputStream stream(shared_ptr<OutputStream>(recording), 8);
+  stream.Write("ab", 2);
+  stream.Write("cdefghijkl", 10);
+  ASSERT_EQ("WriteV(ab, cdefghijkl)", recording->log());
+  stream.Write("mn", 2);
+  stream.Flush();
+  ASSERT_EQ("WriteV(ab, cdefghijkl)Write(mn)Flush()", recording->log());
+}
+
+TEST(BufferedOutputStreamTest, WriteReferenceToMemory) {
+  MemoryOutputStream* memOutStream = new MemoryOutputStream();
+  BufferedOutputStream stream(shared_ptr<OutputStream>(memOutStream), 5);
+  stream.Write("ab", 2);
+  stream.WriteReference("cdefgh", 6);
+  stream.Write("ijk", 3);
+  stream.Write("lmn", 3);
+  stream.Flush();
+  AssertStreamContents("abcdefghijklmn", memOutStream);
+}
+
+// Writes contents to a new temporary file and returns its path
+static string CreateTempFile(const string& contents) {
+  char path[] = "/tmp/cheaproute-stream-test-XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd != -1);
+  ssize_t written = write(fd, contents.data(), contents.size());
+  assert(written == static_cast<ssize_t>(contents.size()));
+  close(fd);
+  return path;
+}
+
+TEST(MappedFileInputStreamTest, Read) {
+  string path = CreateTempFile("Hello World!");
+  {
+    MappedFileInputStream stream(path.c_str());
+    ASSERT_EQ("Hello", ReadString(&stream, 5));
+    ASSERT_EQ(" World!", ReadString(&stream, 100));
+    ASSERT_EQ("", ReadString(&stream, 100));
+  }
+  unlink(path.c_str());
+}
+
+TEST(MappedFileInputStreamTest, ReadSpan) {
+  string path = CreateTempFile("Hello World!");
+  {
+    MappedFileInputStream stream(path.c_str());
+    ASSERT_EQ("Hello ", ReadString(&stream, 6));
+    
+    const uint8_t* data;
+    size_t size;
+    ASSERT_TRUE(stream.ReadSpan(&data, &size));
+    ASSERT_EQ("World!", string(reinterpret_cast<const char*>(data), size));
+    ASSERT_TRUE(stream.ReadSpan(&data, &size));
+    ASSERT_EQ(0U, size);
+  }
+  unlink(path.c_str());
+}
+
+TEST(MappedFileInputStreamTest, EmptyFile) {
+  string path = CreateTempFile("");
+  {
+    MappedFileInputStream stream(path.c_str());
+    ASSERT_EQ("", ReadString(&stream, 10));
+    BufferedInputStream buffered(shared_ptr<InputStream>(
+        new MappedFileInputStream(path.c_str())), 4);
+    ASSERT_EQ(-1, buffered.Peek());
+  }
+  unlink(path.c_str());
+}
+
+TEST(MappedFileInputStreamTest, BufferedReadsInPlace) {
+  string path = CreateTempFile("Hello World!");
+  {
+    BufferedInputStream stream(shared_ptr<InputStream>(
+        new MappedFileInputStream(path.c_str())), 4);
+    ASSERT_EQ('H', stream.Read());
+    ASSERT_EQ('e', stream.Peek());
+    
+    // The rest comes back as one span even though the buffer is tiny
+    const uint8_t* data;
+    size_t size;
+    ASSERT_TRUE(stream.ReadSpan(&data, &size));
+    ASSERT_EQ("ello World!", string(reinterpret_cast<const char*>(data), size));
+    ASSERT_EQ(-1, stream.Read());
+  }
+  unlink(path.c_str());
+}
+
+TEST(SpanInputStreamTest, ReadsInPlace) {
+  const char* contents = "Hello World!";
+  SpanInputStream stream(contents, strlen(contents));
+  ASSERT_EQ("Hello ", ReadString(&stream, 6));
+  
+  const uint8_t* data;
+  size_t size;
+  ASSERT_TRUE(stream.ReadSpan(&data, &size));
+  ASSERT_EQ(reinterpret_cast<const uint8_t*>(contents + 6), data);
+  ASSERT_EQ(6U, size);
+  ASSERT_TRUE(stream.ReadSpan(&data, &size));
+  ASSERT_EQ(0U, size);
+}
+
+TEST(BufferedInputStreamTest, ReadSpan) {
+  BufferedInputStream stream(shared_ptr<InputStream>(
+    new FakeInputStream(100, "Hello World!")), 4);
+  ASSERT_EQ('H', stream.Read());
+  
+  const uint8_t* data;
+  size_t size;
+  ASSERT_TRUE(stream.ReadSpan(&data, &size));
+  ASSERT_EQ("ell", string(reinterpret_cast<const char*>(data), size));
+  ASSERT_TRUE(stream.ReadSpan(&data, &size));
+  ASSERT_EQ("o Wo", string(reinterpret_cast<const char*>(data), size));
+  ASSERT_EQ('r', stream.Read());
+}
+
+// Reads count characters with Read(), stopping early at the end
+static string ReadChars(BufferedInputStream* stream, size_t count) {
+  string result;
+  for (size_t i = 0; i < count; i++) {
+    int ch = stream->Read();
+    if (ch == -1)
+      break;
+    result.push_back(static_cast<char>(ch));
+  }
+  return result;
+}
+
+TEST(BufferedInputStreamTest, MarkSurvivesRefills) {
+  const char* contents = "Hello World, how are you?";
+  for (size_t max_read_size = 1; max_read_size < 10; max_read_size++) {
+    BufferedInputStream stream(shared_ptr<InputStream>(
+      new FakeInputStream(max_read_size, contents)), 4);
+    ASSERT_EQ("Hel", ReadChars(&stream, 3));
+    stream.Mark();
+    // Much more than the buffer holds
+    ASSERT_EQ("lo World, how", ReadChars(&stream, 13));
+    stream.ResetToMark();
+    ASSERT_EQ("lo World", ReadChars(&stream, 8));
+    stream.ClearMark();
+    ASSERT_EQ(", how are you?", ReadChars(&stream, 100));
+    ASSERT_EQ(-1, stream.Read());
+  }
+}
+
+TEST(BufferedInputStreamTest, MarkSurvivesSpans) {
+  const char* contents = "Hello World!";
+  BufferedInputStream stream(shared_ptr<InputStream>(
+      new SpanInputStream(contents, strlen(contents))), 4);
+  ASSERT_EQ("Hello", ReadChars(&stream, 5));
+  stream.Mark();
+  ASSERT_EQ(" World!", ReadChars(&stream, 100));
+  stream.ResetToMark();
+  ASSERT_EQ(" World!", ReadChars(&stream, 100));
+}
+
+TEST(BufferedInputStreamTest, NonBlockingPipe) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  BufferedInputStream stream(shared_ptr<InputStream>(
+      new FileInputStream(fds[0], true)), 16);
+  
+  ASSERT_EQ(-1, stream.Read());
+  ASSERT_TRUE(stream.would_block());
+  
+  ASSERT_EQ(2, write(fds[1], "Hi", 2));
+  ASSERT_EQ("Hi", ReadChars(&stream, 100));
+  ASSERT_TRUE(stream.would_block());
+  
+  close(fds[1]);
+  ASSERT_EQ(-1, stream.Read());
+  ASSERT_FALSE(stream.would_block());
+}
+
+TEST(FileOutputStreamTest, WriteV) {
+  string path = CreateTempFile("");
+  int fd = open(path.c_str(), O_WRONLY);
+  {
+    FileOutputStream stream(fd, true);
+    struct iovec pieces[3];
+    pieces[0].iov_base = const_cast<char*>("Hello");
+    pieces[0].iov_len = 5;
+    pieces[1].iov_base = const_cast<char*>("");
+    pieces[1].iov_len = 0;
+    pieces[2].iov_base = const_cast<char*>(" World!");
+    pieces[2].iov_len = 7;
+    stream.WriteV(pieces, 3);
+  }
+  
+  MappedFileInputStream stream(path.c_str());
+  ASSERT_EQ("Hello World!", ReadString(&stream, 100));
+  unlink(path.c_str());
+}
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "base/common.h"
+
+#include <string.h>
+
+namespace cheaproute {
+
+// A pointer and a length: a string that somebody else owns. Whoever hands
+// one out says how long the characters stay valid.
+class StringPiece {
+public:
+  StringPiece() : data_(NULL), size_(0) {}
+  StringPiece(const char* data, size_t size) : data_(data), size_(size) {}
+  StringPiece(const char* str) : data_(str), size_(strlen(str)) {}
+  StringPiece(const string& str) : data_(str.data()), size_(str.size()) {}
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  string as_string() const { return string(data_, size_); }
+
+  bool operator==(const StringPiece& other) const {
+    return size_ == other.size_ && memcmp(data_, other.data_, size_) == 0;
+  }
+  bool operator!=(const StringPiece& other) const {
+    return !(*this == other);
+  }
+
+private:
+  const char* data_;
+  size_t size_;
+};
+
+// For unordered_map<StringPiece, T, StringPieceHash>; the keys have to
+// outlive the map
+struct StringPieceHash {
+  size_t operator()(const StringPiece& str) const {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < str.size(); i++) {
+      hash = (hash ^ static_cast<uint8_t>(str.data()[i])) * 16777619u;
+    }
+    return hash;
+  }
+};
+
+}
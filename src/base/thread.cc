@@ -0,0 +1,63 @@
+#include "base/thread.h"
+
+#include <sched.h>
+
+namespace cheaproute {
+
+Thread::Thread(const function<void()>& func)
+  : func_(func),
+    cpu_(-1),
+    started_(false),
+    joined_(false) {
+}
+
+Thread::~Thread() {
+  if (started_ && !joined_)
+    Join();
+}
+
+void Thread::set_cpu(int cpu) {
+  assert(!started_);
+  assert(cpu >= 0 && cpu < CPU_SETSIZE);
+  cpu_ = cpu;
+}
+
+void Thread::Start() {
+  assert(!started_);
+  
+  pthread_attr_t attr;
+  int result = pthread_attr_init(&attr);
+  if (result != 0)
+    AbortWithPosixError(result, "Unable to initialize thread attributes");
+  
+  // Setting the affinity up front means the thread never runs anywhere else
+  if (cpu_ >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu_, &cpus);
+    result = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    if (result != 0)
+      AbortWithPosixError(result, "Unable to pin thread to CPU %d", cpu_);
+  }
+  
+  result = pthread_create(&thread_, &attr, &Thread::ThreadMain, this);
+  pthread_attr_destroy(&attr);
+  if (result != 0)
+    AbortWithPosixError(result, "Unable to create thread");
+  started_ = true;
+}
+
+void Thread::Join() {
+  assert(started_ && !joined_);
+  int result = pthread_join(thread_, NULL);
+  if (result != 0)
+    AbortWithPosixError(result, "Unable to join thread");
+  joined_ = true;
+}
+
+void* Thread::ThreadMain(void* arg) {
+  static_cast<Thread*>(arg)->func_();
+  return NULL;
+}
+
+}
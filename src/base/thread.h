@@ -0,0 +1,35 @@
+#pragma once
+
+#include "base/common.h"
+
+#include <pthread.h>
+
+namespace cheaproute {
+
+// A minimal wrapper around a joinable pthread.
+class Thread {
+public:
+  explicit Thread(const function<void()>& func);
+  
+  // Joins the thread if it was started and not yet joined
+  ~Thread();
+  
+  // Pins the thread to a single CPU; must be called before Start()
+  void set_cpu(int cpu);
+  
+  void Start();
+  void Join();
+  
+private:
+  Thread(const Thread& other);
+  static void* ThreadMain(void* arg);
+  
+  function<void()> func_;
+  pthread_t thread_;
+  // -1 if the thread may run anywhere
+  int cpu_;
+  bool started_;
+  bool joined_;
+};
+
+}
@@ -0,0 +1,66 @@
+#include "base/common.h"
+
+#include "gtest/gtest.h"
+
+#include "base/thread.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace cheaproute {
+
+// What a thread finds out about itself
+struct ThreadInfo {
+  ThreadInfo() : ran(false), cpu_count(0) {}
+  
+  void Record() {
+    ran = true;
+    thread = pthread_self();
+    ASSERT_EQ(0, sched_getaffinity(0, sizeof(cpus), &cpus));
+    cpu_count = CPU_COUNT(&cpus);
+    running_on = sched_getcpu();
+  }
+  
+  bool ran;
+  pthread_t thread;
+  cpu_set_t cpus;
+  int cpu_count;
+  int running_on;
+};
+
+TEST(ThreadTest, RunsFunctionOnAnotherThread) {
+  ThreadInfo info;
+  Thread thread(bind(&ThreadInfo::Record, &info));
+  thread.Start();
+  thread.Join();
+  ASSERT_TRUE(info.ran);
+  ASSERT_FALSE(pthread_equal(pthread_self(), info.thread));
+}
+
+TEST(ThreadTest, JoinsWhenDestroyed) {
+  ThreadInfo info;
+  {
+    Thread thread(bind(&ThreadInfo::Record, &info));
+    thread.Start();
+  }
+  ASSERT_TRUE(info.ran);
+}
+
+TEST(ThreadTest, PinsToCpu) {
+  cpu_set_t allowed;
+  ASSERT_EQ(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+  int cpu = CPU_SETSIZE - 1;
+  while (!CPU_ISSET(cpu, &allowed))
+    cpu--;
+  
+  ThreadInfo info;
+  Thread thread(bind(&ThreadInfo::Record, &info));
+  thread.set_cpu(cpu);
+  thread.Start();
+  thread.Join();
+  ASSERT_EQ(1, info.cpu_count);
+  ASSERT_TRUE(CPU_ISSET(cpu, &info.cpus));
+  ASSERT_EQ(cpu, info.running_on);
+}
+
+}
@@ -0,0 +1,220 @@
+#include "base/timer_wheel.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace cheaproute {
+
+// slot_ value of a timer that is in expired_ rather than in a wheel slot
+const unsigned kExpiredSlot = ~0u;
+
+static void LinkBefore(TimerWheelLink* head, TimerWheelLink* link) {
+  link->prev = head->prev;
+  link->next = head;
+  head->prev->next = link;
+  head->prev = link;
+}
+
+// Moves every link in from to the end of to, leaving from empty
+static void SpliceBefore(TimerWheelLink* to, TimerWheelLink* from) {
+  if (from->next == from)
+    return;
+  from->next->prev = to->prev;
+  from->prev->next = to;
+  to->prev->next = from->next;
+  to->prev = from->prev;
+  from->next = from->prev = from;
+}
+
+WheelTimer::WheelTimer(const function<void()>& action)
+  : action_(action),
+    wheel_(NULL),
+    expiry_(0),
+    slot_(0) {
+}
+
+WheelTimer::~WheelTimer() {
+  if (wheel_)
+    wheel_->Cancel(this);
+}
+
+TimerWheel::TimerWheel(uint64_t now)
+  : current_(now),
+    size_(0) {
+  memset(occupied_, 0, sizeof(occupied_));
+}
+
+TimerWheel::~TimerWheel() {
+  // Orphan any timers that are still scheduled, so they don't try to
+  // cancel themselves later
+  for (unsigned level = 0; level < kLevels; level++) {
+    for (unsigned slot = 0; slot < kSlotsPerLevel; slot++) {
+      SpliceBefore(&expired_, &slots_[level][slot]);
+    }
+  }
+  while (expired_.next != &expired_) {
+    WheelTimer* timer = static_cast<WheelTimer*>(expired_.next);
+    Unlink(timer);
+    timer->wheel_ = NULL;
+  }
+}
+
+void TimerWheel::Schedule(WheelTimer* timer, uint64_t expiry) {
+  if (timer->wheel_) {
+    assert(timer->wheel_ == this);
+    Unlink(timer);
+  } else {
+    timer->wheel_ = this;
+    size_++;
+  }
+  timer->expiry_ = expiry;
+  Insert(timer);
+}
+
+void TimerWheel::Cancel(WheelTimer* timer) {
+  if (!timer->wheel_)
+    return;
+  assert(timer->wheel_ == this);
+  Unlink(timer);
+  timer->wheel_ = NULL;
+  size_--;
+}
+
+void TimerWheel::Insert(WheelTimer* timer) {
+  uint64_t expiry = std::max(timer->expiry_, current_);
+  uint64_t delta = expiry - current_;
+  
+  // Level n holds the timers due within 2^(8 * (n + 1)) ticks. Timers
+  // beyond the last level are parked at its far end and placed again
+  // when they get cascaded.
+  unsigned level = 0;
+  while (level < kLevels - 1 && delta >> (kLevelBits * (level + 1))) {
+    level++;
+  }
+  if (level == kLevels - 1 && delta >> (kLevelBits * kLevels)) {
+    expiry = current_ + (static_cast<uint64_t>(1) << (kLevelBits * kLevels)) - 1;
+  }
+  
+  unsigned slot = static_cast<unsigned>(expiry >> (kLevelBits * level)) & kSlotMask;
+  timer->slot_ = level * kSlotsPerLevel + slot;
+  LinkBefore(&slots_[level][slot], timer);
+  occupied_[level][slot / 64] |= static_cast<uint64_t>(1) << (slot % 64);
+}
+
+void TimerWheel::Unlink(WheelTimer* timer) {
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->next = timer->prev = timer;
+  
+  if (timer->slot_ == kExpiredSlot)
+    return;
+  unsigned level = timer->slot_ / kSlotsPerLevel;
+  unsigned slot = timer->slot_ % kSlotsPerLevel;
+  TimerWheelLink* head = &slots_[level][slot];
+  if (head->next == head)
+    occupied_[level][slot / 64] &= ~(static_cast<uint64_t>(1) << (slot % 64));
+}
+
+int TimerWheel::NextOccupiedSlot(unsigned level, unsigned start) const {
+  for (unsigned distance = 0; distance < kSlotsPerLevel; ) {
+    unsigned slot = (start + distance) & kSlotMask;
+    uint64_t word = occupied_[level][slot / 64] >> (slot % 64);
+    if (word)
+      return static_cast<int>(distance + __builtin_ctzll(word));
+    distance += 64 - slot % 64;
+  }
+  return -1;
+}
+
+bool TimerWheel::NextTick(uint64_t* tick) const {
+  if (size_ == 0)
+    return false;
+  if (expired_.next != &expired_) {
+    *tick = current_;
+    return true;
+  }
+  
+  uint64_t result = UINT64_MAX;
+  for (unsigned level = 0; level < kLevels; level++) {
+    unsigned shift = kLevelBits * level;
+    uint64_t base = current_ >> shift;
+    unsigned index = static_cast<unsigned>(base) & kSlotMask;
+    
+    // A coarser slot is due when the tick reaches its start. Unless we're
+    // sitting right on that boundary, the current slot's start has passed
+    // and anything in it belongs to the next rotation.
+    bool on_boundary = (current_ & ((static_cast<uint64_t>(1) << shift) - 1)) == 0;
+    if (on_boundary) {
+      int distance = NextOccupiedSlot(level, index);
+      if (distance >= 0)
+        result = std::min(result, (base + distance) << shift);
+    } else {
+      int distance = NextOccupiedSlot(level, index + 1);
+      if (distance >= 0)
+        result = std::min(result, (base + distance + 1) << shift);
+    }
+  }
+  assert(result != UINT64_MAX);
+  *tick = result;
+  return true;
+}
+
+void TimerWheel::Cascade(unsigned level, uint64_t tick) {
+  unsigned slot = static_cast<unsigned>(tick >> (kLevelBits * level)) & kSlotMask;
+  TimerWheelLink* head = &slots_[level][slot];
+  if (head->next == head)
+    return;
+  
+  TimerWheelLink pending;
+  SpliceBefore(&pending, head);
+  occupied_[level][slot / 64] &= ~(static_cast<uint64_t>(1) << (slot % 64));
+  
+  while (pending.next != &pending) {
+    WheelTimer* timer = static_cast<WheelTimer*>(pending.next);
+    timer->slot_ = kExpiredSlot;
+    Unlink(timer);
+    Insert(timer);
+  }
+}
+
+size_t TimerWheel::Advance(uint64_t now) {
+  size_t fired = 0;
+  uint64_t tick;
+  while (NextTick(&tick) && tick <= now) {
+    current_ = tick;
+    
+    // Coarser levels first, so timers they hand down to a finer level
+    // that is due at this same tick get cascaded again right away
+    for (unsigned level = kLevels - 1; level > 0; level--) {
+      uint64_t mask = (static_cast<uint64_t>(1) << (kLevelBits * level)) - 1;
+      if ((tick & mask) == 0)
+        Cascade(level, tick);
+    }
+    
+    unsigned slot = static_cast<unsigned>(tick) & kSlotMask;
+    TimerWheelLink* head = &slots_[0][slot];
+    for (TimerWheelLink* link = head->next; link != head; link = link->next) {
+      static_cast<WheelTimer*>(link)->slot_ = kExpiredSlot;
+    }
+    SpliceBefore(&expired_, head);
+    occupied_[0][slot / 64] &= ~(static_cast<uint64_t>(1) << (slot % 64));
+    
+    // Timers scheduled from the actions below land after this tick
+    current_ = tick + 1;
+    while (expired_.next != &expired_) {
+      WheelTimer* timer = static_cast<WheelTimer*>(expired_.next);
+      Unlink(timer);
+      timer->wheel_ = NULL;
+      size_--;
+      fired++;
+      timer->action_();
+    }
+  }
+  
+  if (current_ <= now)
+    current_ = now + 1;
+  return fired;
+}
+
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "base/common.h"
+
+namespace cheaproute {
+
+class TimerWheel;
+
+// A link in one of a TimerWheel's slot lists
+struct TimerWheelLink {
+  TimerWheelLink()
+    : prev(this),
+      next(this) {
+  }
+  
+  TimerWheelLink* prev;
+  TimerWheelLink* next;
+};
+
+// A timer that can be scheduled on a TimerWheel. A WheelTimer is meant to
+// be embedded in whatever it times out, so scheduling, rescheduling and
+// cancelling it never allocate. Destroying a scheduled timer cancels it;
+// a timer's action is allowed to destroy the timer.
+class WheelTimer : private TimerWheelLink {
+public:
+  explicit WheelTimer(const function<void()>& action);
+  ~WheelTimer();
+  
+  bool scheduled() const { return wheel_ != NULL; }
+  
+  // The tick the timer fires at; only meaningful while it is scheduled or
+  // its action is running
+  uint64_t expiry() const { return expiry_; }
+  
+private:
+  friend class TimerWheel;
+  WheelTimer(const WheelTimer& other);
+  
+  function<void()> action_;
+  TimerWheel* wheel_;
+  uint64_t expiry_;
+  unsigned slot_;
+};
+
+// A hierarchical timing wheel (Varghese & Lauck). Time is measured in
+// abstract ticks, and is only ever advanced by Advance(), so the wheel can
+// be driven by any clock. Scheduling and cancelling a timer are O(1);
+// timers far in the future sit in coarser wheels and are cascaded down as
+// their time approaches. Timers scheduled for the same tick fire in the
+// order they were scheduled.
+class TimerWheel {
+public:
+  explicit TimerWheel(uint64_t now);
+  ~TimerWheel();
+  
+  // Schedules (or reschedules) timer to fire at the given tick. Timers
+  // scheduled in the past fire on the next call to Advance().
+  void Schedule(WheelTimer* timer, uint64_t expiry);
+  void Cancel(WheelTimer* timer);
+  
+  // Fires every timer due at or before now, and returns how many fired.
+  // Timers may be scheduled and cancelled from within their actions.
+  size_t Advance(uint64_t now);
+  
+  // Sets *tick to the earliest tick at which Advance() has work to do.
+  // That's either a timer's expiry or a cascade of one of the coarser
+  // wheels, so it may be earlier than the next expiry. Returns false if
+  // there are no timers.
+  bool NextTick(uint64_t* tick) const;
+  
+  size_t size() const { return size_; }
+  
+private:
+  TimerWheel(const TimerWheel& other);
+  
+  static const unsigned kLevelBits = 8;
+  static const unsigned kSlotsPerLevel = 1 << kLevelBits;
+  static const unsigned kLevels = 4;
+  static const unsigned kSlotMask = kSlotsPerLevel - 1;
+  static const unsigned kBitmapWords = kSlotsPerLevel / 64;
+  
+  void Insert(WheelTimer* timer);
+  void Unlink(WheelTimer* timer);
+  void Cascade(unsigned level, uint64_t tick);
+  int NextOccupiedSlot(unsigned level, unsigned start) const;
+  
+  // The next tick to be processed; everything before it has fired
+  uint64_t current_;
+  size_t size_;
+  TimerWheelLink slots_[kLevels][kSlotsPerLevel];
+  uint64_t occupied_[kLevels][kBitmapWords];
+  
+  // Timers that are due and about to fire
+  TimerWheelLink expired_;
+};
+
+}
@@ -0,0 +1,147 @@
+// Compares EventLoop's timer wheel against arming one ev_timer per task
+// (how EventLoop::Schedule used to work) for a router-sized timer load.
+
+#include "base/common.h"
+#include "base/event_loop.h"
+
+#include <ev.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+using namespace cheaproute;
+
+namespace {
+
+const size_t kTimerCount = 200000;
+
+double Now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+}
+
+// Flow timeouts spread over a minute
+double RandomTimeout() {
+  return 1.0 + (rand() % 60000) / 1000.0;
+}
+
+// Expiries spread over the next 200ms, so the firing benchmarks finish
+double RandomShortTimeout() {
+  return (rand() % 200) / 1000.0;
+}
+
+struct EvTask {
+  ev_timer timer;
+  size_t* fired;
+};
+
+void HandleEvTimeout(struct ev_loop* loop, ev_timer* w, int revents) {
+  EvTask* task = static_cast<EvTask*>(w->data);
+  (*task->fired)++;
+  delete task;
+}
+
+void Report(const char* name, double seconds) {
+  printf("  %-28s %8.1f ms  %8.1f ns/timer\n", name, seconds * 1000, 
+         seconds * 1e9 / static_cast<double>(kTimerCount));
+}
+
+void BenchmarkEvTimers() {
+  printf("ev_timer per task:\n");
+  struct ev_loop* loop = ev_loop_new(EVFLAG_AUTO);
+  size_t fired = 0;
+  vector<EvTask*> tasks;
+  
+  double start = Now();
+  for (size_t i = 0; i < kTimerCount; i++) {
+    EvTask* task = new EvTask();
+    task->fired = &fired;
+    ev_timer_init(&task->timer, &HandleEvTimeout, RandomTimeout(), 0.0);
+    task->timer.data = task;
+    ev_timer_start(loop, &task->timer);
+    tasks.push_back(task);
+  }
+  Report("schedule", Now() - start);
+  
+  start = Now();
+  for (size_t i = 0; i < kTimerCount; i++) {
+    ev_timer_stop(loop, &tasks[i]->timer);
+    ev_timer_set(&tasks[i]->timer, RandomTimeout(), 0.0);
+    ev_timer_start(loop, &tasks[i]->timer);
+  }
+  Report("reschedule", Now() - start);
+  
+  start = Now();
+  for (size_t i = 0; i < kTimerCount; i++) {
+    ev_timer_stop(loop, &tasks[i]->timer);
+    delete tasks[i];
+  }
+  Report("cancel", Now() - start);
+  
+  start = Now();
+  for (size_t i = 0; i < kTimerCount; i++) {
+    EvTask* task = new EvTask();
+    task->fired = &fired;
+    ev_timer_init(&task->timer, &HandleEvTimeout, RandomShortTimeout(), 0.0);
+    task->timer.data = task;
+    ev_timer_start(loop, &task->timer);
+  }
+  ev_loop(loop, 0);
+  Report("schedule and fire", Now() - start);
+  assert(fired == kTimerCount);
+  
+  ev_loop_destroy(loop);
+}
+
+void CountFired(size_t* fired) {
+  (*fired)++;
+}
+
+void BenchmarkTimerWheel() {
+  printf("timer wheel:\n");
+  EventLoop loop;
+  size_t fired = 0;
+  vector<shared_ptr<Timer> > timers;
+  for (size_t i = 0; i < kTimerCount; i++) {
+    timers.push_back(shared_ptr<Timer>(
+        new Timer(&loop, bind(&CountFired, &fired))));
+  }
+  
+  double start = Now();
+  for (size_t i = 0; i < kTimerCount; i++) {
+    timers[i]->Start(RandomTimeout());
+  }
+  Report("schedule", Now() - start);
+  
+  start = Now();
+  for (size_t i = 0; i < kTimerCount; i++) {
+    timers[i]->Start(RandomTimeout());
+  }
+  Report("reschedule", Now() - start);
+  
+  start = Now();
+  for (size_t i = 0; i < kTimerCount; i++) {
+    timers[i]->Stop();
+  }
+  Report("cancel", Now() - start);
+  
+  start = Now();
+  for (size_t i = 0; i < kTimerCount; i++) {
+    loop.Schedule(RandomShortTimeout(), bind(&CountFired, &fired));
+  }
+  loop.Run();
+  Report("schedule and fire", Now() - start);
+  assert(fired == kTimerCount);
+}
+
+}
+
+int main(int argc, const char* const argv[]) {
+  printf("%zu timers\n", kTimerCount);
+  srand(1);
+  BenchmarkEvTimers();
+  srand(1);
+  BenchmarkTimerWheel();
+  return 0;
+}
@@ -0,0 +1,162 @@
+#include "base/common.h"
+
+#include "gtest/gtest.h"
+
+#include "base/timer_wheel.h"
+
+#include <sstream>
+
+namespace cheaproute {
+
+class TimerLog {
+public:
+  void Fired(int id) {
+    ss_ << id << " ";
+  }
+  
+  // Returns what fired since the last call
+  string Take() {
+    string result = ss_.str();
+    ss_.str("");
+    return result;
+  }
+  
+private:
+  std::stringstream ss_;
+};
+
+TEST(TimerWheelTest, FiresInOrderOfExpiry) {
+  TimerLog log;
+  TimerWheel wheel(1000);
+  WheelTimer a(bind(&TimerLog::Fired, &log, 1));
+  WheelTimer b(bind(&TimerLog::Fired, &log, 2));
+  WheelTimer c(bind(&TimerLog::Fired, &log, 3));
+  wheel.Schedule(&a, 1030);
+  wheel.Schedule(&b, 1010);
+  wheel.Schedule(&c, 1010);
+  ASSERT_EQ(3u, wheel.size());
+  
+  uint64_t tick;
+  ASSERT_TRUE(wheel.NextTick(&tick));
+  ASSERT_EQ(1010u, tick);
+  
+  ASSERT_EQ(0u, wheel.Advance(1009));
+  ASSERT_EQ(2u, wheel.Advance(1010));
+  ASSERT_EQ("2 3 ", log.Take());
+  ASSERT_FALSE(b.scheduled());
+  ASSERT_TRUE(a.scheduled());
+  
+  ASSERT_EQ(1u, wheel.Advance(5000));
+  ASSERT_EQ("1 ", log.Take());
+  ASSERT_EQ(0u, wheel.size());
+  ASSERT_FALSE(wheel.NextTick(&tick));
+}
+
+TEST(TimerWheelTest, CancelAndReschedule) {
+  TimerLog log;
+  TimerWheel wheel(0);
+  WheelTimer a(bind(&TimerLog::Fired, &log, 1));
+  WheelTimer b(bind(&TimerLog::Fired, &log, 2));
+  wheel.Schedule(&a, 10);
+  wheel.Schedule(&b, 20);
+  wheel.Cancel(&a);
+  wheel.Schedule(&b, 100000);
+  ASSERT_EQ(1u, wheel.size());
+  
+  wheel.Advance(99999);
+  ASSERT_EQ("", log.Take());
+  wheel.Advance(100000);
+  ASSERT_EQ("2 ", log.Take());
+  
+  {
+    WheelTimer c(bind(&TimerLog::Fired, &log, 3));
+    wheel.Schedule(&c, 100010);
+  }
+  ASSERT_EQ(0u, wheel.size());
+  wheel.Advance(200000);
+  ASSERT_EQ("", log.Take());
+}
+
+TEST(TimerWheelTest, CascadesFromEveryLevel) {
+  TimerLog log;
+  TimerWheel wheel(12345);
+  uint64_t delays[] = { 1, 255, 256, 257, 65535, 65536, 65537, 300000, 
+                        16777216, 20000000, 5000000000ULL };
+  size_t count = sizeof(delays) / sizeof(delays[0]);
+  vector<shared_ptr<WheelTimer> > timers;
+  for (size_t i = 0; i < count; i++) {
+    timers.push_back(shared_ptr<WheelTimer>(
+        new WheelTimer(bind(&TimerLog::Fired, &log, static_cast<int>(i)))));
+    wheel.Schedule(timers[i].get(), 12345 + delays[i]);
+  }
+  
+  // Walking the wheel one NextTick() at a time must hit every expiry
+  // exactly, without firing anything early
+  uint64_t tick;
+  size_t fired = 0;
+  while (wheel.NextTick(&tick)) {
+    size_t n = wheel.Advance(tick);
+    if (n) {
+      ASSERT_EQ(1u, n);
+      ASSERT_EQ(12345 + delays[fired], tick);
+      fired++;
+    }
+  }
+  ASSERT_EQ(count, fired);
+  ASSERT_EQ("0 1 2 3 4 5 6 7 8 9 10 ", log.Take());
+}
+
+TEST(TimerWheelTest, LargeJumpFiresEverythingDue) {
+  TimerLog log;
+  TimerWheel wheel(0);
+  WheelTimer a(bind(&TimerLog::Fired, &log, 1));
+  WheelTimer b(bind(&TimerLog::Fired, &log, 2));
+  WheelTimer c(bind(&TimerLog::Fired, &log, 3));
+  wheel.Schedule(&a, 70000);
+  wheel.Schedule(&b, 300);
+  wheel.Schedule(&c, 20000000);
+  ASSERT_EQ(2u, wheel.Advance(19999999));
+  ASSERT_EQ("2 1 ", log.Take());
+  ASSERT_EQ(1u, wheel.Advance(20000000));
+  ASSERT_EQ("3 ", log.Take());
+}
+
+class Rescheduler {
+public:
+  Rescheduler(TimerWheel* wheel, int times)
+    : wheel_(wheel),
+      timer_(bind(&Rescheduler::Fired, this)),
+      remaining_(times),
+      fired_(0) {
+  }
+  
+  void Start(uint64_t expiry) {
+    wheel_->Schedule(&timer_, expiry);
+  }
+  
+  void Fired() {
+    fired_++;
+    if (--remaining_ > 0)
+      wheel_->Schedule(&timer_, timer_.expiry() + 100);
+  }
+  
+  int fired() const { return fired_; }
+  
+private:
+  TimerWheel* wheel_;
+  WheelTimer timer_;
+  int remaining_;
+  int fired_;
+};
+
+TEST(TimerWheelTest, ActionsCanReschedule) {
+  TimerWheel wheel(0);
+  Rescheduler rescheduler(&wheel, 5);
+  rescheduler.Start(50);
+  ASSERT_EQ(3u, wheel.Advance(250));
+  ASSERT_EQ(3, rescheduler.fired());
+  wheel.Advance(10000);
+  ASSERT_EQ(5, rescheduler.fired());
+}
+
+}
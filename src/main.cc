@@ -2,10 +2,16 @@
 // Copyright 2011 Kor Nielsen
 
 #include "base/common.h"
+#include "base/async_file_output_stream.h"
+#include "base/compression_stream.h"
 #include "base/event_loop.h"
+#include "base/loop_group.h"
 #include "base/stream.h"
 
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include "net/netlink.h"
 #include "net/netlink_monitor.h"
@@ -59,44 +65,127 @@ private:
 
 class PacketForwarder : public TunListener {
 public:
-  PacketForwarder(TunInterface* destination) {
+  PacketForwarder(TunQueue* destination) {
     destination_ = CheckNotNull(destination, "destination");
   }
   void PacketReceived(const void* data, size_t size)  {
     destination_->SendPacket(data, size);
   }
+  void PacketReceived(const PacketRef& packet) {
+    destination_->SendPacket(packet);
+  }
   
 private:
-  TunInterface* destination_;
+  TunQueue* destination_;
 };
 
+// Logs the packets from every queue on a single loop; queues running on
+// other threads hand their packets over with EventLoop::Post(). Writing to
+// stdout is left to a thread of its own, so a slow disk or pipe doesn't
+// hold up the loop (unless log_policy says to wait for it). A compressed
+// log is compressed on a thread of its own on the way there.
 class PacketLogger : public TunListener {
 public:
-  PacketLogger() {
-    FileOutputStream* file_output_stream = new FileOutputStream(STDOUT_FILENO, false);
+  // Packets handed over but not yet logged hold on to their queue's
+  // buffers, so past this many, packets are left out of the log instead of
+  // starving the queues when logging can't keep up
+  static const size_t kMaxQueuedPackets = 1024;
+  
+  PacketLogger(EventLoop* loop, AsyncOutputPolicy log_policy,
+               CompressionFormat log_compression)
+    : loop_(CheckNotNull(loop, "loop")),
+      queued_packets_(0),
+      dropped_packets_(0) {
+    shared_ptr<OutputStream> output_stream;
+    if (log_compression == CompressionFormat_None) {
+      async_output_.reset(new AsyncFileOutputStream(STDOUT_FILENO, false, 
+                                                    log_policy));
+      output_stream = async_output_;
+      // Packets logged in the same iteration of the loop go to the writer
+      // thread together
+      publish_hook_ = loop_->AddPrepareHook(
+          bind(&AsyncFileOutputStream::PublishRecords, async_output_.get()));
+    } else {
+      // The compressing thread only flushes once it's caught up, so what it
+      // has flushed can go to the writer thread straight away
+      shared_ptr<CompressingOutputStream> compressing_output(
+          new CompressingOutputStream(shared_ptr<OutputStream>(
+              new AsyncFileOutputStream(STDOUT_FILENO, false, log_policy,
+                                        AsyncOutputFlags_PublishOnFlush)),
+              log_compression));
+      output_stream = compressing_output;
+      publish_hook_ = loop_->AddPrepareHook(
+          bind(&CompressingOutputStream::HandOverFlushed, 
+               compressing_output.get()));
+    }
     
     writer_.reset(new JsonWriter(shared_ptr<BufferedOutputStream>(
-        new BufferedOutputStream(shared_ptr<OutputStream>(file_output_stream), 
-                                 4096)), JsonWriterFlags_Indent));
+        new BufferedOutputStream(output_stream, 4096)), 
+        JsonWriterFlags_Indent));
+  }
+  
+  ~PacketLogger() {
+    if (dropped_packets_ > 0) {
+      fprintf(stderr, "%zu packets were left out of the log because too "
+              "many were waiting to be logged\n", 
+              static_cast<size_t>(dropped_packets_));
+    }
+    if (async_output_ && async_output_->dropped_records() > 0) {
+      fprintf(stderr, "%" PRIu64 " packets (%" PRIu64 " bytes) were left out "
+              "of the log because stdout couldn't keep up\n",
+              async_output_->dropped_records(), 
+              async_output_->dropped_bytes());
+    }
   }
   
+  // Must only be called on the logger's loop
   void PacketReceived(const void* data, size_t size)  {
     SerializePacket(writer_.get(), data, size);
     writer_->Flush();
   }
+  void PacketReceived(const PacketRef& packet) {
+    if (__sync_fetch_and_add(&queued_packets_, 1) >= kMaxQueuedPackets) {
+      __sync_fetch_and_sub(&queued_packets_, 1);
+      __sync_fetch_and_add(&dropped_packets_, 1);
+      return;
+    }
+    loop_->Post(bind(&PacketLogger::LogPacket, this, packet));
+  }
+  
+  // Log packets as they appear on the wire, not as offload super-packets
+  bool wants_segments() const { return true; }
+  
 private:
+  void LogPacket(const PacketRef& packet) {
+    PacketReceived(packet.data(), packet.size());
+    __sync_fetch_and_sub(&queued_packets_, 1);
+  }
+  
+  EventLoop* loop_;
+  // What the loop writes to if the log isn't compressed; NULL otherwise
+  shared_ptr<AsyncFileOutputStream> async_output_;
   scoped_ptr<JsonWriter> writer_;
+  shared_ptr<IoTask> publish_hook_;
+  volatile size_t queued_packets_;
+  volatile size_t dropped_packets_;
 };
 
 class Program
 {
 public:
-  Program() {
+  Program(size_t queue_count, TunFlags tun_flags, LoopGroupFlags loop_flags,
+          AsyncOutputPolicy log_policy, CompressionFormat log_compression) {
     loop_.reset(new EventLoop());
     netlink_.reset(new Netlink());
     netlink_monitor_.reset(new NetlinkMonitor(loop_.get()));
-    tun_in_.reset(new TunInterface(loop_.get(), "crIN"));
-    tun_out_.reset(new TunInterface(loop_.get(), "crOUT"));
+    
+    // The main loop handles netlink and logging; each queue of the TUN
+    // devices gets a loop and thread of its own
+    queue_loops_.reset(new LoopGroup(queue_count, loop_flags));
+    vector<EventLoop*> queue_loops = queue_loops_->loops();
+    
+    tun_in_.reset(new TunInterface(queue_loops, "crIN", tun_flags));
+    tun_out_.reset(new TunInterface(queue_loops, "crOUT", tun_flags));
     
     interface_status_logger_.reset(new InterfaceStatusLogger(
         netlink_monitor_.get()));
@@ -104,10 +193,16 @@ public:
     interface_activator_.reset(new InterfaceActivator(netlink_.get(),
                                                       netlink_monitor_.get()));
     
-    in_out_forwarder_.reset(new PacketForwarder(tun_out_.get()));
-    packet_logger_.reset(new PacketLogger());
+    // Each crIN queue forwards to the crOUT queue on the same loop, so a
+    // packet never crosses threads
+    for (size_t i = 0; i < queue_count; i++) {
+      shared_ptr<PacketForwarder> forwarder(new PacketForwarder(tun_out_->queue(i)));
+      in_out_forwarders_.push_back(forwarder);
+      listener_handles_.push_back(tun_in_->queue(i)->AddListener(forwarder.get()));
+    }
     
-    listener_handles_.push_back(tun_in_->AddListener(in_out_forwarder_.get()));
+    packet_logger_.reset(new PacketLogger(loop_.get(), log_policy,
+                                         log_compression));
     listener_handles_.push_back(tun_in_->AddListener(packet_logger_.get()));
   }
   
@@ -127,17 +222,26 @@ public:
   }
   
   void Run() { 
+    queue_loops_->Start();
     loop_->Run(); 
+    
+    // The queue loops call into the TUN interfaces, the forwarders and the
+    // logger, so their threads must be gone before any of those are torn
+    // down. The loops themselves are destroyed last, as the interfaces'
+    // watchers still belong to them.
+    queue_loops_->Stop();
+    queue_loops_->Join();
   }
   
 private:
   Program(const Program& other);
   scoped_ptr<EventLoop> loop_;
+  scoped_ptr<LoopGroup> queue_loops_;
   scoped_ptr<Netlink> netlink_;
   scoped_ptr<NetlinkMonitor> netlink_monitor_;
   scoped_ptr<TunInterface> tun_in_;
   scoped_ptr<TunInterface> tun_out_;
-  scoped_ptr<PacketForwarder> in_out_forwarder_;
+  vector<shared_ptr<PacketForwarder> > in_out_forwarders_;
   scoped_ptr<PacketLogger> packet_logger_;
   scoped_ptr<InterfaceActivator> interface_activator_;
   scoped_ptr<InterfaceStatusLogger> interface_status_logger_;
@@ -148,7 +252,57 @@ private:
 }
 
 int main(int argc, const char *const argv[]) {
-  cheaproute::Program program;
+  size_t queue_count = 1;
+  cheaproute::TunFlags tun_flags = cheaproute::TunFlags_None;
+  cheaproute::LoopGroupFlags loop_flags = cheaproute::LoopGroupFlags_None;
+  cheaproute::AsyncOutputPolicy log_policy = cheaproute::AsyncOutputPolicy_Block;
+  cheaproute::CompressionFormat log_compression = cheaproute::CompressionFormat_None;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--queues") == 0 && i + 1 < argc) {
+      queue_count = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--offload") == 0) {
+      tun_flags = cheaproute::TunFlags(tun_flags | cheaproute::TunFlags_Offload);
+    } else if (strcmp(argv[i], "--io-uring") == 0) {
+      tun_flags = cheaproute::TunFlags(tun_flags | cheaproute::TunFlags_IoUring);
+    } else if (strcmp(argv[i], "--pin-threads") == 0) {
+      loop_flags = cheaproute::LoopGroupFlags_PinThreads;
+    } else if (strcmp(argv[i], "--drop-log") == 0) {
+      log_policy = cheaproute::AsyncOutputPolicy_CountAndDrop;
+    } else if (strcmp(argv[i], "--compress-log") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "gzip") == 0) {
+        log_compression = cheaproute::CompressionFormat_Gzip;
+      } else if (strcmp(argv[i], "zstd") == 0) {
+        log_compression = cheaproute::CompressionFormat_Zstd;
+      } else {
+        fprintf(stderr, "Unknown log compression format '%s'\n", argv[i]);
+        return -1;
+      }
+    } else {
+      fprintf(stderr, "Usage: %s [--queues <count>] [--pin-threads] [--offload] "
+              "[--io-uring] [--drop-log] [--compress-log gzip|zstd]\n", argv[0]);
+      return -1;
+    }
+  }
+  if (log_compression != cheaproute::CompressionFormat_None) {
+    if (!cheaproute::IsCompressionFormatSupported(log_compression)) {
+      fprintf(stderr, "cheaproute was built without support for that "
+              "log compression format\n");
+      return -1;
+    }
+    // Leaving bytes out of a compressed stream would corrupt the rest of it
+    if (log_policy != cheaproute::AsyncOutputPolicy_Block) {
+      fprintf(stderr, "--drop-log can't be combined with --compress-log\n");
+      return -1;
+    }
+  }
+  if (queue_count < 1) {
+    fprintf(stderr, "--queues must be at least 1\n");
+    return -1;
+  }
+  
+  cheaproute::Program program(queue_count, tun_flags, loop_flags, log_policy,
+                              log_compression);
   program.Init();
   program.Run();
 }
@@ -0,0 +1,32 @@
+#include "net/checksum.h"
+
+#include <arpa/inet.h>
+
+namespace cheaproute {
+
+uint32_t ChecksumAdd(uint32_t sum, const void* data, size_t size) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  const uint8_t* end = p + (size & ~static_cast<size_t>(1));
+  
+  uint64_t result = sum;
+  for (; p < end; p += 2) {
+    result += (p[0] << 8) | p[1];
+  }
+  if (size & 0x01) {
+    result += *p << 8;
+  }
+  
+  while (result >> 32) {
+    result = (result & 0xffffffff) + (result >> 32);
+  }
+  return static_cast<uint32_t>(result);
+}
+
+uint16_t ChecksumFinish(uint32_t sum) {
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return htons(static_cast<uint16_t>(~sum));
+}
+
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "base/common.h"
+
+namespace cheaproute {
+
+// Adds data to a running Internet checksum (RFC 1071). Data is summed as
+// big-endian 16-bit words, with an odd trailing byte padded with zero, so
+// sums of several pieces only line up if all but the last have even sizes.
+uint32_t ChecksumAdd(uint32_t sum, const void* data, size_t size);
+
+// Folds and complements a running sum. The result is in network byte order,
+// ready to be stored in a header.
+uint16_t ChecksumFinish(uint32_t sum);
+
+}
@@ -0,0 +1,210 @@
+#include "net/gso.h"
+#include "net/checksum.h"
+
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace cheaproute {
+
+// The CWR flag lives in the upper bit of the 14th byte of the TCP header
+const size_t kTcpFlagsOffset = 13;
+const uint8_t kTcpFlagCwr = 0x80;
+
+// Finds the TCP header behind an IPv6 header and any extension headers.
+// Only hop-by-hop and destination options are skipped: they're copied into
+// every segment as they are. A routing header would change the address in
+// the pseudo-header and a fragment header can't go on a super-packet, so
+// those (and anything else) are rejected. Returns 0 if there's no TCP
+// header to be found.
+static size_t Ipv6TcpHeaderOffset(const uint8_t* data, size_t size) {
+  if (size < sizeof(ip6_hdr))
+    return 0;
+  uint8_t next_header = reinterpret_cast<const ip6_hdr*>(data)->ip6_nxt;
+  size_t offset = sizeof(ip6_hdr);
+  while (next_header == IPPROTO_HOPOPTS || next_header == IPPROTO_DSTOPTS) {
+    // Both start with the next header and their length in 8-byte units,
+    // not counting the first 8 bytes
+    if (size < offset + 8)
+      return 0;
+    next_header = data[offset];
+    offset += (static_cast<size_t>(data[offset + 1]) + 1) * 8;
+  }
+  return next_header == IPPROTO_TCP ? offset : 0;
+}
+
+GsoInfo GsoInfoFromVirtioHeader(const VirtioNetHeader& header) {
+  GsoInfo result;
+  switch (header.gso_type & ~kVirtioNetGsoEcn) {
+    case kVirtioNetGsoTcp4:
+      result.type = GsoType_Tcp4;
+      break;
+    case kVirtioNetGsoTcp6:
+      result.type = GsoType_Tcp6;
+      break;
+    default:
+      result.type = GsoType_None;
+      break;
+  }
+  result.ecn = header.gso_type & kVirtioNetGsoEcn;
+  result.needs_checksum = header.flags & kVirtioNetHeaderNeedsChecksum;
+  result.segment_size = header.gso_size;
+  result.header_size = header.hdr_len;
+  result.checksum_start = header.csum_start;
+  result.checksum_offset = header.csum_offset;
+  return result;
+}
+
+void GsoInfoToVirtioHeader(const GsoInfo& gso, VirtioNetHeader* header) {
+  memset(header, 0, sizeof(*header));
+  switch (gso.type) {
+    case GsoType_Tcp4:
+      header->gso_type = kVirtioNetGsoTcp4;
+      break;
+    case GsoType_Tcp6:
+      header->gso_type = kVirtioNetGsoTcp6;
+      break;
+    case GsoType_None:
+      header->gso_type = kVirtioNetGsoNone;
+      break;
+  }
+  if (gso.ecn)
+    header->gso_type |= kVirtioNetGsoEcn;
+  if (gso.needs_checksum)
+    header->flags |= kVirtioNetHeaderNeedsChecksum;
+  header->gso_size = gso.segment_size;
+  header->hdr_len = gso.header_size;
+  header->csum_start = gso.checksum_start;
+  header->csum_offset = gso.checksum_offset;
+}
+
+bool CompleteChecksum(void* packet, size_t size, const GsoInfo& gso) {
+  if (!gso.needs_checksum)
+    return true;
+  
+  size_t start = gso.checksum_start;
+  size_t field = start + gso.checksum_offset;
+  if (field + sizeof(uint16_t) > size)
+    return false;
+  
+  // The kernel has already put the pseudo-header sum in the checksum field,
+  // so summing everything from start (field included) gives the full sum
+  uint8_t* p = static_cast<uint8_t*>(packet);
+  uint16_t checksum = ChecksumFinish(ChecksumAdd(0, p + start, size - start));
+  memcpy(p + field, &checksum, sizeof(checksum));
+  return true;
+}
+
+static bool CopyPacket(const PacketRef& packet, PacketBufferPool* pool,
+                       vector<PacketRef>* segments) {
+  if (packet.size() > pool->buffer_size())
+    return false;
+  PacketRef copy = pool->Allocate();
+  if (copy.empty())
+    return false;
+  memcpy(copy->data(), packet.data(), packet.size());
+  copy->set_size(packet.size());
+  if (!CompleteChecksum(copy->data(), copy->size(), packet->gso()))
+    return false;
+  segments->push_back(copy);
+  return true;
+}
+
+bool SegmentPacket(const PacketRef& packet, PacketBufferPool* pool,
+                   vector<PacketRef>* segments) {
+  const GsoInfo& gso = packet->gso();
+  if (gso.type == GsoType_None)
+    return CopyPacket(packet, pool, segments);
+  
+  const uint8_t* data = packet->data();
+  size_t size = packet.size();
+  
+  size_t ip_header_size;
+  if (gso.type == GsoType_Tcp4) {
+    const iphdr* ip_header = reinterpret_cast<const iphdr*>(data);
+    if (size < sizeof(iphdr) || ip_header->version != 4 || 
+        ip_header->protocol != IPPROTO_TCP) {
+      return false;
+    }
+    ip_header_size = ip_header->ihl * 4;
+  } else {
+    ip_header_size = Ipv6TcpHeaderOffset(data, size);
+    if (ip_header_size == 0)
+      return false;
+  }
+  if (size < ip_header_size + sizeof(tcphdr))
+    return false;
+  
+  const tcphdr* tcp_header = reinterpret_cast<const tcphdr*>(data + ip_header_size);
+  size_t tcp_header_size = tcp_header->doff * 4;
+  size_t header_size = ip_header_size + tcp_header_size;
+  if (tcp_header_size < sizeof(tcphdr) || size < header_size || 
+      gso.segment_size == 0) {
+    return false;
+  }
+  
+  size_t payload_size = size - header_size;
+  uint32_t first_seq = ntohl(tcp_header->seq);
+  
+  size_t offset = 0;
+  for (uint16_t i = 0; offset < payload_size || i == 0; i++) {
+    size_t segment_payload = std::min(static_cast<size_t>(gso.segment_size), 
+                                      payload_size - offset);
+    size_t segment_size = header_size + segment_payload;
+    if (segment_size > pool->buffer_size())
+      return false;
+    PacketRef segment = pool->Allocate();
+    if (segment.empty())
+      return false;
+    
+    uint8_t* p = segment->data();
+    memcpy(p, data, header_size);
+    memcpy(p + header_size, data + header_size + offset, segment_payload);
+    segment->set_size(segment_size);
+    
+    bool first = offset == 0;
+    bool last = offset + segment_payload >= payload_size;
+    
+    tcphdr* segment_tcp = reinterpret_cast<tcphdr*>(p + ip_header_size);
+    segment_tcp->seq = htonl(first_seq + static_cast<uint32_t>(offset));
+    if (!last) {
+      segment_tcp->fin = 0;
+      segment_tcp->psh = 0;
+    }
+    if (!first)
+      p[ip_header_size + kTcpFlagsOffset] &= static_cast<uint8_t>(~kTcpFlagCwr);
+    
+    uint16_t tcp_size = static_cast<uint16_t>(tcp_header_size + segment_payload);
+    uint32_t pseudo_sum;
+    if (gso.type == GsoType_Tcp4) {
+      iphdr* ip_header = reinterpret_cast<iphdr*>(p);
+      ip_header->tot_len = htons(static_cast<uint16_t>(segment_size));
+      ip_header->id = htons(static_cast<uint16_t>(ntohs(ip_header->id) + i));
+      ip_header->check = 0;
+      ip_header->check = ChecksumFinish(ChecksumAdd(0, ip_header, ip_header_size));
+      
+      pseudo_sum = ChecksumAdd(0, &ip_header->saddr, 2 * sizeof(uint32_t));
+    } else {
+      ip6_hdr* ip_header = reinterpret_cast<ip6_hdr*>(p);
+      ip_header->ip6_plen = htons(static_cast<uint16_t>(
+          segment_size - sizeof(ip6_hdr)));
+      
+      pseudo_sum = ChecksumAdd(0, &ip_header->ip6_src, 2 * sizeof(in6_addr));
+    }
+    pseudo_sum += IPPROTO_TCP + tcp_size;
+    
+    segment_tcp->check = 0;
+    segment_tcp->check = ChecksumFinish(ChecksumAdd(pseudo_sum, segment_tcp, tcp_size));
+    
+    segments->push_back(segment);
+    offset += segment_payload;
+  }
+  return true;
+}
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "base/common.h"
+#include "net/packet_buffer.h"
+
+namespace cheaproute {
+
+// The header that precedes every packet on a TUN device with IFF_VNET_HDR
+// (struct virtio_net_hdr). It's spelled out here because the kernel's
+// virtio_net.h doesn't compile as C++.
+struct VirtioNetHeader {
+  uint8_t flags;
+  uint8_t gso_type;
+  uint16_t hdr_len;
+  uint16_t gso_size;
+  uint16_t csum_start;
+  uint16_t csum_offset;
+};
+
+const uint8_t kVirtioNetHeaderNeedsChecksum = 1;
+
+const uint8_t kVirtioNetGsoNone = 0;
+const uint8_t kVirtioNetGsoTcp4 = 1;
+const uint8_t kVirtioNetGsoTcp6 = 4;
+const uint8_t kVirtioNetGsoEcn = 0x80;
+
+GsoInfo GsoInfoFromVirtioHeader(const VirtioNetHeader& header);
+void GsoInfoToVirtioHeader(const GsoInfo& gso, VirtioNetHeader* header);
+
+// Stores the full transport checksum of a packet whose GsoInfo says the
+// kernel left it partial. Returns false if the checksum location is
+// outside the packet.
+bool CompleteChecksum(void* packet, size_t size, const GsoInfo& gso);
+
+// Turns a packet that needs offload processing into plain packets that can
+// go on the wire, allocated from pool and appended to segments. A TCP
+// super-packet is split into segment_size pieces with their own IP and TCP
+// headers and checksums; a packet that only needs its checksum completed
+// is copied once. Returns false if the packet is malformed or of a type we
+// can't segment (IPv6 extension headers other than hop-by-hop and
+// destination options are among those), or if the pool runs dry.
+bool SegmentPacket(const PacketRef& packet, PacketBufferPool* pool,
+                   vector<PacketRef>* segments);
+
+}
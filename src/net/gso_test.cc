@@ -0,0 +1,229 @@
+#include "net/gso.h"
+#include "net/checksum.h"
+
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "gtest/gtest.h"
+
+namespace cheaproute {
+
+static uint16_t TcpChecksum(const iphdr* ip_header) {
+  size_t ip_header_size = ip_header->ihl * 4;
+  uint16_t tcp_size = static_cast<uint16_t>(ntohs(ip_header->tot_len) -
+                                            ip_header_size);
+  uint32_t sum = ChecksumAdd(0, &ip_header->saddr, 2 * sizeof(uint32_t));
+  sum += IPPROTO_TCP + tcp_size;
+  return ChecksumFinish(ChecksumAdd(
+      sum, reinterpret_cast<const uint8_t*>(ip_header) + ip_header_size, tcp_size));
+}
+
+static uint16_t Tcp6Checksum(const ip6_hdr* ip_header, size_t tcp_offset) {
+  uint16_t tcp_size = static_cast<uint16_t>(
+      sizeof(ip6_hdr) + ntohs(ip_header->ip6_plen) - tcp_offset);
+  uint32_t sum = ChecksumAdd(0, &ip_header->ip6_src, 2 * sizeof(in6_addr));
+  sum += IPPROTO_TCP + tcp_size;
+  return ChecksumFinish(ChecksumAdd(
+      sum, reinterpret_cast<const uint8_t*>(ip_header) + tcp_offset, tcp_size));
+}
+
+// An IPv6 TCP packet with an 8-byte extension header of type
+// extension_type between the IP and TCP headers
+static PacketRef MakeTcp6Packet(PacketBufferPool* pool, uint8_t extension_type,
+                                size_t payload_size) {
+  PacketRef packet = pool->Allocate();
+  uint8_t* p = packet->data();
+  size_t tcp_offset = sizeof(ip6_hdr) + 8;
+  size_t size = tcp_offset + sizeof(tcphdr) + payload_size;
+  memset(p, 0, size);
+  
+  ip6_hdr* ip_header = reinterpret_cast<ip6_hdr*>(p);
+  ip_header->ip6_vfc = 6 << 4;
+  ip_header->ip6_nxt = extension_type;
+  ip_header->ip6_hlim = 64;
+  ip_header->ip6_plen = htons(static_cast<uint16_t>(size - sizeof(ip6_hdr)));
+  ip_header->ip6_src.s6_addr[0] = 0xfd;
+  ip_header->ip6_src.s6_addr[15] = 1;
+  ip_header->ip6_dst.s6_addr[0] = 0xfd;
+  ip_header->ip6_dst.s6_addr[15] = 2;
+  
+  // Next header, then a length of 0 and a PadN option filling the rest
+  p[sizeof(ip6_hdr)] = IPPROTO_TCP;
+  p[sizeof(ip6_hdr) + 2] = 1;
+  p[sizeof(ip6_hdr) + 3] = 4;
+  
+  tcphdr* tcp_header = reinterpret_cast<tcphdr*>(p + tcp_offset);
+  tcp_header->source = htons(1234);
+  tcp_header->dest = htons(80);
+  tcp_header->seq = htonl(1000);
+  tcp_header->doff = 5;
+  tcp_header->ack = 1;
+  for (size_t i = 0; i < payload_size; i++) {
+    p[tcp_offset + sizeof(tcphdr) + i] = i & 0xff;
+  }
+  packet->set_size(size);
+  return packet;
+}
+
+static PacketRef MakeTcp4Packet(PacketBufferPool* pool, size_t payload_size) {
+  PacketRef packet = pool->Allocate();
+  uint8_t* p = packet->data();
+  size_t size = sizeof(iphdr) + sizeof(tcphdr) + payload_size;
+  memset(p, 0, size);
+  
+  iphdr* ip_header = reinterpret_cast<iphdr*>(p);
+  ip_header->version = 4;
+  ip_header->ihl = 5;
+  ip_header->ttl = 64;
+  ip_header->protocol = IPPROTO_TCP;
+  ip_header->tot_len = htons(static_cast<uint16_t>(size));
+  ip_header->id = htons(100);
+  ip_header->saddr = htonl(0xc0a80501);
+  ip_header->daddr = htonl(0xc0a80601);
+  
+  tcphdr* tcp_header = reinterpret_cast<tcphdr*>(p + sizeof(iphdr));
+  tcp_header->source = htons(1234);
+  tcp_header->dest = htons(80);
+  tcp_header->seq = htonl(1000);
+  tcp_header->doff = 5;
+  tcp_header->ack = 1;
+  tcp_header->psh = 1;
+  tcp_header->fin = 1;
+  for (size_t i = 0; i < payload_size; i++) {
+    p[sizeof(iphdr) + sizeof(tcphdr) + i] = i & 0xff;
+  }
+  packet->set_size(size);
+  return packet;
+}
+
+TEST(ChecksumTest, MatchesRfc1071Example) {
+  const uint8_t data[] = { 0x00, 0x01, 0xf2, 0x03, 0xf4, 0xf5, 0xf6, 0xf7 };
+  ASSERT_EQ(0x2ddf0u, ChecksumAdd(0, data, sizeof(data)));
+  ASSERT_EQ(htons(0x220d), ChecksumFinish(ChecksumAdd(0, data, sizeof(data))));
+}
+
+TEST(ChecksumTest, PadsOddLength) {
+  const uint8_t data[] = { 0x12, 0x34, 0x56 };
+  ASSERT_EQ(0x1234u + 0x5600u, ChecksumAdd(0, data, sizeof(data)));
+}
+
+TEST(GsoTest, SplitsTcp4SuperPacket) {
+  PacketBufferPool pool(4096, 8, 0);
+  PacketBufferPool segment_pool(1500, 8, 0);
+  PacketRef packet = MakeTcp4Packet(&pool, 2500);
+  
+  GsoInfo gso;
+  gso.type = GsoType_Tcp4;
+  gso.segment_size = 1000;
+  packet->set_gso(gso);
+  
+  vector<PacketRef> segments;
+  ASSERT_TRUE(SegmentPacket(packet, &segment_pool, &segments));
+  ASSERT_EQ(3u, segments.size());
+  
+  size_t payload_sizes[] = { 1000, 1000, 500 };
+  for (size_t i = 0; i < segments.size(); i++) {
+    const iphdr* ip_header = reinterpret_cast<const iphdr*>(segments[i].data());
+    const tcphdr* tcp_header = reinterpret_cast<const tcphdr*>(ip_header + 1);
+    size_t expected_size = sizeof(iphdr) + sizeof(tcphdr) + payload_sizes[i];
+    
+    ASSERT_EQ(expected_size, segments[i].size());
+    ASSERT_EQ(expected_size, ntohs(ip_header->tot_len));
+    ASSERT_EQ(100u + i, ntohs(ip_header->id));
+    ASSERT_EQ(1000u + 1000 * i, ntohl(tcp_header->seq));
+    ASSERT_EQ(i == 2, tcp_header->fin == 1);
+    ASSERT_EQ(i == 2, tcp_header->psh == 1);
+    ASSERT_EQ(1, tcp_header->ack);
+    ASSERT_EQ(0, ChecksumFinish(ChecksumAdd(0, ip_header, sizeof(iphdr))));
+    ASSERT_EQ(0, TcpChecksum(ip_header));
+    
+    const uint8_t* payload = reinterpret_cast<const uint8_t*>(tcp_header + 1);
+    ASSERT_EQ((i * 1000) & 0xff, payload[0]);
+  }
+}
+
+TEST(GsoTest, CompletesPartialChecksum) {
+  PacketBufferPool pool(4096, 8, 0);
+  PacketRef packet = MakeTcp4Packet(&pool, 100);
+  iphdr* ip_header = reinterpret_cast<iphdr*>(packet->data());
+  tcphdr* tcp_header = reinterpret_cast<tcphdr*>(ip_header + 1);
+  
+  // What the kernel leaves in the checksum field: the folded pseudo-header sum
+  uint32_t pseudo_sum = ChecksumAdd(0, &ip_header->saddr, 2 * sizeof(uint32_t));
+  pseudo_sum += IPPROTO_TCP + sizeof(tcphdr) + 100;
+  tcp_header->check = ~ChecksumFinish(pseudo_sum);
+  
+  GsoInfo gso;
+  gso.needs_checksum = true;
+  gso.checksum_start = sizeof(iphdr);
+  gso.checksum_offset = offsetof(tcphdr, check);
+  packet->set_gso(gso);
+  
+  vector<PacketRef> segments;
+  ASSERT_TRUE(SegmentPacket(packet, &pool, &segments));
+  ASSERT_EQ(1u, segments.size());
+  ASSERT_EQ(0, TcpChecksum(reinterpret_cast<const iphdr*>(segments[0].data())));
+}
+
+TEST(GsoTest, RejectsNonTcpSuperPacket) {
+  PacketBufferPool pool(4096, 8, 0);
+  PacketRef packet = MakeTcp4Packet(&pool, 2000);
+  reinterpret_cast<iphdr*>(packet->data())->protocol = IPPROTO_UDP;
+  GsoInfo gso;
+  gso.type = GsoType_Tcp4;
+  gso.segment_size = 1000;
+  packet->set_gso(gso);
+  
+  vector<PacketRef> segments;
+  ASSERT_FALSE(SegmentPacket(packet, &pool, &segments));
+}
+
+TEST(GsoTest, SplitsTcp6SuperPacketWithHopByHopOptions) {
+  PacketBufferPool pool(4096, 8, 0);
+  PacketBufferPool segment_pool(1500, 8, 0);
+  PacketRef packet = MakeTcp6Packet(&pool, IPPROTO_HOPOPTS, 1500);
+  
+  GsoInfo gso;
+  gso.type = GsoType_Tcp6;
+  gso.segment_size = 1000;
+  packet->set_gso(gso);
+  
+  vector<PacketRef> segments;
+  ASSERT_TRUE(SegmentPacket(packet, &segment_pool, &segments));
+  ASSERT_EQ(2u, segments.size());
+  
+  size_t tcp_offset = sizeof(ip6_hdr) + 8;
+  size_t payload_sizes[] = { 1000, 500 };
+  for (size_t i = 0; i < segments.size(); i++) {
+    const ip6_hdr* ip_header = reinterpret_cast<const ip6_hdr*>(segments[i].data());
+    const tcphdr* tcp_header = reinterpret_cast<const tcphdr*>(
+        segments[i]->data() + tcp_offset);
+    size_t expected_size = tcp_offset + sizeof(tcphdr) + payload_sizes[i];
+    
+    ASSERT_EQ(expected_size, segments[i].size());
+    ASSERT_EQ(expected_size - sizeof(ip6_hdr), ntohs(ip_header->ip6_plen));
+    ASSERT_EQ(IPPROTO_HOPOPTS, ip_header->ip6_nxt);
+    ASSERT_EQ(1000u + 1000 * i, ntohl(tcp_header->seq));
+    ASSERT_EQ(0, Tcp6Checksum(ip_header, tcp_offset));
+  }
+}
+
+TEST(GsoTest, RejectsTcp6SuperPacketWithRoutingHeader) {
+  PacketBufferPool pool(4096, 8, 0);
+  PacketRef packet = MakeTcp6Packet(&pool, IPPROTO_ROUTING, 2000);
+  GsoInfo gso;
+  gso.type = GsoType_Tcp6;
+  gso.segment_size = 1000;
+  packet->set_gso(gso);
+  
+  vector<PacketRef> segments;
+  ASSERT_FALSE(SegmentPacket(packet, &pool, &segments));
+  ASSERT_TRUE(segments.empty());
+}
+
+}
@@ -1,5 +1,6 @@
 
 #include "base/json_writer.h"
+#include "net/checksum.h"
 #include "net/ip_address.h"
 
 #include <netinet/ip.h>
@@ -7,6 +8,7 @@
 #include <netinet/udp.h>
 #include <netinet/ip_icmp.h>
 #include <base/json_reader.h>
+#include <base/string_piece.h>
 #include <arpa/inet.h>
 
 #include <stdarg.h>
@@ -19,6 +21,36 @@ const uint8_t kProtocolTcp = 6;
 const uint8_t kProtocolUdp = 17;
 const uint8_t kProtocolIcmp = 1;
 
+// Most of these are written for every packet, so they're only escaped and
+// quoted once
+static const JsonPropertyName kAckNumberProperty("ackNumber");
+static const JsonPropertyName kCodeProperty("code");
+static const JsonPropertyName kDataProperty("data");
+static const JsonPropertyName kDestPortProperty("destPort");
+static const JsonPropertyName kDestinationProperty("destination");
+static const JsonPropertyName kFlagsProperty("flags");
+static const JsonPropertyName kFragmentOffsetProperty("fragmentOffset");
+static const JsonPropertyName kGatewayProperty("gateway");
+static const JsonPropertyName kIcmpProperty("icmp");
+static const JsonPropertyName kIdProperty("id");
+static const JsonPropertyName kIdentifierProperty("identifier");
+static const JsonPropertyName kIpProperty("ip");
+static const JsonPropertyName kNextHopMtuProperty("nextHopMtu");
+static const JsonPropertyName kOptionsProperty("options");
+static const JsonPropertyName kProtocolProperty("protocol");
+static const JsonPropertyName kSeqNumberProperty("seqNumber");
+static const JsonPropertyName kSequenceNumberProperty("sequenceNumber");
+static const JsonPropertyName kSourceProperty("source");
+static const JsonPropertyName kSourcePortProperty("sourcePort");
+static const JsonPropertyName kTcpProperty("tcp");
+static const JsonPropertyName kTosProperty("tos");
+static const JsonPropertyName kTtlProperty("ttl");
+static const JsonPropertyName kTypeProperty("type");
+static const JsonPropertyName kUdpProperty("udp");
+static const JsonPropertyName kUrgentPointerProperty("urgentPointer");
+static const JsonPropertyName kVersionProperty("version");
+static const JsonPropertyName kWindowSizeProperty("windowSize");
+
 const char* kProtocolNames[256] = {
   "HOPOPT", "ICMP", "IGMP", "GGP", "IP", "ST", "TCP", "CBT",
   "EGP", "IGP", "BBN-RCC-MON", "NVP-II", "PUP", "ARGUS", "EMCON", "XNET",
@@ -104,79 +136,85 @@ const char* kIcmpBadIpHeaderCodeNames[] = {
   "badLength"
 };
 
+// The keys are the string literals above, so the JsonReader's string
+// pieces can be looked up without copying them
+template<typename T>
+struct LookupTable {
+  typedef unordered_map<StringPiece, T, StringPieceHash> Type;
+};
 
-static const unordered_map<string, int>* CreateIpFlagLookupTable() {
-  unordered_map<string, int>* result = new unordered_map<string, int>();
+static const LookupTable<int>::Type* CreateIpFlagLookupTable() {
+  LookupTable<int>::Type* result = new LookupTable<int>::Type();
   (*result)["DF"] = IP_DF;
   (*result)["MF"] = IP_MF;
   return result;
 }
-static const unordered_map<string, int>* GetIpFlagLookupTable() {
-  const static unordered_map<string, int>* result = CreateIpFlagLookupTable();
+static const LookupTable<int>::Type* GetIpFlagLookupTable() {
+  const static LookupTable<int>::Type* result = CreateIpFlagLookupTable();
   return result;
 }
 
 template<typename T>
-static const unordered_map<string, T>* CreateLookupTable(const char** array, size_t array_size) {
-  unordered_map<string, T>* result = new unordered_map<string, T>();
+static const typename LookupTable<T>::Type* CreateLookupTable(const char** array, size_t array_size) {
+  typename LookupTable<T>::Type* result = new typename LookupTable<T>::Type();
   
   for (size_t i = 0; i < array_size; i++) {
     const char* value = array[i];
     if (value) {
-      (*result)[string(value)] = static_cast<T>(i);
+      (*result)[StringPiece(value)] = static_cast<T>(i);
     }
   }
   return result;
 }
 template<typename T>
-static const unordered_map<string, T>* CreateFlagLookupTable(const char** array, size_t array_size) {
-  unordered_map<string, T>* result = new unordered_map<string, T>();
+static const typename LookupTable<T>::Type* CreateFlagLookupTable(const char** array, size_t array_size) {
+  typename LookupTable<T>::Type* result = new typename LookupTable<T>::Type();
   
   for (size_t i = 0; i < array_size; i++) {
     const char* value = array[i];
     if (value) {
-      (*result)[string(value)] = 1 << static_cast<T>(i);
+      (*result)[StringPiece(value)] = 1 << static_cast<T>(i);
     }
   }
   return result;
 }
 
 
-static const unordered_map<string, int>* GetTcpFlagLookupTable() {
-  const static unordered_map<string, int>* result = 
+static const LookupTable<int>::Type* GetTcpFlagLookupTable() {
+  const static LookupTable<int>::Type* result = 
     CreateFlagLookupTable<int>(kTcpFlags, ArrayLength(kTcpFlags));
   return result;
 }
-static const unordered_map<string, uint8_t>* GetTcpOptionTable() {
-  const static unordered_map<string, uint8_t>* result = 
+static const LookupTable<uint8_t>::Type* GetTcpOptionTable() {
+  const static LookupTable<uint8_t>::Type* result = 
       CreateLookupTable<uint8_t>(kTcpOptions, ArrayLength(kTcpOptions));
   return result;
 }
-static const unordered_map<string, uint8_t>* GetIcmpTypeLookupTable() {
-  const static unordered_map<string, uint8_t>* result = 
+static const LookupTable<uint8_t>::Type* GetIcmpTypeLookupTable() {
+  const static LookupTable<uint8_t>::Type* result = 
       CreateLookupTable<uint8_t>(kIcmpTypeNames, ArrayLength(kIcmpTypeNames));
   return result;
 }
-static const unordered_map<string, uint8_t>* GetIcmpDestinationUnreacheableCodeNameLookupTable() {
-  const static unordered_map<string, uint8_t>* result = 
+static const LookupTable<uint8_t>::Type* GetIcmpDestinationUnreacheableCodeNameLookupTable() {
+  const static LookupTable<uint8_t>::Type* result = 
       CreateLookupTable<uint8_t>(kIcmpDestinationUnreachableCodeNames, 
                              ArrayLength(kIcmpDestinationUnreachableCodeNames));
   return result;
 }
-static const unordered_map<string, uint8_t>* GetIcmpRedirectMessageCodeNamesLookupTable() {
-  const static unordered_map<string, uint8_t>* result = 
+static const LookupTable<uint8_t>::Type* GetIcmpRedirectMessageCodeNamesLookupTable() {
+  const static LookupTable<uint8_t>::Type* result = 
       CreateLookupTable<uint8_t>(kIcmpRedirectMessageCodeNames, 
                              ArrayLength(kIcmpRedirectMessageCodeNames));
   return result;
 }
-static const unordered_map<string, uint8_t>* GetIcmpBadIpHeaderCodeNames() {
-  const static unordered_map<string, uint8_t>* result = 
+static const LookupTable<uint8_t>::Type* GetIcmpBadIpHeaderCodeNames() {
+  const static LookupTable<uint8_t>::Type* result = 
       CreateLookupTable<uint8_t>(kIcmpBadIpHeaderCodeNames, 
                              ArrayLength(kIcmpBadIpHeaderCodeNames));
   return result;
 }
-static const unordered_map<string, uint8_t>* GetProtocolNameLookupTable() {
-  const static unordered_map<string, uint8_t>* result = 
+static const LookupTable<uint8_t>::Type* GetProtocolNameLookupTable() {
+  const static LookupTable<uint8_t>::Type* result = 
       CreateLookupTable<uint8_t>(kProtocolNames, ArrayLength(kProtocolNames));
   return result;
 }
@@ -234,9 +272,9 @@ static bool IsPlainText(const void* data, size_t size) {
 
 static void SerializeBytesAsText(JsonWriter* writer, const void* data, size_t size) {
   writer->BeginObject();
-  writer->WritePropertyName("type");
+  writer->WritePropertyName(kTypeProperty);
   writer->WriteString("text");
-  writer->WritePropertyName("data");
+  writer->WritePropertyName(kDataProperty);
   writer->BeginArray();
   const uint8_t* p = static_cast<const uint8_t*>(data);
   const uint8_t* end = p + size;
@@ -258,9 +296,9 @@ static void SerializeBytesAsText(JsonWriter* writer, const void* data, size_t si
 static void SerializeBytesAsHex(JsonWriter* writer, const void* data, size_t size) {
   const ssize_t bytes_per_line = 16;
   writer->BeginObject();
-  writer->WritePropertyName("type");
+  writer->WritePropertyName(kTypeProperty);
   writer->WriteString("hex");
-  writer->WritePropertyName("data");
+  writer->WritePropertyName(kDataProperty);
   
   const uint8_t* p = static_cast<const uint8_t*>(data);
   const uint8_t* end = p + size;
@@ -304,30 +342,30 @@ static void WriteIcmpCode(JsonWriter* writer, int type, int code) {
 
 static size_t WriteIpHeader(JsonWriter* writer, const iphdr* ip_header) {
   writer->BeginObject();
-  writer->WritePropertyName("version");
+  writer->WritePropertyName(kVersionProperty);
   writer->BeginPack();
   writer->WriteInteger(static_cast<int>(ip_header->version));
-  writer->WritePropertyName("tos");
+  writer->WritePropertyName(kTosProperty);
   writer->WriteInteger(ip_header->tos);
-  writer->WritePropertyName("id");
+  writer->WritePropertyName(kIdProperty);
   writer->WriteInteger(htons(ip_header->id));
-  writer->WritePropertyName("flags");
+  writer->WritePropertyName(kFlagsProperty);
   WriteIpFlags(writer, htons(ip_header->frag_off));
   writer->EndPack();
   
-  writer->WritePropertyName("fragmentOffset");
+  writer->WritePropertyName(kFragmentOffsetProperty);
   writer->BeginPack();
   writer->WriteInteger(htons(ip_header->frag_off) & IP_OFFMASK);
-  writer->WritePropertyName("ttl");
+  writer->WritePropertyName(kTtlProperty);
   writer->WriteInteger(ip_header->ttl);
-  writer->WritePropertyName("protocol");
+  writer->WritePropertyName(kProtocolProperty);
   WriteFriendlyStringOrInt<>(writer, kProtocolNames, ip_header->protocol);
   writer->EndPack();
   
-  writer->WritePropertyName("source");
+  writer->WritePropertyName(kSourceProperty);
   writer->BeginPack();
   writer->WriteString(Ip4Address(ip_header->saddr).ToString());
-  writer->WritePropertyName("destination");
+  writer->WritePropertyName(kDestinationProperty);
   writer->WriteString(Ip4Address(ip_header->daddr).ToString());
   writer->EndPack();
   
@@ -358,31 +396,31 @@ static size_t WriteTcpHeader(JsonWriter* writer, const tcphdr* tcp_header, size_
   assert(size_limit >= sizeof(tcp_header));
   
   writer->BeginObject();
-  writer->WritePropertyName("sourcePort");
+  writer->WritePropertyName(kSourcePortProperty);
   writer->BeginPack();
   writer->WriteInteger(htons(tcp_header->source));
-  writer->WritePropertyName("destPort");
+  writer->WritePropertyName(kDestPortProperty);
   writer->WriteInteger(htons(tcp_header->dest));
   writer->EndPack();
   
-  writer->WritePropertyName("seqNumber");
+  writer->WritePropertyName(kSeqNumberProperty);
   writer->BeginPack();
   writer->WriteInteger(htonl(tcp_header->seq));
   if (tcp_header->ack) {
-    writer->WritePropertyName("ackNumber");
+    writer->WritePropertyName(kAckNumberProperty);
     writer->WriteInteger(htonl(tcp_header->ack_seq));
   }
   writer->EndPack();
   
   
-  writer->WritePropertyName("flags");
+  writer->WritePropertyName(kFlagsProperty);
   writer->BeginPack();
   WriteTcpFlags(writer, tcp_header);
-  writer->WritePropertyName("windowSize");
+  writer->WritePropertyName(kWindowSizeProperty);
   writer->BeginPack();
   writer->WriteInteger(htons(tcp_header->window));
   if (tcp_header->urg) {
-    writer->WritePropertyName("urgentPointer");
+    writer->WritePropertyName(kUrgentPointerProperty);
     writer->WriteInteger(htons(tcp_header->urg_ptr));
   }
   writer->EndPack();
@@ -394,7 +432,7 @@ static size_t WriteTcpHeader(JsonWriter* writer, const tcphdr* tcp_header, size_
                                  std::max(static_cast<size_t>(20), total_header_size) - 20);
   
   if (options_size > 0) {
-    writer->WritePropertyName("options");
+    writer->WritePropertyName(kOptionsProperty);
     writer->BeginPack();
     writer->BeginArray();
     
@@ -468,9 +506,9 @@ static size_t WriteTcpHeader(JsonWriter* writer, const tcphdr* tcp_header, size_
 
 static size_t WriteUdpHeader(JsonWriter* writer, const udphdr* udp_header) {
   writer->BeginObject();
-  writer->WritePropertyName("sourcePort");
+  writer->WritePropertyName(kSourcePortProperty);
   writer->WriteInteger(htons(udp_header->source));
-  writer->WritePropertyName("destPort");
+  writer->WritePropertyName(kDestPortProperty);
   writer->WriteInteger(htons(udp_header->dest));
   writer->EndObject();
   return sizeof(udp_header);
@@ -478,10 +516,10 @@ static size_t WriteUdpHeader(JsonWriter* writer, const udphdr* udp_header) {
 
 static size_t WriteIcmpHeader(JsonWriter* writer, const icmphdr* icmp_header) {
   writer->BeginObject();
-  writer->WritePropertyName("type");
+  writer->WritePropertyName(kTypeProperty);
   writer->BeginPack();
   WriteFriendlyStringOrInt(writer, kIcmpTypeNames, icmp_header->type);
-  writer->WritePropertyName("code");
+  writer->WritePropertyName(kCodeProperty);
   WriteIcmpCode(writer, icmp_header->type, icmp_header->code);
   writer->EndPack();
   
@@ -492,21 +530,21 @@ static size_t WriteIcmpHeader(JsonWriter* writer, const icmphdr* icmp_header) {
     case ICMP_TIMESTAMPREPLY:
     case ICMP_ADDRESS:
     case ICMP_ADDRESSREPLY:
-      writer->WritePropertyName("identifier");
+      writer->WritePropertyName(kIdentifierProperty);
       writer->BeginPack();
       writer->WriteInteger(htons(icmp_header->un.echo.id));
-      writer->WritePropertyName("sequenceNumber");
+      writer->WritePropertyName(kSequenceNumberProperty);
       writer->WriteInteger(htons(icmp_header->un.echo.sequence));
       writer->EndPack();
       break;
       
     case ICMP_DEST_UNREACH:
-      writer->WritePropertyName("nextHopMtu");
+      writer->WritePropertyName(kNextHopMtuProperty);
       writer->WriteInteger(htons(icmp_header->un.frag.mtu));
       break;
       
     case ICMP_REDIRECT:
-      writer->WritePropertyName("gateway");
+      writer->WritePropertyName(kGatewayProperty);
       writer->WriteString(Ip4Address(icmp_header->un.gateway).ToString());
       break;
   }
@@ -522,7 +560,7 @@ void SerializePacket(JsonWriter* writer, const void* packet, size_t size) {
     const iphdr* header = static_cast<const iphdr*>(packet);
 
     if (header->ihl >= 5) {
-      writer->WritePropertyName("ip");
+      writer->WritePropertyName(kIpProperty);
 
       size_t next_header_offset = WriteIpHeader(writer, header);
       size_t header2_size = 0;
@@ -532,7 +570,7 @@ void SerializePacket(JsonWriter* writer, const void* packet, size_t size) {
         const tcphdr* tcp_header = reinterpret_cast<const tcphdr*>(
             static_cast<const char*>(packet) + next_header_offset);
         
-        writer->WritePropertyName("tcp");
+        writer->WritePropertyName(kTcpProperty);
         header2_size = WriteTcpHeader(writer, tcp_header, 
                                                 size - next_header_offset);
       }
@@ -542,7 +580,7 @@ void SerializePacket(JsonWriter* writer, const void* packet, size_t size) {
         const udphdr* udp_header = reinterpret_cast<const udphdr*>(
             static_cast<const char*>(packet) + next_header_offset);
         
-        writer->WritePropertyName("udp");
+        writer->WritePropertyName(kUdpProperty);
         header2_size = WriteUdpHeader(writer, udp_header);
       } 
       else if (header->protocol == kProtocolIcmp && 
@@ -551,14 +589,14 @@ void SerializePacket(JsonWriter* writer, const void* packet, size_t size) {
         const icmphdr* icmp_header = reinterpret_cast<const icmphdr*>(
             static_cast<const char*>(packet) + next_header_offset);
         
-        writer->WritePropertyName("icmp");
+        writer->WritePropertyName(kIcmpProperty);
         header2_size = WriteIcmpHeader(writer, icmp_header);
       }
     
       size_t data_offset = next_header_offset + header2_size;
       
       if (size > data_offset) {
-        writer->WritePropertyName("data");
+        writer->WritePropertyName(kDataProperty);
         SerializeBytes(writer, static_cast<const char*>(packet) + data_offset, 
                         size - data_offset);
       }
@@ -620,7 +658,7 @@ static bool ExpectCurrentPropertyName(JsonReader* reader, const char* property_n
     return Error(out_err, "expected property named %s, was token %s",
                  property_name, GetJsonTokenName(reader->token_type()));
   
-  if (reader->str_value() != string(property_name)) 
+  if (reader->str_piece() != property_name) 
     return Error(out_err, "expected property named '%s', instead it "
                  "was named '%s'", property_name, reader->str_value().c_str());
   
@@ -637,7 +675,7 @@ static bool ExpectNextPropertyName(JsonReader* reader, const char* property_name
 
 template<typename T>
 bool ExpectNextEnumProperty(JsonReader* reader, const char* property_name,
-                               const unordered_map<string, T>* lookup_table,
+                               const typename LookupTable<T>::Type* lookup_table,
                                T* out_result, string* out_err) {
   if (!ExpectNextPropertyName(reader, property_name, out_err))
     return false;
@@ -651,13 +689,13 @@ bool ExpectNextEnumProperty(JsonReader* reader, const char* property_name,
 
 template<typename T>
 bool ExpectNextEnumValue(JsonReader* reader, 
-                               const unordered_map<string, T>* lookup_table,
+                               const typename LookupTable<T>::Type* lookup_table,
                                T* out_result, string* out_err) {
   if (!ExpectNextJsonToken(reader, out_err))
     return false;
   
-  typename unordered_map<string, T>::const_iterator i = 
-      lookup_table->find(reader->str_value());
+  typename LookupTable<T>::Type::const_iterator i = 
+      lookup_table->find(reader->str_piece());
   
   if (i == lookup_table->end()) {
     return Error(out_err, "unknown value '%s'", 
@@ -780,16 +818,26 @@ static bool ExpectIp4Value(JsonReader* reader, uint32_t* out_result, string* out
   if (!ExpectNextJsonToken(reader, JSON_String, out_err))
     return false;
   
+  // inet_pton() wants a terminated string, so copy it somewhere that
+  // doesn't need to be allocated
+  StringPiece str_value = reader->str_piece();
+  char address[INET_ADDRSTRLEN];
+  if (str_value.size() >= sizeof(address)) {
+    return Error(out_err, "Unable to parse IPv4 address '%s'", 
+                 reader->str_value().c_str());
+  }
+  memcpy(address, str_value.data(), str_value.size());
+  address[str_value.size()] = '\0';
+  
   struct in_addr sock_addr;
-  const string& str_value = reader->str_value();
-  if (inet_pton(AF_INET, str_value.c_str(), &sock_addr) != 1) {
-    return Error(out_err, "Unable to parse IPv4 address '%s'", str_value.c_str());
+  if (inet_pton(AF_INET, address, &sock_addr) != 1) {
+    return Error(out_err, "Unable to parse IPv4 address '%s'", address);
   }
   *out_result = sock_addr.s_addr;
   return true;
 }
 
-bool DeserializeFlags(JsonReader* reader, const unordered_map<string, int>* lookup_table,
+bool DeserializeFlags(JsonReader* reader, const LookupTable<int>::Type* lookup_table,
                       int* out_result, string* out_err) {
   if (!ExpectNextJsonToken(reader, JSON_StartArray, out_err))
     return false;
@@ -803,8 +851,8 @@ bool DeserializeFlags(JsonReader* reader, const unordered_map<string, int>* look
     if (reader ->token_type() != JSON_String)
       return Error(out_err, "Unexpected token while deserializing flags");
     
-    unordered_map<string, int>::const_iterator i = 
-        lookup_table->find(reader->str_value());
+    LookupTable<int>::Type::const_iterator i = 
+        lookup_table->find(reader->str_piece());
         
     if (i == lookup_table->end()) 
       return Error(out_err, "Unknown flag %s", reader->str_value().c_str());
@@ -961,7 +1009,7 @@ static bool DeserializeTcpHeader(JsonReader* reader, vector<uint8_t>* dest_buffe
   if (!ExpectNextJsonToken(reader, JSON_PropertyName, out_err))
     return false;
   
-  if (reader->str_value() == "ackNumber") {
+  if (reader->str_piece() == "ackNumber") {
     if (!ExpectCurrentProperty<uint32_t>(reader, "ackNumber", &tcp_header.ack_seq, out_err))
       return false;
     if (!ExpectNextJsonToken(reader, JSON_PropertyName, out_err))
@@ -1110,34 +1158,14 @@ static bool DeserializeIcmpHeader(JsonReader* reader, vector<uint8_t>* dest_buff
   return true;
 }
 
-static void Add(const void* header, size_t size, uint32_t* result) {
-  const uint16_t* p = static_cast<const uint16_t*>(header);
-  const uint16_t* end = reinterpret_cast<const uint16_t*>(
-      static_cast<const uint8_t*>(header) + (size/2*2));
-  
-  for (; p < end; p++) {
-    *result += htons(*p);
-  }
-  
-  // if there is an odd number of bytes, we need to zero-pad
-  // the last byte
-  if (size & 0x01) {
-    *result += static_cast<const uint8_t*>(header)[size - 1] << 8;
-  }
-}
-
 static uint16_t ComputeIpChecksum(const void* pseudo_header, size_t pseudo_size,
-                           const void* header, size_t size) {
-  uint32_t result = 0;
-  Add(pseudo_header, pseudo_size, &result);
-  Add(header, size, &result);
-  return htons(static_cast<uint16_t>(~((result & 0xffff) + (result >> 16))));
+                                  const void* header, size_t size) {
+  uint32_t result = ChecksumAdd(0, pseudo_header, pseudo_size);
+  return ChecksumFinish(ChecksumAdd(result, header, size));
 }
 
 static uint16_t ComputeIpChecksum(const void* header, size_t size) {
-  uint32_t result = 0;
-  Add(header, size, &result);
-  return htons(static_cast<uint16_t>(~((result & 0xffff) + (result >> 16))));
+  return ChecksumFinish(ChecksumAdd(0, header, size));
 }
 
 struct pseudo_header {
@@ -1194,10 +1222,10 @@ bool DeserializePacket(JsonReader* reader, vector<uint8_t>* dest_buffer, string*
     if (!ExpectNextJsonToken(reader, JSON_String, out_err))
       return false;
     
-    string data_type = reader->str_value();
-    if (data_type != "text" && data_type != "hex") {
+    bool is_hex = reader->str_piece() == "hex";
+    if (!is_hex && reader->str_piece() != "text") {
       return Error(out_err, "data type must be 'text' or 'hex', was '%s'", 
-                  data_type.c_str());
+                  reader->str_value().c_str());
     }
     
     if (!ExpectNextPropertyName(reader, "data", out_err))
@@ -1218,12 +1246,13 @@ bool DeserializePacket(JsonReader* reader, vector<uint8_t>* dest_buffer, string*
                     GetJsonTokenName(reader->token_type()));
       }
       
-      data_str.append(reader->str_value());
+      StringPiece data = reader->str_piece();
+      data_str.append(data.data(), data.size());
     }
-    if (data_type == "text") {
-      AppendVectorU8(dest_buffer, data_str.c_str(), data_str.size());
-    } else if (data_type == "hex") {
+    if (is_hex) {
       ParseHex(data_str.c_str(), dest_buffer);
+    } else {
+      AppendVectorU8(dest_buffer, data_str.c_str(), data_str.size());
     }
     
     if (!ExpectNextJsonToken(reader, JSON_EndObject, out_err))
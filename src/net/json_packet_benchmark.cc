@@ -0,0 +1,79 @@
+// Measures how fast SerializePacket writes JSON the way PacketLogger does
+// (indented, through a 4 KB BufferedOutputStream). The packets come from a
+// packet log such as one in samples/packet_logs, and the output is thrown
+// away, so only the serializer and JsonWriter are measured.
+
+#include "base/common.h"
+#include "base/json_writer.h"
+#include "base/stream.h"
+#include "net/json_packet.h"
+#include "net/packet_log_loader.h"
+
+#include <stdio.h>
+#include <time.h>
+
+using namespace cheaproute;
+
+namespace {
+
+// Write at least this much in total
+const size_t kMinBytesWritten = 256 * 1024 * 1024;
+
+double Now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+}
+
+class NullOutputStream : public OutputStream {
+public:
+  NullOutputStream() : bytes_written_(0) {}
+
+  void Write(const void* buf, size_t count) { bytes_written_ += count; }
+  void Flush() {}
+
+  size_t bytes_written() const { return bytes_written_; }
+
+private:
+  size_t bytes_written_;
+};
+
+}
+
+int main(int argc, const char* const argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <packet_log_file>\n", argv[0]);
+    return -1;
+  }
+  vector<vector<uint8_t> > packets;
+  {
+    MappedFileInputStream log(argv[1]);
+    string err;
+    if (!LoadPacketLog(log.data(), log.size(), 1, &packets, &err))
+      AbortWithMessage("Couldn't load %s: %s", argv[1], err.c_str());
+  }
+  if (packets.empty())
+    AbortWithMessage("%s has no packets", argv[1]);
+
+  NullOutputStream* output = new NullOutputStream();
+  JsonWriter writer(shared_ptr<BufferedOutputStream>(
+      new BufferedOutputStream(shared_ptr<OutputStream>(output), 4096)),
+      JsonWriterFlags_Indent);
+
+  size_t packet_count = 0;
+  double start = Now();
+  while (output->bytes_written() < kMinBytesWritten) {
+    for (size_t i = 0; i < packets.size(); i++) {
+      SerializePacket(&writer, &packets[i][0], packets[i].size());
+      writer.Flush();
+    }
+    packet_count += packets.size();
+  }
+  double elapsed = Now() - start;
+
+  printf("%zu packets in %.3f s: %.1f MB/s, %.1f ns per packet\n",
+         packet_count, elapsed,
+         static_cast<double>(output->bytes_written()) / elapsed / 1e6,
+         elapsed * 1e9 / static_cast<double>(packet_count));
+  return 0;
+}
@@ -71,17 +71,34 @@ static Ip4AddressInfo GetIp4AddressInfo(const ifaddrmsg* ifmsg, const NetlinkAtt
   return result;
 }
 
-NetInterfaceInfo* NetlinkMonitor::GetOrCreateInterface(int index) {
+shared_ptr<const NetInterfaceInfo> NetlinkMonitor::GetInterface(int index) const {
+  unordered_map<int, shared_ptr<const NetInterfaceInfo> >::const_iterator i = 
+    interfaces_by_index_.find(index);
+  if (i == interfaces_by_index_.end())
+    return shared_ptr<const NetInterfaceInfo>();
+  return i->second;
+}
+
+shared_ptr<const NetInterfaceInfo> NetlinkMonitor::GetOrCreateInterface(int index) {
   
-  unordered_map<int, shared_ptr<NetInterfaceInfo> >::iterator i = 
+  unordered_map<int, shared_ptr<const NetInterfaceInfo> >::iterator i = 
     interfaces_by_index_.find(index);
   
   if (i == interfaces_by_index_.end()) {
     i = interfaces_by_index_.insert(make_pair(index, 
-                 shared_ptr<NetInterfaceInfo>(new NetInterfaceInfo(index)))).first;
+                 shared_ptr<const NetInterfaceInfo>(new NetInterfaceInfo(index)))).first;
   }
 
-  return i->second.get();
+  return i->second;
+}
+
+NetInterfaceInfo* NetlinkMonitor::UpdateInterface(
+    shared_ptr<const NetInterfaceInfo>* info) {
+  NetInterfaceInfo* updated = new NetInterfaceInfo(**info);
+  updated->version++;
+  info->reset(updated);
+  interfaces_by_index_[updated->index] = *info;
+  return updated;
 }
 
 namespace {
@@ -116,26 +133,28 @@ void NetlinkMonitor::HandleRead(int flags) {
           
           const NetlinkAttributeMap& attr = receiver.attributes();
           
-          NetInterfaceInfo* if_info = GetOrCreateInterface(ifmsg->ifi_index);
+          shared_ptr<const NetInterfaceInfo> if_info = 
+              GetOrCreateInterface(ifmsg->ifi_index);
           
           NetlinkAttributeMap::const_iterator i;
           if (!if_info->is_public && (i = attr.find(IFLA_IFNAME)) != attr.end()) {
-            if_info->name = string(&i->second[0]);
-            if_info->is_public = true;
+            NetInterfaceInfo* updated = UpdateInterface(&if_info);
+            updated->name = string(&i->second[0]);
+            updated->is_public = true;
             broadcaster_->Broadcast(
-              bind(&NetlinkListener::InterfaceCreated, _1, *if_info));
+              bind(&NetlinkListener::InterfaceCreated, _1, cref(*if_info)));
           }
           
           bool link_active = ifmsg->ifi_flags & IFF_UP;
           if (link_active != if_info->link_active) {
-            if_info->link_active = link_active;
+            UpdateInterface(&if_info)->link_active = link_active;
             if (if_info->is_public) {
               if (if_info->link_active) {
                 broadcaster_->Broadcast(
-                  bind(&NetlinkListener::LinkUp, _1, *if_info));
+                  bind(&NetlinkListener::LinkUp, _1, cref(*if_info)));
               } else {
                 broadcaster_->Broadcast(
-                  bind(&NetlinkListener::LinkDown, _1, *if_info));
+                  bind(&NetlinkListener::LinkDown, _1, cref(*if_info)));
               }
             }
           }
@@ -146,7 +165,8 @@ void NetlinkMonitor::HandleRead(int flags) {
         case RTM_DELADDR:
         {
           const ifaddrmsg* ifmsg = receiver.ifaddrmsg();
-          NetInterfaceInfo* if_info = GetOrCreateInterface(ifmsg->ifa_index);
+          shared_ptr<const NetInterfaceInfo> if_info = 
+              GetOrCreateInterface(ifmsg->ifa_index);
           const NetlinkAttributeMap& attributes = receiver.attributes();
           
           switch (ifmsg->ifa_family) {
@@ -156,18 +176,24 @@ void NetlinkMonitor::HandleRead(int flags) {
               switch (nh->nlmsg_type) {
                 
                 case RTM_NEWADDR:
-                  if (if_info->ip4_addresses.insert(address_info).second &&
-                      if_info->is_public) {
-                    broadcaster_->Broadcast(
-                        bind(&NetlinkListener::Ip4AddressAdded, _1, *if_info, address_info));
+                  if (!if_info->ip4_addresses.count(address_info)) {
+                    UpdateInterface(&if_info)->ip4_addresses.insert(address_info);
+                    if (if_info->is_public) {
+                      broadcaster_->Broadcast(
+                          bind(&NetlinkListener::Ip4AddressAdded, _1, 
+                               cref(*if_info), cref(address_info)));
+                    }
                   }
                   break;
                   
                 case RTM_DELADDR:
-                  if (if_info->ip4_addresses.erase(address_info) && 
-                      if_info->is_public) {
-                    broadcaster_->Broadcast(
-                      bind(&NetlinkListener::Ip4AddressRemoved, _1, *if_info, address_info));
+                  if (if_info->ip4_addresses.count(address_info)) {
+                    UpdateInterface(&if_info)->ip4_addresses.erase(address_info);
+                    if (if_info->is_public) {
+                      broadcaster_->Broadcast(
+                        bind(&NetlinkListener::Ip4AddressRemoved, _1, 
+                             cref(*if_info), cref(address_info)));
+                    }
                   }
                   break;
               }
@@ -178,18 +204,24 @@ void NetlinkMonitor::HandleRead(int flags) {
               switch (nh->nlmsg_type) {
                 
                 case RTM_NEWADDR:
-                  if (if_info->ip6_addresses.insert(address).second && 
-                      if_info->is_public) {
-                    broadcaster_->Broadcast(
-                      bind(&NetlinkListener::Ip6AddressAdded, _1, *if_info, address));
+                  if (!if_info->ip6_addresses.count(address)) {
+                    UpdateInterface(&if_info)->ip6_addresses.insert(address);
+                    if (if_info->is_public) {
+                      broadcaster_->Broadcast(
+                        bind(&NetlinkListener::Ip6AddressAdded, _1, 
+                             cref(*if_info), cref(address)));
+                    }
                   }
                   break;
                   
                 case RTM_DELADDR:
-                  if (if_info->ip6_addresses.erase(address) &&
-                      if_info->is_public) {
-                    broadcaster_->Broadcast(
-                      bind(&NetlinkListener::Ip6AddressRemoved, _1, *if_info, address));
+                  if (if_info->ip6_addresses.count(address)) {
+                    UpdateInterface(&if_info)->ip6_addresses.erase(address);
+                    if (if_info->is_public) {
+                      broadcaster_->Broadcast(
+                        bind(&NetlinkListener::Ip6AddressRemoved, _1, 
+                             cref(*if_info), cref(address)));
+                    }
                   }
                   break;
               }
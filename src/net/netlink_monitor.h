@@ -14,14 +14,20 @@ namespace cheaproute
 class EventLoop;
 class IoTask;
 
+// A snapshot of an interface's state. NetlinkMonitor never changes a
+// snapshot once listeners have seen it; each change is published as a new
+// copy with a higher version, so a listener can hang on to a snapshot
+// (through NetlinkMonitor::GetInterface()) for as long as it likes.
 struct NetInterfaceInfo {
   explicit NetInterfaceInfo(int index)
     : index(index),
+      version(0),
       link_active(false),
       is_public(false) {
   }
     
   const int index;
+  uint64_t version;
   string name;
   bool link_active;
   bool is_public;
@@ -53,8 +59,14 @@ public:
     return broadcaster_->AddListener(listener);
   }
   
+  // Returns the latest snapshot of an interface, or NULL if it isn't known
+  shared_ptr<const NetInterfaceInfo> GetInterface(int index) const;
+  
 private:
-  NetInterfaceInfo* GetOrCreateInterface(int index);
+  shared_ptr<const NetInterfaceInfo> GetOrCreateInterface(int index);
+  // Replaces *info with a new version of itself and returns it for
+  // editing, which must be done before it's broadcast
+  NetInterfaceInfo* UpdateInterface(shared_ptr<const NetInterfaceInfo>* info);
   void HandleRead(int flags);
   void BeginLinkQuery();
   void BeginAddrQuery(int address_family);
@@ -70,7 +82,6 @@ private:
   int sequence_number_;
   int last_received_seq_;
   deque<vector<uint8_t> > unsent_messages_;
-  unordered_map<string, shared_ptr<NetInterfaceInfo> > interfaces_by_name_;
-  unordered_map<int, shared_ptr<NetInterfaceInfo> > interfaces_by_index_;
+  unordered_map<int, shared_ptr<const NetInterfaceInfo> > interfaces_by_index_;
 };
 }
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "base/common.h"
+#include "net/packet_buffer.h"
+
+namespace cheaproute {
+
+// The packets a TunQueue read during a single wakeup. The batch itself is
+// reused across wakeups; listeners that want to hold on to a packet past
+// the callback should copy its PacketRef.
+class PacketBatch {
+public:
+  explicit PacketBatch(size_t capacity) {
+    Reserve(capacity);
+  }
+  
+  // Discards all packets and makes room for capacity packets
+  void Reserve(size_t capacity) {
+    packets_.clear();
+    packets_.reserve(capacity);
+    capacity_ = capacity;
+  }
+  
+  size_t capacity() const { return capacity_; }
+  
+  size_t size() const { return packets_.size(); }
+  bool empty() const { return packets_.empty(); }
+  bool full() const { return packets_.size() == capacity_; }
+  
+  const PacketRef& packet(size_t i) const { return packets_[i]; }
+  const void* data(size_t i) const { return packets_[i].data(); }
+  size_t packet_size(size_t i) const { return packets_[i].size(); }
+  
+  void Clear() { packets_.clear(); }
+  
+  void Push(const PacketRef& packet) {
+    assert(!full());
+    packets_.push_back(packet);
+  }
+  
+private:
+  PacketBatch(const PacketBatch& other);
+  
+  size_t capacity_;
+  vector<PacketRef> packets_;
+};
+
+}
@@ -0,0 +1,111 @@
+#include "net/packet_buffer.h"
+
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
+
+namespace cheaproute {
+
+static size_t RoundUpToCacheLine(size_t size) {
+  return (size + kCacheLineSize - 1) & ~(kCacheLineSize - 1);
+}
+
+PacketBufferPool::PacketBufferPool(size_t buffer_size, size_t buffers_per_slab,
+                                   size_t max_buffers, size_t headroom)
+  : buffer_size_(buffer_size),
+    headroom_(headroom),
+    buffers_per_slab_(buffers_per_slab),
+    max_buffers_(max_buffers),
+    total_buffers_(0),
+    free_buffers_(0),
+    free_list_(NULL) {
+  assert(buffers_per_slab > 0);
+}
+
+PacketBufferPool::~PacketBufferPool() {
+  assert(free_buffers_ == total_buffers_);
+  for (size_t i = 0; i < slabs_.size(); i++) {
+    free(slabs_[i]);
+  }
+}
+
+bool PacketBufferPool::AddSlab() {
+  size_t buffer_count = buffers_per_slab_;
+  if (max_buffers_) {
+    buffer_count = std::min(buffer_count, max_buffers_ - total_buffers_);
+    if (buffer_count == 0)
+      return false;
+  }
+  
+  // Each buffer is laid out as [header][headroom][data], with the header
+  // and the data starting on their own cache line
+  size_t header_size = RoundUpToCacheLine(sizeof(PacketBuffer)) + 
+                       RoundUpToCacheLine(headroom_);
+  size_t stride = header_size + RoundUpToCacheLine(buffer_size_);
+  
+  void* slab = NULL;
+  int result = posix_memalign(&slab, kCacheLineSize, stride * buffer_count);
+  if (result != 0)
+    AbortWithPosixError(result, "Unable to allocate packet buffer slab");
+  slabs_.push_back(slab);
+  
+  uint8_t* p = static_cast<uint8_t*>(slab);
+  for (size_t i = 0; i < buffer_count; i++, p += stride) {
+    PacketBuffer* buffer = new (p) PacketBuffer();
+    buffer->pool_ = this;
+    buffer->data_ = p + header_size;
+    buffer->capacity_ = buffer_size_;
+    buffer->size_ = 0;
+    buffer->ref_count_ = 0;
+    buffer->next_free_ = free_list_;
+    free_list_ = buffer;
+  }
+  total_buffers_ += buffer_count;
+  free_buffers_ += buffer_count;
+  return true;
+}
+
+PacketRef PacketBufferPool::Allocate() {
+  MutexLock lock(&mutex_);
+  return AllocateLocked();
+}
+
+PacketRef PacketBufferPool::Allocate(const function<void()>& on_available) {
+  MutexLock lock(&mutex_);
+  PacketRef result = AllocateLocked();
+  if (result.empty())
+    on_available_ = on_available;
+  return result;
+}
+
+PacketRef PacketBufferPool::AllocateLocked() {
+  if (!free_list_ && !AddSlab())
+    return PacketRef();
+  
+  PacketBuffer* buffer = free_list_;
+  free_list_ = buffer->next_free_;
+  free_buffers_--;
+  
+  buffer->next_free_ = NULL;
+  buffer->size_ = 0;
+  buffer->gso_ = GsoInfo();
+  buffer->ref_count_ = 1;
+  return PacketRef(buffer);
+}
+
+void PacketBufferPool::Free(PacketBuffer* buffer) {
+  function<void()> on_available;
+  {
+    MutexLock lock(&mutex_);
+    buffer->next_free_ = free_list_;
+    free_list_ = buffer;
+    free_buffers_++;
+    on_available.swap(on_available_);
+  }
+  
+  // Outside the lock, so it can allocate
+  if (on_available)
+    on_available();
+}
+
+}
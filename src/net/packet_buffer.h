@@ -0,0 +1,201 @@
+#pragma once
+
+#include "base/common.h"
+#include "base/mutex.h"
+
+namespace cheaproute {
+
+class PacketBufferPool;
+
+const size_t kCacheLineSize = 64;
+
+enum GsoType {
+  GsoType_None,
+  GsoType_Tcp4,
+  GsoType_Tcp6
+};
+
+// Offload metadata that comes with a packet read from (or going to) a TUN
+// device with IFF_VNET_HDR enabled. A packet with a GsoType other than
+// GsoType_None is a coalesced super-packet that still has to be split into
+// segment_size pieces before it goes on the wire.
+struct GsoInfo {
+  GsoInfo()
+    : type(GsoType_None),
+      ecn(false),
+      needs_checksum(false),
+      segment_size(0),
+      header_size(0),
+      checksum_start(0),
+      checksum_offset(0) {
+  }
+  
+  // True if the packet can't be handed to something that expects a
+  // plain, fully checksummed IP packet
+  bool needs_processing() const {
+    return type != GsoType_None || needs_checksum;
+  }
+  
+  GsoType type;
+  bool ecn;
+  // The transport checksum only covers the pseudo-header; the rest has to
+  // be summed from checksum_start and stored at checksum_start + checksum_offset
+  bool needs_checksum;
+  uint16_t segment_size;
+  uint16_t header_size;
+  uint16_t checksum_start;
+  uint16_t checksum_offset;
+};
+
+// A fixed-size, reference-counted packet buffer. Buffers are carved out of
+// a PacketBufferPool's slabs and go back to the pool's free list when the
+// last PacketRef pointing at them is released, so a packet can be shared by
+// any number of listeners and queues (on any thread) without being copied.
+class PacketBuffer {
+public:
+  uint8_t* data() { return data_; }
+  const uint8_t* data() const { return data_; }
+  
+  size_t size() const { return size_; }
+  void set_size(size_t size) {
+    assert(size <= capacity_);
+    size_ = size;
+  }
+  size_t capacity() const { return capacity_; }
+  
+  // How many bytes in front of data() belong to the buffer too, for
+  // headers that are read or written along with the packet
+  size_t headroom() const;
+  
+  const GsoInfo& gso() const { return gso_; }
+  void set_gso(const GsoInfo& gso) { gso_ = gso; }
+  
+private:
+  friend class PacketBufferPool;
+  friend class PacketRef;
+  
+  PacketBuffer() {}
+  PacketBuffer(const PacketBuffer& other);
+  
+  void AddRef() {
+    __sync_fetch_and_add(&ref_count_, 1);
+  }
+  void Release();
+  
+  PacketBufferPool* pool_;
+  PacketBuffer* next_free_;
+  uint8_t* data_;
+  size_t size_;
+  size_t capacity_;
+  int ref_count_;
+  GsoInfo gso_;
+};
+
+// A smart pointer to a PacketBuffer
+class PacketRef {
+public:
+  PacketRef()
+      : buffer_(NULL) {
+  }
+  PacketRef(const PacketRef& other)
+      : buffer_(other.buffer_) {
+    if (buffer_)
+      buffer_->AddRef();
+  }
+  ~PacketRef() {
+    if (buffer_)
+      buffer_->Release();
+  }
+  
+  PacketRef& operator=(const PacketRef& other) {
+    PacketRef(other).swap(*this);
+    return *this;
+  }
+  
+  void reset() {
+    PacketRef().swap(*this);
+  }
+  void swap(PacketRef& other) {
+    PacketBuffer* tmp = other.buffer_;
+    other.buffer_ = buffer_;
+    buffer_ = tmp;
+  }
+  
+  PacketBuffer* get() const { return buffer_; }
+  PacketBuffer* operator->() const {
+    assert(buffer_);
+    return buffer_; 
+  }
+  
+  const void* data() const { return buffer_->data(); }
+  size_t size() const { return buffer_->size(); }
+  
+  bool empty() const { return buffer_ == NULL; }
+  
+private:
+  friend class PacketBufferPool;
+  
+  // Takes ownership of the initial reference held by the pool
+  explicit PacketRef(PacketBuffer* buffer)
+      : buffer_(buffer) {
+  }
+  
+  PacketBuffer* buffer_;
+};
+
+// Hands out cache-line aligned buffers of a single size. Memory is allocated
+// a slab at a time and recycled through a free list, so the steady state
+// involves no calls to malloc. The pool must outlive every buffer it has
+// handed out.
+class PacketBufferPool {
+public:
+  // max_buffers limits how large the pool may grow; 0 means no limit
+  PacketBufferPool(size_t buffer_size, size_t buffers_per_slab, 
+                   size_t max_buffers, size_t headroom = 0);
+  ~PacketBufferPool();
+  
+  // Returns an empty PacketRef if the pool is exhausted
+  PacketRef Allocate();
+  
+  // Like Allocate(), but if the pool is exhausted, on_available is called
+  // once the next time a buffer comes back, on whichever thread releases
+  // it. For readers that stop reading until there's somewhere to put the
+  // packets. A later call replaces an on_available that hasn't been called
+  // yet.
+  PacketRef Allocate(const function<void()>& on_available);
+  
+  size_t buffer_size() const { return buffer_size_; }
+  size_t headroom() const { return headroom_; }
+  size_t total_buffers() const { return total_buffers_; }
+  size_t free_buffers() const { return free_buffers_; }
+  
+private:
+  friend class PacketBuffer;
+  PacketBufferPool(const PacketBufferPool& other);
+  
+  bool AddSlab();
+  PacketRef AllocateLocked();
+  void Free(PacketBuffer* buffer);
+  
+  size_t buffer_size_;
+  size_t headroom_;
+  size_t buffers_per_slab_;
+  size_t max_buffers_;
+  size_t total_buffers_;
+  size_t free_buffers_;
+  PacketBuffer* free_list_;
+  vector<void*> slabs_;
+  function<void()> on_available_;
+  Mutex mutex_;
+};
+
+inline size_t PacketBuffer::headroom() const {
+  return pool_->headroom();
+}
+
+inline void PacketBuffer::Release() {
+  if (__sync_sub_and_fetch(&ref_count_, 1) == 0)
+    pool_->Free(this);
+}
+
+}
@@ -0,0 +1,104 @@
+#include "net/packet_buffer.h"
+
+#include "gtest/gtest.h"
+
+namespace cheaproute {
+
+TEST(PacketBufferPoolTest, BuffersAreCacheLineAligned) {
+  PacketBufferPool pool(1500, 4, 0);
+  PacketRef a = pool.Allocate();
+  PacketRef b = pool.Allocate();
+  ASSERT_FALSE(a.empty());
+  ASSERT_FALSE(b.empty());
+  ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(a->data()) % kCacheLineSize);
+  ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(b->data()) % kCacheLineSize);
+  ASSERT_EQ(1500u, a->capacity());
+  ASSERT_EQ(0u, a->size());
+}
+
+TEST(PacketBufferPoolTest, HeadroomPrecedesAlignedData) {
+  PacketBufferPool pool(256, 4, 0, 10);
+  PacketRef a = pool.Allocate();
+  PacketRef b = pool.Allocate();
+  ASSERT_EQ(10u, a->headroom());
+  ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(a->data()) % kCacheLineSize);
+  
+  // Writing the whole headroom and data of one buffer leaves the other alone
+  memset(b->data() - b->headroom(), 0xaa, b->headroom() + b->capacity());
+  memset(a->data() - a->headroom(), 0x55, a->headroom() + a->capacity());
+  ASSERT_EQ(0xaa, b->data()[0]);
+  ASSERT_EQ(0xaa, b->data()[-10]);
+  ASSERT_EQ(0xaa, b->data()[255]);
+}
+
+TEST(PacketBufferPoolTest, LastReferenceReturnsBufferToPool) {
+  PacketBufferPool pool(64, 4, 0);
+  PacketRef a = pool.Allocate();
+  ASSERT_EQ(4u, pool.total_buffers());
+  ASSERT_EQ(3u, pool.free_buffers());
+  
+  a->set_size(3);
+  memcpy(a->data(), "abc", 3);
+  {
+    PacketRef b = a;
+    PacketRef c;
+    c = b;
+    a.reset();
+    ASSERT_EQ(3u, pool.free_buffers());
+    ASSERT_EQ(0, memcmp("abc", c.data(), c.size()));
+  }
+  ASSERT_EQ(4u, pool.free_buffers());
+}
+
+TEST(PacketBufferPoolTest, RecyclesWithoutGrowing) {
+  PacketBufferPool pool(64, 2, 0);
+  for (int i = 0; i < 100; i++) {
+    PacketRef a = pool.Allocate();
+    PacketRef b = pool.Allocate();
+    ASSERT_NE(a.get(), b.get());
+  }
+  ASSERT_EQ(2u, pool.total_buffers());
+}
+
+TEST(PacketBufferPoolTest, GrowsBySlabUntilLimit) {
+  PacketBufferPool pool(64, 2, 3);
+  PacketRef a = pool.Allocate();
+  PacketRef b = pool.Allocate();
+  PacketRef c = pool.Allocate();
+  ASSERT_EQ(3u, pool.total_buffers());
+  ASSERT_FALSE(c.empty());
+  
+  PacketRef d = pool.Allocate();
+  ASSERT_TRUE(d.empty());
+  
+  b.reset();
+  d = pool.Allocate();
+  ASSERT_FALSE(d.empty());
+}
+
+static void CountCall(int* calls) {
+  (*calls)++;
+}
+
+TEST(PacketBufferPoolTest, NotifiesOnceWhenExhaustedPoolGetsBufferBack) {
+  PacketBufferPool pool(64, 2, 2);
+  int calls = 0;
+  PacketRef a = pool.Allocate(bind(&CountCall, &calls));
+  PacketRef b = pool.Allocate(bind(&CountCall, &calls));
+  ASSERT_FALSE(b.empty());
+  
+  // Only an allocation that fails asks to be told
+  a.reset();
+  ASSERT_EQ(0, calls);
+  a = pool.Allocate();
+  
+  PacketRef c = pool.Allocate(bind(&CountCall, &calls));
+  ASSERT_TRUE(c.empty());
+  ASSERT_EQ(0, calls);
+  a.reset();
+  ASSERT_EQ(1, calls);
+  b.reset();
+  ASSERT_EQ(1, calls);
+}
+
+}
@@ -0,0 +1,116 @@
+#include "net/packet_log_loader.h"
+
+#include "base/json_array_index.h"
+#include "base/json_reader.h"
+#include "base/thread.h"
+#include "net/json_packet.h"
+
+#include <algorithm>
+
+namespace cheaproute {
+
+namespace {
+
+// Packets are claimed this many at a time, which is few enough to keep
+// every thread busy until the end and many enough that claiming is rare
+const size_t kPacketsPerChunk = 256;
+
+class PacketLogLoader {
+public:
+  PacketLogLoader(const JsonArrayIndex* index, 
+                  vector<vector<uint8_t> >* packets)
+    : index_(index),
+      packets_(packets),
+      next_chunk_(0) {
+    chunk_count_ = (index->element_count() + kPacketsPerChunk - 1) / 
+                   kPacketsPerChunk;
+    chunk_errors_.resize(chunk_count_);
+    packets_->resize(index->element_count());
+  }
+  
+  size_t chunk_count() const { return chunk_count_; }
+  
+  // Run on every thread; returns once there's nothing left to claim
+  void Run() {
+    while (true) {
+      size_t chunk = __sync_fetch_and_add(&next_chunk_, 1);
+      if (chunk >= chunk_count_)
+        return;
+      LoadChunk(chunk);
+    }
+  }
+  
+  // The error from the first bad packet, if there was one
+  bool GetError(string* out_err) const {
+    for (size_t i = 0; i < chunk_count_; i++) {
+      if (!chunk_errors_[i].empty()) {
+        *out_err = chunk_errors_[i];
+        return true;
+      }
+    }
+    return false;
+  }
+  
+private:
+  void LoadChunk(size_t chunk) {
+    size_t begin = chunk * kPacketsPerChunk;
+    size_t end = std::min(begin + kPacketsPerChunk, index_->element_count());
+    string error;
+    for (size_t i = begin; i < end; i++) {
+      shared_ptr<JsonReader> reader = index_->ReadElement(i);
+      if (!reader->Next() || 
+          !DeserializePacket(reader.get(), &(*packets_)[i], &error)) {
+        if (error.empty())
+          error = "Unexpected end of packet";
+        chunk_errors_[chunk] = StrPrintf("Error reading packet %zu: %s", 
+                                         i, error.c_str());
+        return;
+      }
+    }
+  }
+  
+  const JsonArrayIndex* index_;
+  vector<vector<uint8_t> >* packets_;
+  size_t chunk_count_;
+  size_t next_chunk_;
+  // Each thread only writes the entries for the chunks it claimed
+  vector<string> chunk_errors_;
+};
+
+}
+
+bool LoadPacketLog(const void* data, size_t size, size_t thread_count,
+                   vector<vector<uint8_t> >* out_packets, string* out_err) {
+  JsonArrayIndex index;
+  if (!index.Build(static_cast<const uint8_t*>(data), size)) {
+    *out_err = "Expected an array of packets at the top of the packet log";
+    return false;
+  }
+  
+  out_packets->clear();
+  PacketLogLoader loader(&index, out_packets);
+  
+  // This thread works too
+  size_t extra_thread_count = std::min(thread_count, loader.chunk_count());
+  if (extra_thread_count > 0)
+    extra_thread_count--;
+  vector<shared_ptr<Thread> > threads;
+  for (size_t i = 0; i < extra_thread_count; i++) {
+    shared_ptr<Thread> thread(new Thread(bind(&PacketLogLoader::Run, 
+                                              &loader)));
+    thread->Start();
+    threads.push_back(thread);
+  }
+  loader.Run();
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i]->Join();
+  }
+  
+  if (loader.GetError(out_err)) {
+    out_packets->clear();
+    return false;
+  }
+  return true;
+}
+
+}
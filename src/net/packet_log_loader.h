@@ -0,0 +1,16 @@
+#pragma once
+
+#include "base/common.h"
+
+namespace cheaproute {
+  
+  // Deserializes a whole packet log (the array of packets PacketLogger
+  // writes) that's in memory, such as a mapped file, on thread_count
+  // threads. The log is indexed first (see JsonArrayIndex), then the
+  // threads take turns claiming runs of packets, each packet being read
+  // with its own JsonReader. out_packets ends up in the same order as the
+  // log. If any packet can't be deserialized, returns false and out_err
+  // describes the first bad packet in the log.
+  bool LoadPacketLog(const void* data, size_t size, size_t thread_count,
+                     vector<vector<uint8_t> >* out_packets, string* out_err);
+}
@@ -0,0 +1,91 @@
+#include "net/packet_log_loader.h"
+#include "gtest/gtest.h"
+
+#include "base/json_reader.h"
+#include "net/json_packet.h"
+#include <test_util/stream.h>
+
+namespace cheaproute {
+
+static const char* kPackets[] = {
+  "{\"ip\":{\"version\":4,\"tos\":0,\"id\":1642,\"flags\":[\"DF\"],"
+    "\"fragmentOffset\":0,\"ttl\":64,\"protocol\":\"TCP\","
+    "\"source\":\"192.168.1.125\",\"destination\":\"72.14.204.147\"},"
+  "\"tcp\":{\"sourcePort\":39570,\"destPort\":80,\"seqNumber\":1628108555,"
+    "\"ackNumber\":2245680723,\"flags\":[\"ACK\",\"PSH\"],\"windowSize\":115},"
+  "\"data\":{\"type\":\"text\",\"data\":[\"GET / HTTP/1.1\\r\\n\",\"\\r\\n\"]}}",
+  
+  "{\"ip\":{\"version\":4,\"tos\":0,\"id\":54260,\"flags\":[],"
+    "\"fragmentOffset\":0,\"ttl\":64,\"protocol\":\"UDP\","
+    "\"source\":\"192.168.1.132\",\"destination\":\"8.8.8.8\"},"
+  "\"udp\":{\"sourcePort\":51680,\"destPort\":53},"
+  "\"data\":{\"type\":\"hex\",\"data\":["
+    "\"45 35 01 00 00 01 00 00  00 00 00 00 03 77 77 77\","
+    "\"06 67 6f 6f 67 6c 65 03  63 6f 6d 00 00 01 00 01\"]}}"
+};
+
+// A log of packet_count packets, cycling through kPackets
+static string CreatePacketLog(size_t packet_count) {
+  string result = "[";
+  for (size_t i = 0; i < packet_count; i++) {
+    if (i > 0)
+      result += ",\n";
+    result += kPackets[i % ArrayLength(kPackets)];
+  }
+  return result + "]";
+}
+
+// What a single JsonReader makes of the log
+static vector<vector<uint8_t> > LoadSequentially(const string& log) {
+  vector<vector<uint8_t> > result;
+  JsonReader reader(CreateBufferedInputStream(log.c_str()));
+  EXPECT_TRUE(reader.Next());
+  string error;
+  while (reader.Next() && reader.token_type() != JSON_EndArray) {
+    result.push_back(vector<uint8_t>());
+    EXPECT_TRUE(DeserializePacket(&reader, &result.back(), &error)) << error;
+  }
+  return result;
+}
+
+TEST(PacketLogLoaderTest, MatchesSequentialLoading) {
+  size_t packet_counts[] = { 0, 1, 255, 256, 257, 2000 };
+  for (size_t i = 0; i < ArrayLength(packet_counts); i++) {
+    string log = CreatePacketLog(packet_counts[i]);
+    vector<vector<uint8_t> > expected = LoadSequentially(log);
+    ASSERT_EQ(packet_counts[i], expected.size());
+    
+    for (size_t thread_count = 1; thread_count <= 4; thread_count++) {
+      vector<vector<uint8_t> > packets;
+      string error;
+      ASSERT_TRUE(LoadPacketLog(log.data(), log.size(), thread_count, 
+                                &packets, &error)) << error;
+      ASSERT_TRUE(expected == packets);
+    }
+  }
+}
+
+TEST(PacketLogLoaderTest, ReportsFirstBadPacket) {
+  string log = CreatePacketLog(1000);
+  // Break packets 300 and 900
+  for (size_t i = 0, pos = 0; i <= 900; i++) {
+    pos = log.find("\"ip\"", pos + 1);
+    if (i == 300 || i == 900)
+      log[pos + 1] = 'x';
+  }
+  
+  for (size_t thread_count = 1; thread_count <= 4; thread_count++) {
+    vector<vector<uint8_t> > packets;
+    string error;
+    ASSERT_FALSE(LoadPacketLog(log.data(), log.size(), thread_count, 
+                               &packets, &error));
+    ASSERT_EQ(0U, error.find("Error reading packet 300:")) << error;
+    ASSERT_TRUE(packets.empty());
+  }
+  
+  string error;
+  vector<vector<uint8_t> > packets;
+  ASSERT_FALSE(LoadPacketLog("{}", 2, 2, &packets, &error));
+}
+
+}
@@ -1,5 +1,6 @@
-
 #include "net/tun_interface.h"
+#include "net/gso.h"
+#include "net/tun_uring.h"
 #include "base/event_loop.h"
 
 #include <sys/types.h>
@@ -9,60 +10,435 @@
 #include <linux/if.h>
 #include <linux/if_tun.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
 
+#include <algorithm>
+
 namespace cheaproute {
+
+// Buffers that aren't returned right away (by listeners that queue packets)
+// make the pool grow; past this many, reads stop until some come back
+const size_t kMaxTunQueueBuffers = 8192;
+const size_t kTunBuffersPerSlab = 256;
+
+// Offload buffers are 16 times bigger, so keep fewer of them around
+const size_t kMaxTunOffloadQueueBuffers = 512;
+const size_t kTunOffloadBuffersPerSlab = 16;
+
+namespace {
+  class MultiQueueListenerHandle : public ListenerHandle {
+  public:
+    void Add(shared_ptr<ListenerHandle> handle) {
+      handles_.push_back(handle);
+    }
+  private:
+    vector<shared_ptr<ListenerHandle> > handles_;
+  };
+}
+
+// io_uring reads the virtio header straight into the buffer's headroom
+static size_t TunBufferHeadroom(TunFlags flags) {
+  if ((flags & TunFlags_Offload) && (flags & TunFlags_IoUring))
+    return sizeof(VirtioNetHeader);
+  return 0;
+}
+
+TunQueue::TunQueue(EventLoop* loop, int fd, TunFlags flags)
+  : loop_(CheckNotNull(loop, "loop")),
+    offload_(flags & TunFlags_Offload),
+    broadcaster_(new Broadcaster<TunListener>()),
+    buffer_pool_(offload_ ? kMaxTunOffloadPacketSize : kMaxTunPacketSize, 
+                 offload_ ? kTunOffloadBuffersPerSlab : kTunBuffersPerSlab, 
+                 offload_ ? kMaxTunOffloadQueueBuffers : kMaxTunQueueBuffers,
+                 TunBufferHeadroom(flags)),
+    batch_(kDefaultTunReadBudget),
+    reads_stalled_(false),
+    segment_pool_(kMaxTunPacketSize, kTunBuffersPerSlab, kMaxTunQueueBuffers),
+    segment_batch_(0),
+    segment_batch_ready_(false),
+    tx_queue_limit_(kDefaultTunTxQueueLimit) {
+  fd_.set(fd);
+  
+  if (flags & TunFlags_IoUring) {
+    uring_.reset(TunUring::Create(loop, fd_.get(), offload_, &buffer_pool_, 
+                                  &stats_, 
+                                  bind(&TunQueue::PacketRead, this, _1),
+                                  bind(&TunQueue::DeliverReads, this)));
+    
+    // The fd stays blocking, so io_uring waits for packets instead of
+    // failing reads with EAGAIN
+    if (uring_.get())
+      return;
+    printf("io_uring is not available; using read() and write() instead\n");
+  }
+  
+  int fd_flags = CheckFdOp(fcntl(fd_.get(), F_GETFL, 0), "Getting socket flags");
+  CheckFdOp(fcntl(fd_.get(), F_SETFL, fd_flags | O_NONBLOCK), 
+            "Enabling non-blocking behavior on TUN socket");
+  
+  ioTask_ = loop->MonitorFd(fd_.get(), kEvRead, bind(&TunQueue::HandleRead, this, _1));
+  
+  // Only watched while there are packets waiting in tx_queue_
+  write_task_ = loop->MonitorFd(fd_.get(), kEvWrite, bind(&TunQueue::HandleWrite, this, _1));
+  write_task_->Pause();
+}
+
+TunQueue::~TunQueue() {
+  if (reads_stalled_)
+    loop_->Unref();
+}
+
+TunQueue::WriteResult TunQueue::WritePacket(const void* data, size_t size,
+                                            const GsoInfo& gso) {
+  VirtioNetHeader header;
+  iovec iov[2];
+  if (offload_) {
+    GsoInfoToVirtioHeader(gso, &header);
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = const_cast<void*>(data);
+    iov[1].iov_len = size;
+  }
+  
+  while (true) {
+    ssize_t bytes_written = offload_ ? writev(fd_.get(), iov, 2) 
+                                     : write(fd_.get(), data, size);
+    if (bytes_written != -1) {
+      stats_.packets_sent++;
+      return WriteResult_Sent;
+    }
+    
+    switch (errno) {
+      case EINTR:
+        continue;
+        
+      case EAGAIN:
+        return WriteResult_WouldBlock;
+        
+      // The kernel didn't like this particular packet, or the interface
+      // isn't up; neither is a reason to stop forwarding
+      case EINVAL:
+      case EMSGSIZE:
+      case EIO:
+      case EBADFD:
+        stats_.send_errors++;
+        return WriteResult_Failed;
+        
+      default:
+        AbortWithPosixError("Unable to write to TUN device");
+    }
+  }
+}
+
+void TunQueue::EnqueuePacket(const PacketRef& packet) {
+  if (tx_queue_.size() >= tx_queue_limit_) {
+    stats_.packets_dropped++;
+    return;
+  }
+  
+  tx_queue_.push_back(packet);
+  stats_.packets_queued++;
+  stats_.tx_queue_depth = tx_queue_.size();
+  stats_.tx_queue_high_water = std::max(stats_.tx_queue_high_water, 
+                                        stats_.tx_queue_depth);
+  if (write_task_->paused())
+    write_task_->Resume();
+}
+
+void TunQueue::SendPacket(const void* data, size_t size) {
+  // Packets that are already waiting go first
+  if (!uring_.get() && tx_queue_.empty() && 
+      WritePacket(data, size, GsoInfo()) != WriteResult_WouldBlock) {
+    return;
+  }
+  
+  if (size > buffer_pool_.buffer_size()) {
+    stats_.send_errors++;
+    return;
+  }
+  PacketRef packet = buffer_pool_.Allocate();
+  if (packet.empty()) {
+    stats_.packets_dropped++;
+    return;
+  }
+  memcpy(packet->data(), data, size);
+  packet->set_size(size);
+  if (uring_.get()) {
+    SendPacket(packet);
+  } else {
+    EnqueuePacket(packet);
+  }
+}
+
+void TunQueue::SendPacket(const PacketRef& packet) {
+  if (!offload_ && packet->gso().needs_processing()) {
+    SendSegments(packet);
+    return;
+  }
+  
+  if (uring_.get()) {
+    if (!uring_->Send(packet))
+      stats_.packets_dropped++;
+    return;
+  }
+  
+  if (tx_queue_.empty() && 
+      WritePacket(packet.data(), packet.size(), packet->gso()) != WriteResult_WouldBlock) {
+    return;
+  }
+  EnqueuePacket(packet);
+}
+
+void TunQueue::SendSegments(const PacketRef& packet) {
+  vector<PacketRef> segments;
+  if (!SegmentPacket(packet, &segment_pool_, &segments)) {
+    stats_.send_errors++;
+    return;
+  }
+  for (size_t i = 0; i < segments.size(); i++) {
+    SendPacket(segments[i]);
+  }
+}
+
+void TunQueue::HandleWrite(int flags) {
+  while (!tx_queue_.empty()) {
+    const PacketRef& packet = tx_queue_.front();
+    if (WritePacket(packet.data(), packet.size(), packet->gso()) == 
+        WriteResult_WouldBlock) {
+      break;
+    }
+    tx_queue_.pop_front();
+  }
+  stats_.tx_queue_depth = tx_queue_.size();
+  
+  if (tx_queue_.empty())
+    write_task_->Pause();
+}
+
+void TunQueue::set_read_budget(size_t budget) {
+  if (budget < 1) {
+    AbortWithMessage("The TUN read budget must be at least 1");
+  }
+  batch_.Reserve(budget);
+  if (uring_.get())
+    uring_->set_read_depth(budget);
+}
+
+ssize_t TunQueue::ReadPacket(PacketBuffer* buffer) {
+  if (!offload_)
+    return read(fd_.get(), buffer->data(), buffer->capacity());
+  
+  // In offload mode every packet is preceded by a VirtioNetHeader
+  VirtioNetHeader header;
+  iovec iov[2];
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof(header);
+  iov[1].iov_base = buffer->data();
+  iov[1].iov_len = buffer->capacity();
+  
+  ssize_t bytes_read = readv(fd_.get(), iov, 2);
+  if (bytes_read == -1)
+    return -1;
+  if (bytes_read < static_cast<ssize_t>(sizeof(header))) {
+    AbortWithMessage("Short read of virtio header from TUN device");
+  }
+  buffer->set_gso(GsoInfoFromVirtioHeader(header));
+  return bytes_read - sizeof(header);
+}
+
+void TunQueue::DeliverBatch(TunListener* listener) {
+  if (!offload_ || !listener->wants_segments()) {
+    listener->PacketsReceived(batch_);
+    return;
+  }
+  
+  // Only segment once per wakeup, no matter how many listeners want it
+  if (!segment_batch_ready_) {
+    segments_.clear();
+    vector<PacketRef> packet_segments;
+    for (size_t i = 0; i < batch_.size(); i++) {
+      const PacketRef& packet = batch_.packet(i);
+      if (!packet->gso().needs_processing()) {
+        segments_.push_back(packet);
+        continue;
+      }
+      // Listeners that want segments only ever see plain packets, so a
+      // packet that was only partly segmented is left out altogether
+      packet_segments.clear();
+      if (SegmentPacket(packet, &segment_pool_, &packet_segments)) {
+        segments_.insert(segments_.end(), packet_segments.begin(),
+                         packet_segments.end());
+      } else {
+        stats_.segment_errors++;
+      }
+    }
+    segment_batch_.Reserve(segments_.size());
+    for (size_t i = 0; i < segments_.size(); i++) {
+      segment_batch_.Push(segments_[i]);
+    }
+    segments_.clear();
+    segment_batch_ready_ = true;
+  }
+  listener->PacketsReceived(segment_batch_);
+}
+
+void TunQueue::HandleRead(int flags) { 
+  // Drain the device until it runs dry or the budget is spent; anything
+  // left over will wake us up again on the next loop iteration
+  while (!batch_.full()) {
+    if (spare_buffer_.empty()) {
+      spare_buffer_ = buffer_pool_.Allocate(
+          bind(&TunQueue::BufferAvailable, this));
+      
+      // Every buffer is still held by a listener, so leave the rest of the
+      // packets in the kernel until one is released. The fd stays readable,
+      // so it mustn't be watched in the meantime or the loop would spin.
+      // The loop still has to wait for ResumeReads() to be posted, even if
+      // nothing else is left to watch.
+      if (spare_buffer_.empty()) {
+        ioTask_->Pause();
+        if (!reads_stalled_) {
+          reads_stalled_ = true;
+          loop_->Ref();
+        }
+        stats_.read_stalls++;
+        break;
+      }
+    }
+    
+    ssize_t bytes_read = ReadPacket(spare_buffer_.get());
+    if (bytes_read == -1) {
+      if (errno == EAGAIN || errno == EINTR)
+        break;
+      AbortWithPosixError("Reading data from TUN device");
+    }
+    spare_buffer_->set_size(bytes_read);
+    batch_.Push(spare_buffer_);
+    spare_buffer_.reset();
+  }
+  
+  DeliverReads();
+}
+
+// Called by the pool on whichever thread released the buffer
+void TunQueue::BufferAvailable() {
+  loop_->Post(bind(&TunQueue::ResumeReads, this));
+}
+
+void TunQueue::ResumeReads() {
+  if (reads_stalled_) {
+    reads_stalled_ = false;
+    loop_->Unref();
+  }
+  ioTask_->Resume();
+}
+
+void TunQueue::PacketRead(const PacketRef& packet) {
+  batch_.Push(packet);
+  if (batch_.full())
+    DeliverReads();
+}
+
+void TunQueue::DeliverReads() {
+  if (batch_.empty())
+    return;
+  
+  broadcaster_->Broadcast(bind(&TunQueue::DeliverBatch, this, _1));
+  
+  // Return the buffers nobody kept to the pool right away
+  batch_.Clear();
+  if (segment_batch_ready_) {
+    segment_batch_.Clear();
+    segment_batch_ready_ = false;
+  }
+}
  
 TunInterface::TunInterface(EventLoop* loop, const string& name) {
-  CheckNotNull(loop, "loop");
+  Init(vector<EventLoop*>(1, CheckNotNull(loop, "loop")), name, TunFlags_None);
+}
+
+TunInterface::TunInterface(const vector<EventLoop*>& loops, const string& name) {
+  Init(loops, name, TunFlags_None);
+}
+
+TunInterface::TunInterface(const vector<EventLoop*>& loops, const string& name,
+                           TunFlags flags) {
+  Init(loops, name, flags);
+}
+
+void TunInterface::Init(const vector<EventLoop*>& loops, const string& name,
+                        TunFlags flags) {
+  if (loops.empty()) {
+    AbortWithMessage("A TUN interface needs at least one queue");
+  }
   
   if (name.size() >= IFNAMSIZ) {
     AbortWithMessage("ifname %s is too long; maximum length is %d\n", 
                      name.c_str(), IFNAMSIZ);
   }
   
-  fd_.set(CheckFdOp(open("/dev/net/tun", O_RDWR), "Opening TUN device"));
+  bool multi_queue = loops.size() > 1;
+  bool offload = flags & TunFlags_Offload;
   
   ifreq req;
-  memset(&req, 0, sizeof(req));
-  req.ifr_flags = IFF_TUN | IFF_NO_PI;
-  strcpy(req.ifr_name, name.c_str());
-  CheckFdOp(ioctl(fd_.get(), TUNSETIFF, (void*) &req), "setting interface name");
-  CheckFdOp(ioctl(fd_.get(), TUNSETNOCSUM, 1), "disabling checksum validation"); 
-  
-  printf("created TUN interface with name %s\n", req.ifr_name);
-  
-  ioTask_ = loop->MonitorFd(fd_.get(), kEvRead, bind(&TunInterface::HandleRead, this, _1));
+  for (size_t i = 0; i < loops.size(); i++) {
+    int fd = CheckFdOp(open("/dev/net/tun", O_RDWR), "Opening TUN device");
   
-  int flags = CheckFdOp(fcntl(fd_.get(), F_GETFL, 0), "Getting socket flags");
-  CheckFdOp(fcntl(fd_.get(), F_SETFL, flags | O_NONBLOCK), 
-            "Enabling non-blocking behavior on TUN socket");
+    // Every TUNSETIFF with the same name and IFF_MULTI_QUEUE attaches
+    // another queue to the same device
+    memset(&req, 0, sizeof(req));
+    req.ifr_flags = IFF_TUN | IFF_NO_PI;
+    if (multi_queue)
+      req.ifr_flags |= IFF_MULTI_QUEUE;
+    if (offload)
+      req.ifr_flags |= IFF_VNET_HDR;
+    strcpy(req.ifr_name, name.c_str());
+    CheckFdOp(ioctl(fd, TUNSETIFF, (void*) &req), "setting interface name");
+    CheckFdOp(ioctl(fd, TUNSETNOCSUM, 1), "disabling checksum validation"); 
+    
+    if (offload) {
+      int header_size = sizeof(VirtioNetHeader);
+      CheckFdOp(ioctl(fd, TUNSETVNETHDRSZ, &header_size), 
+                "setting virtio header size");
+      
+      // Tells the kernel it may send us TCP super-packets with partial
+      // checksums instead of segmenting them first
+      unsigned int offloads = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN;
+      CheckFdOp(ioctl(fd, TUNSETOFFLOAD, offloads), "enabling TUN offloads");
+    }
+    
+    queues_.push_back(shared_ptr<TunQueue>(new TunQueue(loops[i], fd, flags)));
+  }
   
-  broadcaster_.reset(new Broadcaster<TunListener>());
+  printf("created TUN interface with name %s (%zu queues)\n", req.ifr_name, 
+         queues_.size());
 }
 
+void TunInterface::set_read_budget(size_t budget) {
+  for (size_t i = 0; i < queues_.size(); i++) {
+    queues_[i]->set_read_budget(budget);
+  }
+}
 
-void TunInterface::SendPacket(const void* data, size_t size) {
-  
-  ssize_t bytes_written = write(fd_.get(), data, size);
-  if (bytes_written == -1) {
-    if (errno == EAGAIN) {
-      printf("Dropped packet; EAGAIN received from write()\n");
-    } else {
-      AbortWithPosixError("Unable to write to TUN device");
-    }
+void TunInterface::set_tx_queue_limit(size_t limit) {
+  for (size_t i = 0; i < queues_.size(); i++) {
+    queues_[i]->set_tx_queue_limit(limit);
   }
 }
 
-void TunInterface::HandleRead(int flags) { 
-  uint8_t buffer[4096];
-  ssize_t bytes_read = CheckFdOp(read(fd_.get(), &buffer, sizeof(buffer)), 
-                                 "Reading data from TUN device");
-  broadcaster_->Broadcast(
-    bind(&TunListener::PacketReceived, _1, buffer, bytes_read));
+shared_ptr<ListenerHandle> TunInterface::AddListener(TunListener* listener) {
+  if (queues_.size() == 1)
+    return queues_[0]->AddListener(listener);
   
+  MultiQueueListenerHandle* handle = new MultiQueueListenerHandle();
+  shared_ptr<ListenerHandle> result(handle);
+  for (size_t i = 0; i < queues_.size(); i++) {
+    handle->Add(queues_[i]->AddListener(listener));
+  }
+  return result;
 }
   
-}
\ No newline at end of file
+}
@@ -1,32 +1,215 @@
-
 #include "base/common.h"
 #include "base/file_descriptor.h"
 #include "base/broadcaster.h"
+#include "net/packet_batch.h"
 
 namespace cheaproute {
   class EventLoop;
   class IoTask;
+  class TunUring;
   
   class TunListener {
   public:
     virtual void PacketReceived(const void* data, size_t size) = 0;
+    
+    // Listeners that want to keep a packet beyond the callback (to queue
+    // it, or hand it to another thread) should override this and keep a
+    // copy of the PacketRef instead of copying the data.
+    virtual void PacketReceived(const PacketRef& packet) {
+      PacketReceived(packet.data(), packet.size());
+    }
+    
+    // Called once per read wakeup with every packet that was drained from
+    // the queue. Listeners that can amortize work across packets should
+    // override this; by default each packet goes to PacketReceived().
+    virtual void PacketsReceived(const PacketBatch& batch) {
+      for (size_t i = 0; i < batch.size(); i++) {
+        PacketReceived(batch.packet(i));
+      }
+    }
+    
+    // On a queue in offload mode, packets may be coalesced super-packets
+    // (see GsoInfo). Listeners that need to see the individual segments as
+    // they would appear on the wire (to log or inspect them) should return
+    // true here; everyone else gets the super-packets as they were read.
+    virtual bool wants_segments() const { return false; }
   };
   
-  class TunInterface {
+  enum TunFlags {
+    TunFlags_None = 0,
+    
+    // Enables IFF_VNET_HDR and TCP segmentation/checksum offload, so the
+    // kernel can hand over (and accept) TCP super-packets of up to
+    // kMaxTunOffloadPacketSize bytes
+    TunFlags_Offload = (1 << 0),
+    
+    // Does packet I/O through io_uring (see TunUring) when the kernel
+    // supports it, and falls back to read() and write() otherwise
+    TunFlags_IoUring = (1 << 1)
+  };
+  
+  // The most packets a queue will read per wakeup unless told otherwise
+  const size_t kDefaultTunReadBudget = 32;
+  
+  // The largest packet a queue will read
+  const size_t kMaxTunPacketSize = 4096;
+  
+  // The largest packet a queue in offload mode will read
+  const size_t kMaxTunOffloadPacketSize = 65536;
+  
+  // How many packets a queue will hold back while the device is full,
+  // unless told otherwise
+  const size_t kDefaultTunTxQueueLimit = 1024;
+  
+  struct TunQueueStats {
+    TunQueueStats()
+      : packets_sent(0),
+        packets_queued(0),
+        packets_dropped(0),
+        send_errors(0),
+        segment_errors(0),
+        read_stalls(0),
+        tx_queue_depth(0),
+        tx_queue_high_water(0) {
+    }
+    
+    uint64_t packets_sent;
+    // Packets that had to wait in the transmit queue for the device
+    uint64_t packets_queued;
+    // Packets discarded because the transmit queue was full
+    uint64_t packets_dropped;
+    // Packets the kernel refused (malformed, or the device was down)
+    uint64_t send_errors;
+    // Super-packets that couldn't be segmented for listeners that wanted
+    // segments
+    uint64_t segment_errors;
+    // Times reads stopped because listeners were holding every buffer
+    uint64_t read_stalls;
+    size_t tx_queue_depth;
+    size_t tx_queue_high_water;
+  };
+  
+  // A single packet queue of a TUN device. Everything about a queue
+  // (its listeners and its reads) happens on the thread running its loop.
+  class TunQueue {
   public:
-    TunInterface(EventLoop* loop, const string& name);
+    ~TunQueue();
     
     shared_ptr<ListenerHandle> AddListener(TunListener* listener) {
       return broadcaster_->AddListener(listener);
     }
+    // Writes the packet to the device. If the device can't take it right
+    // now, the packet waits in a bounded transmit queue that is flushed as
+    // soon as the device becomes writable again; it is only dropped if that
+    // queue is full. Must be called from the queue's loop thread.
     void SendPacket(const void* data, size_t size);
     
+    // Like SendPacket(data, size), but a packet that has to wait is queued
+    // by reference rather than copied. Super-packets sent to a queue that
+    // isn't in offload mode are segmented first.
+    void SendPacket(const PacketRef& packet);
+    
+    bool offload() const { return offload_; }
+    bool uses_io_uring() const { return uring_.get() != NULL; }
+    
+    EventLoop* loop() const { return loop_; }
+    
+    // The pool this queue reads packets into; also handy for building
+    // packets that will be sent on this queue
+    PacketBufferPool* buffer_pool() { return &buffer_pool_; }
+    
+    // Sets how many packets HandleRead will drain before yielding back to
+    // the event loop. Must be called from the queue's loop thread.
+    void set_read_budget(size_t budget);
+    size_t read_budget() const { return batch_.capacity(); }
+    
+    // Doesn't apply to io_uring queues, which have a fixed number of writes
+    // in flight instead of a transmit queue
+    void set_tx_queue_limit(size_t limit) { tx_queue_limit_ = limit; }
+    size_t tx_queue_limit() const { return tx_queue_limit_; }
+    
+    const TunQueueStats& stats() const { return stats_; }
+    
   private:
+    friend class TunInterface;
+    friend class TunQueueTest;
+    TunQueue(EventLoop* loop, int fd, TunFlags flags);
+    TunQueue(const TunQueue& other);
+    
     void HandleRead(int flags);
+    void BufferAvailable();
+    void ResumeReads();
+    ssize_t ReadPacket(PacketBuffer* buffer);
+    void PacketRead(const PacketRef& packet);
+    void DeliverReads();
+    void DeliverBatch(TunListener* listener);
+    void HandleWrite(int flags);
+    
+    enum WriteResult {
+      WriteResult_Sent,
+      WriteResult_WouldBlock,
+      WriteResult_Failed
+    };
+    WriteResult WritePacket(const void* data, size_t size, const GsoInfo& gso);
+    void EnqueuePacket(const PacketRef& packet);
+    void SendSegments(const PacketRef& packet);
     
     EventLoop* loop_;
     FileDescriptor fd_;
+    bool offload_;
     shared_ptr<Broadcaster<TunListener> > broadcaster_;
     shared_ptr<IoTask> ioTask_;
+    shared_ptr<IoTask> write_task_;
+    PacketBufferPool buffer_pool_;
+    PacketBatch batch_;
+    PacketRef spare_buffer_;
+    // Set while reads wait for a buffer to be released, which holds a
+    // reference on the loop
+    bool reads_stalled_;
+    
+    // Holds the segments of super-packets, for listeners that want them and
+    // for sending to a device that can't take super-packets
+    PacketBufferPool segment_pool_;
+    vector<PacketRef> segments_;
+    PacketBatch segment_batch_;
+    bool segment_batch_ready_;
+    deque<PacketRef> tx_queue_;
+    size_t tx_queue_limit_;
+    TunQueueStats stats_;
+    
+    // Only set for queues that do their I/O through io_uring
+    scoped_ptr<TunUring> uring_;
+  };
+  
+  class TunInterface {
+  public:
+    TunInterface(EventLoop* loop, const string& name);
+    
+    // Creates a multi-queue (IFF_MULTI_QUEUE) device with one queue per
+    // loop. The kernel spreads flows across the queues, so each loop can be
+    // run on its own thread.
+    TunInterface(const vector<EventLoop*>& loops, const string& name);
+    TunInterface(const vector<EventLoop*>& loops, const string& name, 
+                 TunFlags flags);
+    
+    // Listeners added here receive packets from every queue, so they will be
+    // called concurrently if the queue loops run on different threads.
+    shared_ptr<ListenerHandle> AddListener(TunListener* listener);
+    void SendPacket(const void* data, size_t size) {
+      queues_[0]->SendPacket(data, size);
+    }
+    
+    // Sets the read budget of every queue; see TunQueue::set_read_budget()
+    void set_read_budget(size_t budget);
+    void set_tx_queue_limit(size_t limit);
+    
+    size_t queue_count() const { return queues_.size(); }
+    TunQueue* queue(size_t index) { return queues_[index].get(); }
+    
+  private:
+    void Init(const vector<EventLoop*>& loops, const string& name, 
+              TunFlags flags);
+    
+    vector<shared_ptr<TunQueue> > queues_;
   };
-}
\ No newline at end of file
+}
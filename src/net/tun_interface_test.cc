@@ -0,0 +1,238 @@
+#include "net/tun_interface.h"
+#include "net/gso.h"
+#include "net/packet_buffer.h"
+#include "base/event_loop.h"
+#include "base/event_loop_thread.h"
+
+#include "gtest/gtest.h"
+
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/socket.h>
+
+namespace cheaproute {
+
+class TunQueueTest : public testing::Test {
+protected:
+  // A SOCK_SEQPACKET socket hands over one packet per read(), like a TUN
+  // device does
+  void CreateQueue(TunFlags flags) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds));
+    peer_fd_.set(fds[1]);
+    queue_.reset(NewQueue(&loop_, fds[0], flags));
+  }
+  
+  TunQueue* NewQueue(EventLoop* loop, int fd, TunFlags flags) {
+    return new TunQueue(loop, fd, flags);
+  }
+  
+  void SendFromPeer(size_t size) {
+    vector<uint8_t> packet(size, 0x45);
+    ASSERT_EQ(static_cast<ssize_t>(size), 
+              write(peer_fd_.get(), &packet[0], size));
+  }
+  
+  // Sends a TCP packet with payload_size bytes of payload, preceded by a
+  // virtio header that asks for it to be split into segment_size pieces
+  // (or for nothing at all if segment_size is 0)
+  void SendOffloadFromPeer(size_t payload_size, uint16_t segment_size) {
+    size_t size = sizeof(iphdr) + sizeof(tcphdr) + payload_size;
+    vector<uint8_t> message(sizeof(VirtioNetHeader) + size);
+    GsoInfo gso;
+    if (segment_size > 0) {
+      gso.type = GsoType_Tcp4;
+      gso.segment_size = segment_size;
+    }
+    VirtioNetHeader header;
+    GsoInfoToVirtioHeader(gso, &header);
+    memcpy(&message[0], &header, sizeof(header));
+    
+    uint8_t* p = &message[sizeof(header)];
+    iphdr* ip_header = reinterpret_cast<iphdr*>(p);
+    ip_header->version = 4;
+    ip_header->ihl = 5;
+    ip_header->ttl = 64;
+    ip_header->protocol = IPPROTO_TCP;
+    ip_header->tot_len = htons(static_cast<uint16_t>(size));
+    tcphdr* tcp_header = reinterpret_cast<tcphdr*>(p + sizeof(iphdr));
+    tcp_header->doff = 5;
+    ASSERT_EQ(static_cast<ssize_t>(message.size()), 
+              write(peer_fd_.get(), &message[0], message.size()));
+  }
+  
+  // Runs the loop for a while, then stops watching the queue's fd so that
+  // Run() returns
+  void RunFor(double seconds) {
+    loop_.Schedule(seconds, bind(&TunQueueTest::StopReading, this));
+    loop_.Run();
+  }
+  
+  void StopReading() {
+    queue_->ioTask_->Pause();
+  }
+  
+  // Runs the loop until the queue is destroyed, which takes every task the
+  // queue had on the loop with it
+  void RunUntilDestroyed(double seconds) {
+    loop_.Schedule(seconds, bind(&TunQueueTest::DestroyQueue, this));
+    loop_.Run();
+  }
+  
+  void DestroyQueue() {
+    queue_.reset();
+  }
+  
+  EventLoop loop_;
+  FileDescriptor peer_fd_;
+  PacketBufferPool* segment_pool() { return &queue_->segment_pool_; }
+  
+  scoped_ptr<TunQueue> queue_;
+};
+
+class CountingTunListener : public TunListener {
+public:
+  CountingTunListener() : packets_received(0) {}
+  
+  void PacketReceived(const void* data, size_t size) {
+    packets_received++;
+  }
+  
+  int packets_received;
+};
+
+class CountingSegmentListener : public CountingTunListener {
+public:
+  bool wants_segments() const { return true; }
+};
+
+// Holds on to every buffer of a pool until Release() is called
+struct BufferHolder {
+  explicit BufferHolder(PacketBufferPool* pool) {
+    while (true) {
+      PacketRef packet = pool->Allocate();
+      if (packet.empty())
+        break;
+      held.push_back(packet);
+    }
+  }
+  
+  // Records how far the loop got while the buffers were held
+  void Release(EventLoop* loop, const CountingTunListener* listener) {
+    iterations_held = loop->stats().iterations;
+    packets_received_held = listener->packets_received;
+    held.clear();
+  }
+  
+  vector<PacketRef> held;
+  uint64_t iterations_held;
+  int packets_received_held;
+};
+
+TEST_F(TunQueueTest, ReadsStopWhileEveryBufferIsHeld) {
+  CreateQueue(TunFlags_None);
+  CountingTunListener listener;
+  shared_ptr<ListenerHandle> handle = queue_->AddListener(&listener);
+  
+  BufferHolder holder(queue_->buffer_pool());
+  SendFromPeer(100);
+  SendFromPeer(200);
+  SendFromPeer(300);
+  
+  // The fd stays readable, so a loop that kept watching it would go round
+  // and round until the buffers were released. Letting go of them starts
+  // the reads again; the stalled queue keeps the loop running until then.
+  loop_.Schedule(0.1, bind(&BufferHolder::Release, &holder, &loop_, 
+                           &listener));
+  RunFor(0.2);
+  ASSERT_LT(holder.iterations_held, 10u);
+  ASSERT_EQ(0, holder.packets_received_held);
+  ASSERT_EQ(3, listener.packets_received);
+  ASSERT_EQ(1u, queue_->stats().read_stalls);
+}
+
+TEST_F(TunQueueTest, LeavesOutPartlySegmentedPackets) {
+  CreateQueue(TunFlags_Offload);
+  CountingSegmentListener listener;
+  shared_ptr<ListenerHandle> handle = queue_->AddListener(&listener);
+  
+  // Leave room for just one segment of the three
+  BufferHolder holder(segment_pool());
+  holder.held.pop_back();
+  
+  SendOffloadFromPeer(2500, 1000);
+  SendOffloadFromPeer(100, 0);
+  RunFor(0.1);
+  ASSERT_EQ(1, listener.packets_received);
+  ASSERT_EQ(1u, queue_->stats().segment_errors);
+}
+
+TEST_F(TunQueueTest, TearsDownWithIoUringReadsInFlight) {
+  CreateQueue(TunFlags_IoUring);
+  if (!queue_->uses_io_uring())
+    return;
+  CountingTunListener listener;
+  shared_ptr<ListenerHandle> handle = queue_->AddListener(&listener);
+  
+  // Reads get posted just before the loop first waits, and are still in
+  // flight when the queue goes away
+  SendFromPeer(100);
+  RunUntilDestroyed(0.1);
+  ASSERT_EQ(1, listener.packets_received);
+}
+
+// Counts packets from the loop's thread, and waits for them on another
+class ThreadedCountingListener : public TunListener {
+public:
+  ThreadedCountingListener() : packets_received_(0) {}
+  
+  void PacketReceived(const void* data, size_t size) {
+    __sync_fetch_and_add(&packets_received_, 1);
+  }
+  
+  // Returns false if count packets didn't arrive within a second
+  bool WaitForPackets(int count) {
+    for (int i = 0; i < 1000; i++) {
+      if (__sync_fetch_and_add(&packets_received_, 0) >= count)
+        return true;
+      usleep(1000);
+    }
+    return false;
+  }
+  
+private:
+  int packets_received_;
+};
+
+static void DestroyTunQueue(scoped_ptr<TunQueue>* queue) {
+  queue->reset();
+}
+
+TEST_F(TunQueueTest, StalledQueueKeepsItsLoopThreadRunning) {
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds));
+  FileDescriptor peer_fd(fds[1]);
+  EventLoopThread thread;
+  scoped_ptr<TunQueue> queue(NewQueue(thread.loop(), fds[0], TunFlags_None));
+  ThreadedCountingListener listener;
+  shared_ptr<ListenerHandle> handle = queue->AddListener(&listener);
+  
+  BufferHolder holder(queue->buffer_pool());
+  ASSERT_EQ(1, write(peer_fd.get(), "x", 1));
+  thread.Start();
+  
+  // By now the queue has stalled, and has nothing left to watch but the
+  // ResumeReads() that releasing a buffer posts to it
+  usleep(100000);
+  holder.held.clear();
+  ASSERT_TRUE(listener.WaitForPackets(1));
+  
+  // Once the queue is gone, nothing keeps the loop running any more
+  thread.loop()->Post(bind(&DestroyTunQueue, &queue));
+  thread.Join();
+}
+
+}
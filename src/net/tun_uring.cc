@@ -0,0 +1,261 @@
+#include "net/tun_uring.h"
+#include "net/tun_interface.h"
+#include "base/event_loop.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace cheaproute {
+
+const unsigned kTunUringSubmitEntries = 256;
+const unsigned kTunUringCompletionEntries = 2048;
+
+// Must be a power of two
+const unsigned kTunUringBufferRingSize = 128;
+
+// Stays well under kTunUringCompletionEntries, so the completion queue
+// can't overflow even with every read and write in flight
+const size_t kTunUringMaxWrites = 1024;
+
+// Writes are tagged with their slot in writes_, reads and cancellations
+// with these
+const uint64_t kReadUserData = UINT64_MAX;
+const uint64_t kCancelUserData = UINT64_MAX - 1;
+
+TunUring* TunUring::Create(EventLoop* loop, int fd, bool offload, 
+                           PacketBufferPool* pool, TunQueueStats* stats,
+                           const function<void(const PacketRef&)>& packet_read,
+                           const function<void()>& reads_done) {
+  IoUring* ring = IoUring::Create(kTunUringSubmitEntries, 
+                                  kTunUringCompletionEntries);
+  if (!ring)
+    return NULL;
+  if (!ring->RegisterBufferRing(kTunUringBufferRingSize)) {
+    delete ring;
+    return NULL;
+  }
+  return new TunUring(loop, fd, offload, pool, stats, ring, packet_read, 
+                      reads_done);
+}
+
+TunUring::TunUring(EventLoop* loop, int fd, bool offload, 
+                   PacketBufferPool* pool, TunQueueStats* stats, IoUring* ring,
+                   const function<void(const PacketRef&)>& packet_read,
+                   const function<void()>& reads_done)
+  : loop_(loop),
+    fd_(fd),
+    offload_(offload),
+    pool_(CheckNotNull(pool, "pool")),
+    stats_(CheckNotNull(stats, "stats")),
+    packet_read_(packet_read),
+    reads_done_(reads_done),
+    ring_buffers_(kTunUringBufferRingSize),
+    buffers_on_ring_(0),
+    read_depth_(kDefaultTunReadBudget),
+    reads_in_flight_(0),
+    writes_(kTunUringMaxWrites),
+    ring_(ring) {
+  if (offload && pool->headroom() < sizeof(VirtioNetHeader)) {
+    AbortWithMessage("TUN buffer pool has no room for virtio headers");
+  }
+  
+  for (size_t i = 0; i < kTunUringBufferRingSize; i++) {
+    empty_buffer_ids_.push_back(static_cast<uint16_t>(i));
+  }
+  for (size_t i = 0; i < kTunUringMaxWrites; i++) {
+    free_writes_.push_back(i);
+  }
+  
+  completion_task_ = loop->MonitorFd(ring_->fd(), kEvRead, 
+                                     bind(&TunUring::HandleCompletions, this, _1));
+  flush_task_ = loop->AddPrepareHook(bind(&TunUring::Flush, this));
+}
+
+// The kernel keeps reading into the ring's buffers and writing from
+// writes_ until those operations complete, so they are cancelled and
+// reaped before any of it is released
+TunUring::~TunUring() {
+  size_t cancels_in_flight = 0;
+  if (reads_in_flight_ > 0 && 
+      ring_->PrepareCancel(kReadUserData, kCancelUserData)) {
+    cancels_in_flight++;
+  }
+  for (size_t i = 0; i < writes_.size(); i++) {
+    if (!writes_[i].packet.empty() && 
+        ring_->PrepareCancel(i, kCancelUserData)) {
+      cancels_in_flight++;
+    }
+  }
+  
+  size_t writes_in_flight = writes_.size() - free_writes_.size();
+  while (reads_in_flight_ > 0 || writes_in_flight > 0 || 
+         cancels_in_flight > 0) {
+    ring_->Submit();
+    IoCompletion completion;
+    if (!ring_->NextCompletion(&completion)) {
+      ring_->WaitForCompletion();
+      continue;
+    }
+    if (completion.user_data == kCancelUserData) {
+      cancels_in_flight--;
+    } else if (completion.user_data == kReadUserData) {
+      reads_in_flight_--;
+    } else {
+      writes_in_flight--;
+    }
+  }
+}
+
+bool TunUring::Send(const PacketRef& packet) {
+  if (free_writes_.empty())
+    return false;
+  
+  size_t index = free_writes_.back();
+  Write& write = writes_[index];
+  
+  unsigned iov_count = 0;
+  if (offload_) {
+    GsoInfoToVirtioHeader(packet->gso(), &write.header);
+    write.iov[iov_count].iov_base = &write.header;
+    write.iov[iov_count].iov_len = sizeof(write.header);
+    iov_count++;
+  }
+  write.iov[iov_count].iov_base = const_cast<void*>(packet.data());
+  write.iov[iov_count].iov_len = packet.size();
+  iov_count++;
+  
+  if (!ring_->PrepareWritev(fd_, write.iov, iov_count, index))
+    return false;
+  
+  write.packet = packet;
+  free_writes_.pop_back();
+  
+  stats_->tx_queue_depth = writes_.size() - free_writes_.size();
+  stats_->tx_queue_high_water = std::max(stats_->tx_queue_high_water, 
+                                         stats_->tx_queue_depth);
+  return true;
+}
+
+void TunUring::HandleCompletions(int flags) {
+  IoCompletion completion;
+  while (ring_->NextCompletion(&completion)) {
+    if (completion.user_data == kReadUserData) {
+      ReadCompleted(completion);
+    } else {
+      WriteCompleted(completion);
+    }
+  }
+  stats_->tx_queue_depth = writes_.size() - free_writes_.size();
+  reads_done_();
+}
+
+void TunUring::ReadCompleted(const IoCompletion& completion) {
+  reads_in_flight_--;
+  
+  PacketRef packet;
+  if (completion.has_buffer) {
+    buffers_on_ring_--;
+    packet.swap(ring_buffers_[completion.buffer_id]);
+    empty_buffer_ids_.push_back(completion.buffer_id);
+  }
+  
+  if (completion.result < 0) {
+    switch (-completion.result) {
+      // ENOBUFS means the ring ran dry before this read got a buffer; it
+      // gets posted again once there are buffers to read into
+      case ENOBUFS:
+      case EINTR:
+      case EAGAIN:
+        return;
+      default:
+        AbortWithPosixError(-completion.result, "Reading data from TUN device");
+    }
+  }
+  if (packet.empty()) {
+    AbortWithMessage("io_uring completed a TUN read without a buffer");
+  }
+  
+  size_t size = completion.result;
+  if (offload_) {
+    if (size < sizeof(VirtioNetHeader)) {
+      AbortWithMessage("Short read of virtio header from TUN device");
+    }
+    VirtioNetHeader header;
+    memcpy(&header, packet->data() - sizeof(header), sizeof(header));
+    packet->set_gso(GsoInfoFromVirtioHeader(header));
+    size -= sizeof(header);
+  }
+  packet->set_size(size);
+  packet_read_(packet);
+}
+
+void TunUring::WriteCompleted(const IoCompletion& completion) {
+  size_t index = completion.user_data;
+  writes_[index].packet.reset();
+  free_writes_.push_back(index);
+  
+  if (completion.result >= 0) {
+    stats_->packets_sent++;
+    return;
+  }
+  
+  switch (-completion.result) {
+    // Same as TunQueue::WritePacket(): a bad packet or an interface that
+    // is down isn't a reason to stop forwarding
+    case EINVAL:
+    case EMSGSIZE:
+    case EIO:
+    case EBADFD:
+      stats_->send_errors++;
+      break;
+    default:
+      AbortWithPosixError(-completion.result, "Unable to write to TUN device");
+  }
+}
+
+void TunUring::RefillBuffers() {
+  size_t headroom = offload_ ? sizeof(VirtioNetHeader) : 0;
+  while (!empty_buffer_ids_.empty()) {
+    PacketRef buffer = pool_->Allocate(bind(&TunUring::BufferAvailable, 
+                                            this));
+    
+    // Every buffer is held by a listener or a write; reads pick up again
+    // once one is released
+    if (buffer.empty())
+      break;
+    
+    uint16_t id = empty_buffer_ids_.back();
+    empty_buffer_ids_.pop_back();
+    ring_->AddBuffer(buffer->data() - headroom, 
+                     static_cast<unsigned>(buffer->capacity() + headroom), id);
+    ring_buffers_[id].swap(buffer);
+    buffers_on_ring_++;
+  }
+  ring_->PublishBuffers();
+}
+
+// Called by the pool on whichever thread released the buffer. Waking the
+// loop is enough, as Flush() runs before it waits again.
+void TunUring::BufferAvailable() {
+  loop_->Post(bind(&TunUring::Flush, this));
+}
+
+void TunUring::Flush() {
+  RefillBuffers();
+  
+  // Don't post more reads than there are buffers for; the extra reads
+  // would only fail with ENOBUFS
+  size_t headroom = offload_ ? sizeof(VirtioNetHeader) : 0;
+  unsigned size = static_cast<unsigned>(pool_->buffer_size() + headroom);
+  while (reads_in_flight_ < std::min(read_depth_, buffers_on_ring_)) {
+    if (!ring_->PrepareBufferedRead(fd_, size, kReadUserData))
+      break;
+    reads_in_flight_++;
+  }
+  
+  ring_->Submit();
+}
+
+}
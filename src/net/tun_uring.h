@@ -0,0 +1,88 @@
+#pragma once
+
+#include "base/common.h"
+#include "base/io_uring.h"
+#include "net/gso.h"
+#include "net/packet_buffer.h"
+
+#include <sys/uio.h>
+
+namespace cheaproute {
+
+class EventLoop;
+class IoTask;
+struct TunQueueStats;
+
+// Does the packet I/O of a TunQueue through io_uring instead of readiness
+// notifications and read()/write() calls. Reads stay posted against a ring
+// of provided buffers taken from the queue's pool, so a completed read
+// hands over a packet that is already in a PacketBuffer. Writes are
+// collected while the loop runs its callbacks and submitted together with
+// the next reads just before the loop waits again, so forwarding a whole
+// batch of packets costs a single system call.
+class TunUring {
+public:
+  // Returns NULL if the kernel doesn't support io_uring with provided buffer
+  // rings. In offload mode, the pool's buffers must have room for a
+  // VirtioNetHeader in their headroom. packet_read is called for every
+  // packet read, and reads_done once all completions have been handled.
+  static TunUring* Create(EventLoop* loop, int fd, bool offload, 
+                          PacketBufferPool* pool, TunQueueStats* stats,
+                          const function<void(const PacketRef&)>& packet_read,
+                          const function<void()>& reads_done);
+  ~TunUring();
+  
+  // Queues the packet to be written. Returns false if too many writes are
+  // already in flight.
+  bool Send(const PacketRef& packet);
+  
+  // Sets how many reads are kept posted at once
+  void set_read_depth(size_t depth) { read_depth_ = depth; }
+  
+private:
+  struct Write {
+    PacketRef packet;
+    VirtioNetHeader header;
+    iovec iov[2];
+  };
+  
+  TunUring(EventLoop* loop, int fd, bool offload, PacketBufferPool* pool, 
+           TunQueueStats* stats, IoUring* ring,
+           const function<void(const PacketRef&)>& packet_read,
+           const function<void()>& reads_done);
+  TunUring(const TunUring& other);
+  
+  void HandleCompletions(int flags);
+  void ReadCompleted(const IoCompletion& completion);
+  void WriteCompleted(const IoCompletion& completion);
+  void Flush();
+  void RefillBuffers();
+  void BufferAvailable();
+  
+  EventLoop* loop_;
+  int fd_;
+  bool offload_;
+  PacketBufferPool* pool_;
+  TunQueueStats* stats_;
+  function<void(const PacketRef&)> packet_read_;
+  function<void()> reads_done_;
+  
+  // The buffer behind each buffer id; empty while the buffer is off the
+  // ring, either because it was read into or because the pool ran dry
+  vector<PacketRef> ring_buffers_;
+  vector<uint16_t> empty_buffer_ids_;
+  size_t buffers_on_ring_;
+  size_t read_depth_;
+  size_t reads_in_flight_;
+  
+  vector<Write> writes_;
+  vector<size_t> free_writes_;
+  
+  // Declared before the tasks, so its fd is no longer watched by the time
+  // it gets closed
+  scoped_ptr<IoUring> ring_;
+  shared_ptr<IoTask> completion_task_;
+  shared_ptr<IoTask> flush_task_;
+};
+
+}
@@ -2,10 +2,13 @@
 // Copyright 2011 Kor Nielsen
 
 #include "base/common.h"
+#include "base/compression_stream.h"
 #include "base/event_loop.h"
 #include "base/stream.h"
 
+#include <algorithm>
 #include <stdio.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include "net/netlink.h"
 #include "net/netlink_monitor.h"
@@ -13,6 +16,7 @@
 #include "net/interface_activator.h"
 #include "base/json_writer.h"
 #include "net/json_packet.h"
+#include "net/packet_log_loader.h"
 #include "base/json_reader.h"
 
 namespace cheaproute
@@ -23,7 +27,8 @@ class TunPlaybackProgram
 public:
   TunPlaybackProgram(const string& iface_name, const string& packet_log_file)
       : iface_name_(iface_name),
-        packet_log_file_(packet_log_file) {
+        packet_log_file_(packet_log_file),
+        unmapped_log_read_(false) {
     loop_.reset(new EventLoop());
     netlink_.reset(new Netlink());
     netlink_monitor_.reset(new NetlinkMonitor(loop_.get()));
@@ -50,8 +55,49 @@ public:
   
 private:
   void Playback() {
+    // Regular files are mapped afresh for every playback. Anything else (a
+    // pipe, /dev/stdin) can't be mapped and can only be read once, so it
+    // gets read into memory the first time and played back from there.
+    struct stat st;
+    if (stat(packet_log_file_.c_str(), &st) == -1)
+      AbortWithPosixError("While opening %s", packet_log_file_.c_str());
+    
+    shared_ptr<InputStream> input;
+    const uint8_t* data = NULL;
+    size_t size = 0;
+    if (S_ISREG(st.st_mode)) {
+      shared_ptr<MappedFileInputStream> mapped_input(
+          new MappedFileInputStream(packet_log_file_.c_str()));
+      data = mapped_input->data();
+      size = mapped_input->size();
+      input = mapped_input;
+    } else {
+      if (!unmapped_log_read_) {
+        ReadUnmappedLog();
+      }
+      if (!unmapped_log_.empty()) {
+        data = &unmapped_log_[0];
+        size = unmapped_log_.size();
+      }
+      input.reset(new SpanInputStream(data, size));
+    }
+    
+    // Logs written with --compress-log are decompressed on the fly, others
+    // are loaded in parallel
+    CompressionFormat format = DetectCompressionFormat(
+        data, std::min<size_t>(size, 4));
+    if (format == CompressionFormat_None) {
+      PlaybackLog(data, size);
+      return;
+    }
+    
+    if (!IsCompressionFormatSupported(format))
+      AbortWithMessage("%s is compressed in a format this build can't read",
+                       packet_log_file_.c_str());
+    input.reset(new DecompressingInputStream(input, format));
+    
     JsonReader reader(shared_ptr<BufferedInputStream>(new BufferedInputStream(
-        shared_ptr<InputStream>(new FileInputStream(packet_log_file_.c_str())), 4096)));
+        input, 4096)));
     
     if (!reader.Next() || reader.token_type() != JSON_StartArray)
       AbortWithMessage("Expected start of array at top of json packet log");
@@ -63,10 +109,40 @@ private:
       if (!DeserializePacket(&reader, &packet, &error)) {
         AbortWithMessage("Error reading packet: %s\n", error.c_str());
       }
-      tun_->SendPacket(&packet[0], packet.size());
+      // An empty packet has nothing to send, nor a first byte to point at
+      if (!packet.empty())
+        tun_->SendPacket(&packet[0], packet.size());
+    }
+    loop_->Schedule(1.0, bind(&TunPlaybackProgram::Playback, this));
+  }
+  
+  void ReadUnmappedLog() {
+    FileInputStream input(packet_log_file_.c_str());
+    uint8_t buffer[65536];
+    ssize_t bytes_read;
+    while ((bytes_read = input.Read(buffer, sizeof(buffer))) > 0) {
+      unmapped_log_.insert(unmapped_log_.end(), buffer, buffer + bytes_read);
+    }
+    unmapped_log_read_ = true;
+  }
+  
+  // Uncompressed logs are deserialized up front, on every CPU
+  void PlaybackLog(const uint8_t* data, size_t size) {
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    vector<vector<uint8_t> > packets;
+    string error;
+    if (!LoadPacketLog(data, size, 
+                       static_cast<size_t>(std::max(cpu_count, 1L)), 
+                       &packets, &error)) {
+      AbortWithMessage("Error reading packet log: %s\n", error.c_str());
+    }
+    for (size_t i = 0; i < packets.size(); i++) {
+      if (!packets[i].empty())
+        tun_->SendPacket(&packets[i][0], packets[i].size());
     }
     loop_->Schedule(1.0, bind(&TunPlaybackProgram::Playback, this));
   }
+  
   TunPlaybackProgram(const TunPlaybackProgram& other);
   scoped_ptr<EventLoop> loop_;
   scoped_ptr<Netlink> netlink_;
@@ -75,6 +151,9 @@ private:
   scoped_ptr<InterfaceActivator> interface_activator_;
   string iface_name_;
   string packet_log_file_;
+  // The whole log, if it isn't a regular file
+  vector<uint8_t> unmapped_log_;
+  bool unmapped_log_read_;
 };
 
 }